@@ -0,0 +1,58 @@
+--
+-- Latency of array element and object key lookups as containers grow.
+--
+-- Offsets chunks are found by binary search over their headers, so the time
+-- per lookup should stay nearly flat from 10^2 up to 10^6 elements.  The
+-- values are detoasted once into PL/pgSQL variables, so only the lookups are
+-- measured.
+--
+-- Run with: psql -f bench/chunk_seek.sql in a database with jsonbc.
+--
+SET client_min_messages = notice;
+
+DO $$
+DECLARE
+	n		integer;
+	a		jsonbc;
+	x		jsonbc;
+	k		integer;
+	loops	constant integer := 100000;
+	t		timestamptz;
+BEGIN
+	FOREACH n IN ARRAY ARRAY[100, 1000, 10000, 100000, 1000000]
+	LOOP
+		a := (SELECT jsonb_agg(i)::text FROM generate_series(1, n) i)::jsonbc;
+		t := clock_timestamp();
+		FOR k IN 1..loops
+		LOOP
+			x := a -> (n - 1 - k % 1000);
+		END LOOP;
+		RAISE NOTICE 'array of % elements: % us per element lookup', n,
+			round((extract(epoch FROM clock_timestamp() - t) * 1e6 / loops)::numeric, 3);
+	END LOOP;
+END;
+$$;
+
+DO $$
+DECLARE
+	n		integer;
+	o		jsonbc;
+	x		jsonbc;
+	k		integer;
+	loops	constant integer := 100000;
+	t		timestamptz;
+BEGIN
+	FOREACH n IN ARRAY ARRAY[10, 100, 1000, 5000]
+	LOOP
+		o := (SELECT jsonb_object_agg('bench_key_' || i, i)::text
+			  FROM generate_series(1, n) i)::jsonbc;
+		t := clock_timestamp();
+		FOR k IN 1..loops
+		LOOP
+			x := o -> ('bench_key_' || (n - k % n));
+		END LOOP;
+		RAISE NOTICE 'object of % keys: % us per key lookup', n,
+			round((extract(epoch FROM clock_timestamp() - t) * 1e6 / loops)::numeric, 3);
+	END LOOP;
+END;
+$$;
@@ -7,225 +7,2902 @@
 
 #include "postgres.h"
 #include "access/hash.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
 #include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/snapmgr.h"
 
 #include "dict.h"
 
+void _PG_init(void);
+
 bool initialized = false;
 HTAB *idToNameHash, *nameToIdHash;
+static MemoryContext dictCacheContext = NULL;
 SPIPlanPtr savedPlanInsert = NULL;
 SPIPlanPtr savedPlanSelect = NULL;
+SPIPlanPtr savedPlanSelectId = NULL;
+SPIPlanPtr savedPlanRevive = NULL;
+SPIPlanPtr savedPlanSelectDict = NULL;
+SPIPlanPtr savedPlanSelectDictName = NULL;
+SPIPlanPtr savedPlanSelectValueKeys = NULL;
+SPIPlanPtr savedPlanSetValueKey = NULL;
+SPIPlanPtr savedPlanSelectLike = NULL;
+SPIPlanPtr savedPlanSelectRegex = NULL;
+SPIPlanPtr savedPlanSelectVersion = NULL;
+SPIPlanPtr savedPlanSelectPrevIds = NULL;
+
+/*
+ * Keys which have their string values stored in the dictionary, see
+ * dictEncodesValues().  Keys of a dictionary are loaded all at once, an
+ * entry with InvalidKeyId tells the dictionary is loaded.
+ */
+static HTAB *valueKeysHash = NULL;
+
+/*
+ * Previous ids of the keys of dictionaries being renumbered, see
+ * jsonbc_renumber_keys().  Values not rewritten yet still have them.  Keys of
+ * a dictionary are loaded all at once, an entry with InvalidKeyId tells the
+ * dictionary is loaded.  Previous ids never collide with the current ones.
+ */
+static MemoryContext prevIdsContext = NULL;
+static HTAB *prevIdToNameHash = NULL,
+		   *prevNameToIdHash = NULL;
+
+static bool prevLookupId(int32 dict, int32 id, KeyName *name);
 
+/*
+ * Hash keys.  Names and ids are only unique within a dictionary, so every
+ * cache is keyed by the dictionary as well.
+ */
 typedef struct
 {
+	int32	dict;
 	int32	id;
+} DictId;
+
+typedef struct
+{
+	int32	dict;
 	KeyName	name;
-} IdToName;
+} DictName;
 
 typedef struct
 {
+	DictId	key;
 	KeyName	name;
+} IdToName;
+
+typedef struct
+{
+	DictName key;
 	int32	id;
 } NameToId;
 
+/*
+ * Statistics.  Hits are lookups answered by the local or shared caches,
+ * misses are the ones which had to consult the negative cache or SPI.
+ * Backends accumulate them locally and add them to the shared totals at
+ * the end of each transaction.
+ */
+typedef struct
+{
+	int64		nameHits;
+	int64		nameMisses;
+	int64		idHits;
+	int64		idMisses;
+	int64		spiCalls;
+	int64		inserts;
+	int64		spiTime;		/* microseconds */
+} DictStats;
+
+static DictStats localStats;
+static DictStats flushedStats;	/* part of localStats already in shared */
+
+static void
+accountSPI(instr_time start)
+{
+	instr_time	duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	localStats.spiCalls++;
+	localStats.spiTime += INSTR_TIME_GET_MICROSEC(duration);
+}
+
+/*
+ * SPI_execute_plan() accounted in the statistics.
+ */
+static int
+dictExecutePlan(SPIPlanPtr plan, Datum *args, bool readOnly, long count)
+{
+	instr_time	start;
+	int			ret;
+
+	INSTR_TIME_SET_CURRENT(start);
+	ret = SPI_execute_plan(plan, args, NULL, readOnly, count);
+	accountSPI(start);
+
+	return ret;
+}
+
+/*
+ * Shared dictionary.
+ *
+ * When jsonbc is loaded via shared_preload_libraries, entries resolved by any
+ * backend are published into a pair of shared hash tables, so that a fresh
+ * backend can resolve already known keys without an SPI round trip.  Names
+ * are copied into an append-only arena which follows the header.  The shared
+ * memory segment is mapped at the same address in every backend, so KeyName
+ * pointers into the arena are valid everywhere.
+ */
+typedef struct
+{
+	LWLock	   *lock;
+	pg_atomic_uint64 generation;	/* bumped whenever dictionary grows */
+	pg_atomic_uint64 resets;		/* bumped whenever entries are removed */
+	pg_atomic_uint32 resetting;		/* changes being committed right now */
+	long		maxEntries;
+	long		nEntries;
+	Size		arenaSize;
+	Size		arenaUsed;
+	slock_t		statsMutex;
+	DictStats	stats;			/* totals of all the backends */
+	int64		version;		/* jsonbc_dict_version entries belong to */
+	char		arena[FLEXIBLE_ARRAY_MEMBER];
+} DictSharedState;
+
+/* rough estimate of an average key name length, used to size the arena */
+#define SHARED_DICT_AVG_NAME_LEN	24
+
+static int	sharedDictSize = 4096;	/* kB */
+static DictSharedState *dictShared = NULL;
+static HTAB *sharedIdToNameHash = NULL,
+		   *sharedNameToIdHash = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ * Entries resolved via SPI in the current transaction.  They are published
+ * to the shared dictionary only at commit, because an id inserted by an
+ * aborted (sub)transaction must never become visible to other backends.
+ */
+typedef struct
+{
+	int32	dict;
+	int32	id;
+	KeyName	name;
+	int		nestLevel;
+} PendingEntry;
+
+static PendingEntry *pendingEntries = NULL;
+static int	nPendingEntries = 0;
+static int	pendingEntriesSize = 0;
+static bool pendingEvicted = false;	/* some were evicted before commit */
+
+/*
+ * Negative cache.
+ *
+ * Remembers names and ids which were looked up via SPI and found missing,
+ * so that repeated probes of absent keys don't run a query each time.  The
+ * cache is only valid as long as the dictionary doesn't grow: it is tagged
+ * with the dictionary generation (see currentDictGeneration()) and reset
+ * once that changes.  When it's full, it's simply reset as well.
+ */
+static int	negativeCacheSize = 1024;
+static MemoryContext negCacheContext = NULL;
+static HTAB *negNameHash = NULL,
+		   *negIdHash = NULL;
+static long	negCacheEntries = 0;
+static uint64 negCacheGeneration = 0;
+
+static int64 negCacheHits = 0;
+static int64 negCacheMisses = 0;
+static int64 negCacheResets = 0;
+
+static void negCacheReset(void);
+static void negCacheForgetName(int32 dict, KeyName name);
+static void negCacheForgetId(int32 dict, int32 id);
+
+/* Load whole dictionary at first use? */
+static bool dictPrewarm = false;
+/* Number of entries loaded by the prewarm at first use */
+static int64 initPrewarmed = 0;
+
+/*
+ * Invalidation.
+ *
+ * Updates, deletes and truncation of jsonbc_dict fire a statement trigger
+ * (jsonbc_dict_invalidate()) which bumps jsonbc_dict_version and sends a
+ * relcache invalidation for the table.  Every cache remembers the version it
+ * was built at.  Relcache invalidations are also sent by VACUUM, ANALYZE and
+ * the like, so dictRelcacheCallback() only makes the next lookup recheck the
+ * version, and the cache is dropped only if the latest version is another.
+ * Invalidations arrive once the change is visible, so the latest snapshot
+ * is sure to see it.
+ *
+ * The shared dictionary is cleared right before the modifying transaction
+ * becomes visible, and its reset counter is bumped.  Until the commit is
+ * over, the resetting counter stays raised, and no backend keeps its local
+ * cache between lookups.  Then the shared dictionary is cleared once again,
+ * dropping entries resolved in the meantime.  Backends compare the reset
+ * counter against the value their cache was built at, so they notice the
+ * change even before the invalidation message arrives, and never publish
+ * entries resolved before it.
+ */
+static Oid	dictRelid = InvalidOid;
+static bool dictCacheStale = false;
+static bool dictCacheCheck = false;
+static bool dictRecheckAtEnd = false;
+static bool sharedResetPending = false;
+static bool sharedResetStarted = false;
+static uint64 cacheEpoch = 0;
+static int64 cacheVersion = 0;
+static int64 pendingVersion = 0;	/* 0 if unknown */
+static int	pendingVersionLevel = 0;
+
+static void sharedAdvance(int64 version);
+static int64 cacheGeneration = 0;
+
+/*
+ * Memory-mapped dictionary file, see dict_file.c.  Names looked up in the
+ * file point into the mapping, so a replaced file is only unmapped at the end
+ * of statement, like a retired cache context.
+ */
+static DictFile *dictFile = NULL;
+
+/*
+ * Replaced cache memory.  Names are handed out as pointers into the cache,
+ * and the caller might still use them after a later lookup has rebuilt it, so
+ * replaced memory is kept until the end of the top-level statement, or of the
+ * transaction if the statement doesn't go through the executor.
+ */
+static MemoryContext retiredContext = NULL;
+static List *retiredFiles = NIL;
+static int	executorDepth = 0;
+
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+
+static int64 prewarmDict(void);
+
+static DictId
+makeDictId(int32 dict, int32 id)
+{
+	DictId		key;
+
+	key.dict = dict;
+	key.id = id;
+	return key;
+}
+
+static DictName
+makeDictName(int32 dict, KeyName name)
+{
+	DictName	key;
+
+	key.dict = dict;
+	key.name = name;
+	return key;
+}
+
 static uint32
 name_hash(const void *key, Size keysize)
 {
-	const KeyName *name = (const KeyName *)key;
+	const DictName *name = (const DictName *)key;
 
-	return DatumGetUInt32(hash_any((unsigned char *)name->s, name->len));
+	return DatumGetUInt32(hash_any((unsigned char *)name->name.s, name->name.len)) ^
+		DatumGetUInt32(hash_uint32((uint32) name->dict));
 }
 
 static int
 name_match(const void *key1, const void *key2, Size keysize)
 {
-	const KeyName *name1 = (const KeyName *)key1;
-	const KeyName *name2 = (const KeyName *)key2;
+	const DictName *name1 = (const DictName *)key1;
+	const DictName *name2 = (const DictName *)key2;
+
+	if (name1->dict != name2->dict)
+	{
+		return (name1->dict > name2->dict) ? 1 : -1;
+	}
+	else if (name1->name.len == name2->name.len)
+	{
+		return memcmp(name1->name.s, name2->name.s, name1->name.len);
+	}
+	else
+	{
+		return (name1->name.len > name2->name.len) ? 1 : -1;
+	}
+}
+
+/*
+ * Dictionary snapshot.
+ *
+ * Entries cached in the hashes are periodically folded into compact
+ * per-dictionary snapshots.  Names are copied into a single arena, an array
+ * indexed by id maps ids to names, and an open addressing table of ids maps
+ * names back.  Lookups try the snapshot first, so decoding known keys costs
+ * an array access instead of a dynahash probe.  The snapshot is rebuilt
+ * once the hashes have collected as many new entries as it holds.  Entries
+ * resolved via SPI in the current transaction might still be rolled back,
+ * so they stay in the hashes, where an abort finds them.
+ */
+typedef struct
+{
+	uint32		offset;		/* offset of the name in the arena */
+	int32		len;		/* length of the name, -1 if the id is unknown */
+} SnapshotName;
+
+typedef struct
+{
+	int32		dict;
+	int32		maxId;		/* names[] has maxId + 1 elements */
+	SnapshotName *names;
+	bool	   *referenced;	/* by id, set on every lookup */
+	int32	   *slots;		/* ids by name hash, InvalidKeyId if empty */
+	uint32		mask;		/* number of slots minus one */
+	char	   *arena;
+} DictSnapshot;
+
+/* minimal number of new entries worth rebuilding the snapshot */
+#define SNAPSHOT_MIN_ENTRIES	64
+/* dictionaries with fewer than one in that many ids cached stay in hashes */
+#define SNAPSHOT_MAX_SPARSENESS	4
+
+/*
+ * Memory limit.
+ *
+ * The size of the local cache is estimated from the lengths of names plus
+ * a fixed overhead per entry.  Once it exceeds jsonbc.dict_cache_size, the
+ * next snapshot rebuild evicts entries CLOCK-wise: entries looked up since
+ * the previous sweep get a second chance, and the hand keeps going until
+ * the cache is down to three quarters of the limit.  The memory of evicted
+ * entries is released at the end of statement, see retireContext(), so the
+ * limit holds in the middle of a transaction as well.  Entries resolved in
+ * the current transaction are evicted like any other, they are just not
+ * published at commit then.
+ */
+#define HASH_ENTRY_OVERHEAD		(2 * (sizeof(IdToName) + sizeof(NameToId)))
+#define SNAPSHOT_ENTRY_OVERHEAD	(sizeof(SnapshotName) + sizeof(bool) + 2 * sizeof(int32))
+
+static int	dictCacheSize = 65536;	/* kB */
+static Size	cacheBytes = 0;
+static Size	rebuildBytes = 0;	/* cacheBytes right after the last rebuild */
+static long	clockHand = 0;
+
+/*
+ * Is it time to evict?  If eviction didn't manage to get below the limit
+ * (dense arrays of ids are not evicted), wait for the cache to grow a bit
+ * rather than rebuild it at every lookup.
+ */
+static inline bool
+cacheOverLimit(void)
+{
+	Size		limit = dictCacheSize * 1024L;
+
+	return dictCacheSize > 0 && cacheBytes > limit &&
+		cacheBytes >= rebuildBytes + limit / 16;
+}
+
+static MemoryContext snapshotContext = NULL;
+static DictSnapshot *snapshots = NULL;
+static int	nSnapshots = 0;
+static long	snapshotEntries = 0;
+static long	unfoldedEntries = 0;
+
+static void buildSnapshot(void);
+
+static inline DictSnapshot *
+findSnapshot(int32 dict)
+{
+	int			i;
+
+	for (i = 0; i < nSnapshots; i++)
+	{
+		if (snapshots[i].dict == dict)
+			return &snapshots[i];
+	}
+	return NULL;
+}
+
+static bool
+snapshotLookupId(int32 dict, int32 id, KeyName *name)
+{
+	DictSnapshot *snapshot = findSnapshot(dict);
+	SnapshotName *entry;
+
+	if (!snapshot || id <= 0 || id > snapshot->maxId)
+		return false;
+
+	entry = &snapshot->names[id];
+	if (entry->len < 0)
+		return false;
+
+	snapshot->referenced[id] = true;
+	name->s = snapshot->arena + entry->offset;
+	name->len = entry->len;
+	return true;
+}
+
+static bool
+snapshotLookupName(int32 dict, KeyName name, int32 *id)
+{
+	DictSnapshot *snapshot = findSnapshot(dict);
+	uint32		i;
+
+	if (!snapshot)
+		return false;
+
+	i = DatumGetUInt32(hash_any((unsigned char *) name.s, name.len)) & snapshot->mask;
+	while (snapshot->slots[i] != InvalidKeyId)
+	{
+		SnapshotName *entry = &snapshot->names[snapshot->slots[i]];
+
+		if (entry->len == name.len &&
+			memcmp(snapshot->arena + entry->offset, name.s, name.len) == 0)
+		{
+			*id = snapshot->slots[i];
+			snapshot->referenced[*id] = true;
+			return true;
+		}
+		i = (i + 1) & snapshot->mask;
+	}
+	return false;
+}
+
+static MemoryContext
+getRetiredContext(void)
+{
+	if (!retiredContext)
+		retiredContext = AllocSetContextCreate(TopMemoryContext,
+											   "jsonbc retired cache",
+											   ALLOCSET_SMALL_MINSIZE,
+											   ALLOCSET_SMALL_INITSIZE,
+											   ALLOCSET_SMALL_MAXSIZE);
+	return retiredContext;
+}
+
+/*
+ * Release memory of a replaced cache.  Names handed out before might still be
+ * used by the current statement, so the memory is only released at its end.
+ */
+static void
+retireContext(MemoryContext context)
+{
+	if (!context)
+		return;
+
+	if (IsTransactionState())
+		MemoryContextSetParent(context, getRetiredContext());
+	else
+		MemoryContextDelete(context);
+}
+
+static void
+releaseRetired(void)
+{
+	ListCell   *lc;
+
+	if (retiredContext)
+		MemoryContextReset(retiredContext);
+
+	foreach(lc, retiredFiles)
+		dictFileClose((DictFile *) lfirst(lc));
+	list_free(retiredFiles);
+	retiredFiles = NIL;
+}
+
+static void
+createHashes(long nelem)
+{
+	HASHCTL ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.hash = tag_hash;
+	ctl.hcxt = dictCacheContext;
+	ctl.keysize = sizeof(DictId);
+	ctl.entrysize = sizeof(IdToName);
+	idToNameHash = hash_create("Id to name map", nelem, &ctl,
+							 HASH_FUNCTION | HASH_CONTEXT | HASH_ELEM);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(DictName);
+	ctl.entrysize = sizeof(NameToId);
+	ctl.hash = name_hash;
+	ctl.match = name_match;
+	ctl.hcxt = dictCacheContext;
+	nameToIdHash = hash_create("Name to id map", nelem, &ctl,
+					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+}
+
+/*
+ * Drop the local cache.
+ */
+static void
+resetCache(void)
+{
+	retireContext(dictCacheContext);
+	dictCacheContext = NULL;
+	idToNameHash = NULL;
+	nameToIdHash = NULL;
+	initialized = false;
+
+	retireContext(snapshotContext);
+	snapshotContext = NULL;
+	snapshots = NULL;
+	nSnapshots = 0;
+	snapshotEntries = 0;
+	unfoldedEntries = 0;
+	cacheBytes = 0;
+	rebuildBytes = 0;
+
+	/* Entries resolved before the change must never be published */
+	nPendingEntries = 0;
+
+	if (dictFile)
+	{
+		if (IsTransactionState())
+		{
+			MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+			retiredFiles = lappend(retiredFiles, dictFile);
+			MemoryContextSwitchTo(oldcxt);
+		}
+		else
+			dictFileClose(dictFile);
+		dictFile = NULL;
+	}
+
+	if (valueKeysHash)
+	{
+		hash_destroy(valueKeysHash);
+		valueKeysHash = NULL;
+	}
+
+	retireContext(prevIdsContext);
+	prevIdsContext = NULL;
+	prevIdToNameHash = NULL;
+	prevNameToIdHash = NULL;
+
+	negCacheReset();
+	dictRelid = InvalidOid;
+	cacheGeneration++;
+}
+
+/*
+ * Current jsonbc_dict_version, as seen by our snapshot or, if latest is set,
+ * by the latest one.  Parallel workers can't take new snapshots, but they
+ * don't outlive the leader's transaction anyway.
+ */
+static int64
+readDictVersion(bool latest)
+{
+	instr_time	start;
+	int64		version;
+	bool		null;
+	Snapshot	snapshot;
+
+	SPI_connect();
+
+	if (!savedPlanSelectVersion)
+	{
+		savedPlanSelectVersion = SPI_prepare("SELECT version FROM jsonbc_dict_version;",
+											 0, NULL);
+		if (!savedPlanSelectVersion)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanSelectVersion))
+			elog(ERROR, "Error keeping plan");
+	}
+
+	/*
+	 * Output functions might run without an active snapshot, e.g. for FETCH
+	 * from a holdable cursor after the transaction which declared it.
+	 */
+	if (latest && !IsInParallelMode())
+		snapshot = GetLatestSnapshot();
+	else if (ActiveSnapshotSet())
+		snapshot = GetActiveSnapshot();
+	else
+		snapshot = GetTransactionSnapshot();
+
+	INSTR_TIME_SET_CURRENT(start);
+	if (SPI_execute_snapshot(savedPlanSelectVersion, NULL, NULL, snapshot,
+							 InvalidSnapshot, true, false, 1) != SPI_OK_SELECT)
+		elog(ERROR, "Failed to select from jsonbc_dict_version");
+	accountSPI(start);
+	if (SPI_processed == 0)
+		elog(ERROR, "jsonbc_dict_version is empty");
+	version = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, 1, &null));
+	SPI_finish();
+
+	return version;
+}
+
+/*
+ * Map the dictionary file, unless it was exported before the latest change
+ * of existing entries, i.e. at another version than the cache is built at.
+ */
+static void
+openDictFile(void)
+{
+	DictFile   *file = dictFileOpen();
+
+	if (!file)
+	{
+		dictWorkerRequestExport();
+		return;
+	}
+
+	if (dictFileVersion(file) == cacheVersion)
+		dictFile = file;
+	else
+	{
+		dictFileClose(file);
+		dictWorkerRequestExport();
+	}
+}
+
+static void
+checkInit()
+{
+	bool		resetting;
+
+	if (initialized)
+	{
+		if (dictCacheCheck && !dictCacheStale)
+		{
+			dictCacheCheck = false;
+			if (readDictVersion(true) != cacheVersion)
+				dictCacheStale = true;
+		}
+		if (!dictCacheStale &&
+			(!dictShared ||
+			 (pg_atomic_read_u64(&dictShared->resets) == cacheEpoch &&
+			  pg_atomic_read_u32(&dictShared->resetting) == 0)))
+		{
+			if (hash_get_num_entries(idToNameHash) - unfoldedEntries >=
+				Max(snapshotEntries, SNAPSHOT_MIN_ENTRIES) ||
+				cacheOverLimit())
+				buildSnapshot();
+			return;
+		}
+		resetCache();
+	}
+
+	dictCacheStale = false;
+	dictCacheCheck = false;
+	resetting = false;
+	if (dictShared)
+	{
+		cacheEpoch = pg_atomic_read_u64(&dictShared->resets);
+		resetting = pg_atomic_read_u32(&dictShared->resetting) > 0;
+	}
+	if (!OidIsValid(dictRelid))
+		dictRelid = RelnameGetRelid("jsonbc_dict");
+
+	/*
+	 * The cache is built at the version our snapshot sees, which might be
+	 * older than the latest one.  So the version is checked once again in
+	 * the next transaction.
+	 *
+	 * Our snapshot is taken after cacheEpoch was read.  A change committed
+	 * without a reset of the shared dictionary (e.g. a prepared one) is
+	 * noticed here, by the first backend which sees it.  Our own changes
+	 * are not committed yet, and are taken care of at commit.
+	 */
+	cacheVersion = readDictVersion(false);
+	dictRecheckAtEnd = true;
+	if (dictShared && !sharedResetPending)
+		sharedAdvance(cacheVersion);
+
+	dictCacheContext = AllocSetContextCreate(TopMemoryContext,
+											 "jsonbc dictionary cache",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+	createHashes(1024);
+	initialized = true;
+
+	/* The cache is going to be dropped at the next lookup anyway */
+	if (resetting)
+		return;
+
+	if (dictFileEnabled)
+		openDictFile();
+
+	if (dictPrewarm)
+		initPrewarmed = prewarmDict();
+}
+
+/*
+ * Add entry to the local cache.  Name must be already allocated in a
+ * long-lived memory context.
+ */
+static IdToName *
+addEntryNoCopy(int32 dict, int id, KeyName name)
+{
+	NameToId   *nameToId;
+	IdToName   *idToName;
+	DictName	nameKey = makeDictName(dict, name);
+	DictId		idKey = makeDictId(dict, id);
+	bool		found;
+
+	nameToId = (NameToId *) hash_search(nameToIdHash,
+									 (const void *)&nameKey,
+									 HASH_ENTER, &found);
+	nameToId->id = id;
+
+	negCacheForgetName(dict, name);
+	negCacheForgetId(dict, id);
+
+	idToName = (IdToName *) hash_search(idToNameHash,
+									 (const void *)&idKey,
+									 HASH_ENTER, &found);
+	idToName->name = name;
+	cacheBytes += name.len + HASH_ENTRY_OVERHEAD;
+
+	return idToName;
+}
+
+static IdToName *
+addEntry(int32 dict, int id, KeyName name)
+{
+	char	   *copy;
+
+	copy = MemoryContextAlloc(dictCacheContext, name.len);
+	memcpy(copy, name.s, name.len);
+	name.s = copy;
+
+	return addEntryNoCopy(dict, id, name);
+}
+
+/*
+ * Rebuild local hashes so that they are presized for nelem entries, keeping
+ * the entries already cached.
+ */
+static void
+resizeHashes(long nelem)
+{
+	HTAB	   *oldIdToNameHash = idToNameHash,
+			   *oldNameToIdHash = nameToIdHash;
+	HASH_SEQ_STATUS scan;
+	IdToName   *idToName;
+	Size		bytes = cacheBytes;
+
+	createHashes(nelem);
+
+	hash_seq_init(&scan, oldIdToNameHash);
+	while ((idToName = (IdToName *) hash_seq_search(&scan)) != NULL)
+		addEntryNoCopy(idToName->key.dict, idToName->key.id, idToName->name);
+	cacheBytes = bytes;
+
+	hash_destroy(oldIdToNameHash);
+	hash_destroy(oldNameToIdHash);
+}
+
+/*
+ * Load the whole dictionary into the local cache with a single scan of
+ * jsonbc_dict.  Returns the number of entries loaded.
+ */
+static int64
+prewarmDict(void)
+{
+	uint64		i,
+				nrows;
+	int64		nloaded = 0;
+	instr_time	start;
+
+	SPI_connect();
+
+	INSTR_TIME_SET_CURRENT(start);
+	if (SPI_execute("SELECT dict, id, name FROM jsonbc_dict WHERE NOT retired;", true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "Failed to select from dictionary");
+	accountSPI(start);
+
+	nrows = SPI_processed;
+
+	if (hash_get_num_entries(idToNameHash) + nrows > 1024)
+		resizeHashes(hash_get_num_entries(idToNameHash) + nrows);
+
+	for (i = 0; i < nrows; i++)
+	{
+		bool	null;
+		DictId	key;
+		text   *nameText;
+		KeyName	name;
+
+		key.dict = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &null));
+		key.id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &null));
+		if (snapshotLookupId(key.dict, key.id, &name) ||
+			hash_search(idToNameHash, (const void *)&key, HASH_FIND, NULL))
+			continue;
+
+		nameText = DatumGetTextPP(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 3, &null));
+		name.s = VARDATA_ANY(nameText);
+		name.len = VARSIZE_ANY_EXHDR(nameText);
+		addEntry(key.dict, key.id, name);
+		nloaded++;
+	}
+
+	SPI_finish();
+
+	buildSnapshot();
+
+	return nloaded;
+}
+
+/*
+ * Per-dictionary statistics collected while building a snapshot.
+ */
+typedef struct
+{
+	int32		dict;
+	int32		maxId;
+	long		count;
+	Size		arenaSize;
+	DictSnapshot *snapshot;	/* NULL if the dictionary is too sparse */
+} SnapshotStats;
+
+/*
+ * Evict entries until the cache fits into three quarters of the limit.
+ * Evicted entries get their name pointer reset.
+ */
+static void
+evictEntries(IdToName *entries, bool *referenced, long nEntries)
+{
+	Size		target = dictCacheSize * 1024L / 4 * 3;
+	Size		bytes = 0;
+	long		i,
+				swept;
+
+	for (i = 0; i < nEntries; i++)
+		bytes += entries[i].name.len + SNAPSHOT_ENTRY_OVERHEAD;
+
+	if (nEntries == 0)
+		return;
+	if (clockHand >= nEntries)
+		clockHand = 0;
+
+	/* Two turns of the hand: the second one evicts everything it meets */
+	for (swept = 0; swept < 2 * nEntries && bytes > target; swept++)
+	{
+		i = clockHand;
+		clockHand = (clockHand + 1) % nEntries;
+
+		if (!entries[i].name.s)
+			continue;
+		if (referenced[i])
+		{
+			referenced[i] = false;
+			continue;
+		}
+		bytes -= entries[i].name.len + SNAPSHOT_ENTRY_OVERHEAD;
+		entries[i].name.s = NULL;
+	}
+}
+
+/*
+ * Fold all the cached entries into new snapshots, evicting some of them if
+ * the cache is over the limit.  Entries which don't fit (non-positive ids,
+ * or ids of too sparse a dictionary) stay in the hashes, and so do pending
+ * entries.  Pending entries which were evicted are not published.
+ */
+static void
+buildSnapshot(void)
+{
+	IdToName   *entries;
+	bool	   *referenced,
+			   *pending;
+	HTAB	   *pendingHash = NULL;
+	long		nEntries = 0,
+				i;
+	SnapshotStats *stats;
+	int			nStats = 0;
+	int			j;
+	MemoryContext newContext,
+				oldCacheContext = dictCacheContext;
+	DictSnapshot *newSnapshots;
+	int			nNewSnapshots = 0;
+	long		nFolded = 0;
+	HASH_SEQ_STATUS scan;
+	IdToName   *idToName;
+
+	/*
+	 * Collect the entries of the current snapshots and the hashes.  Entries
+	 * of the hashes were added since the last rebuild, so they count as
+	 * referenced.
+	 */
+	i = snapshotEntries + hash_get_num_entries(idToNameHash);
+	entries = (IdToName *) palloc(sizeof(IdToName) * Max(i, 1));
+	referenced = (bool *) palloc(sizeof(bool) * Max(i, 1));
+	pending = (bool *) palloc0(sizeof(bool) * Max(i, 1));
+	for (j = 0; j < nSnapshots; j++)
+	{
+		DictSnapshot *snapshot = &snapshots[j];
+		int32		id;
+
+		for (id = 1; id <= snapshot->maxId; id++)
+		{
+			if (snapshot->names[id].len < 0)
+				continue;
+			entries[nEntries].key = makeDictId(snapshot->dict, id);
+			entries[nEntries].name.s = snapshot->arena + snapshot->names[id].offset;
+			entries[nEntries].name.len = snapshot->names[id].len;
+			referenced[nEntries] = snapshot->referenced[id];
+			nEntries++;
+		}
+	}
+	if (nPendingEntries > 0)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.hash = tag_hash;
+		ctl.hcxt = CurrentMemoryContext;
+		ctl.keysize = sizeof(DictId);
+		ctl.entrysize = sizeof(DictId);
+		pendingHash = hash_create("jsonbc pending entries", nPendingEntries,
+								  &ctl, HASH_FUNCTION | HASH_CONTEXT | HASH_ELEM);
+		for (j = 0; j < nPendingEntries; j++)
+		{
+			DictId		key = makeDictId(pendingEntries[j].dict,
+										 pendingEntries[j].id);
+
+			hash_search(pendingHash, (const void *)&key, HASH_ENTER, NULL);
+		}
+	}
+	hash_seq_init(&scan, idToNameHash);
+	while ((idToName = (IdToName *) hash_seq_search(&scan)) != NULL)
+	{
+		entries[nEntries] = *idToName;
+		referenced[nEntries] = true;
+		pending[nEntries] = pendingHash &&
+			hash_search(pendingHash, (const void *)&idToName->key,
+						HASH_FIND, NULL) != NULL;
+		nEntries++;
+	}
+
+	if (cacheOverLimit())
+		evictEntries(entries, referenced, nEntries);
+
+	/* Size snapshots of the dictionaries */
+	stats = (SnapshotStats *) palloc(sizeof(SnapshotStats) * (nSnapshots + 1));
+	for (i = 0; i < nEntries; i++)
+	{
+		if (!entries[i].name.s || entries[i].key.id <= 0 || pending[i])
+			continue;
+
+		for (j = 0; j < nStats; j++)
+		{
+			if (stats[j].dict == entries[i].key.dict)
+				break;
+		}
+		if (j == nStats)
+		{
+			if (nStats > nSnapshots)
+				stats = (SnapshotStats *) repalloc(stats,
+									sizeof(SnapshotStats) * (nStats + 1));
+			stats[j].dict = entries[i].key.dict;
+			stats[j].maxId = 0;
+			stats[j].count = 0;
+			stats[j].arenaSize = 0;
+			nStats++;
+		}
+		stats[j].maxId = Max(stats[j].maxId, entries[i].key.id);
+		stats[j].count++;
+		stats[j].arenaSize += entries[i].name.len;
+	}
+
+	newContext = AllocSetContextCreate(TopMemoryContext,
+									   "jsonbc dictionary snapshot",
+									   ALLOCSET_DEFAULT_MINSIZE,
+									   ALLOCSET_DEFAULT_INITSIZE,
+									   ALLOCSET_DEFAULT_MAXSIZE);
+	newSnapshots = (DictSnapshot *) MemoryContextAlloc(newContext,
+									sizeof(DictSnapshot) * Max(nStats, 1));
+	for (j = 0; j < nStats; j++)
+	{
+		DictSnapshot *snapshot;
+		uint32		nslots = 1;
+		int32		id;
+
+		if (stats[j].maxId / SNAPSHOT_MAX_SPARSENESS >
+			stats[j].count + SNAPSHOT_MIN_ENTRIES)
+		{
+			stats[j].snapshot = NULL;
+			continue;
+		}
+
+		while (nslots < 2 * stats[j].count)
+			nslots <<= 1;
+
+		snapshot = &newSnapshots[nNewSnapshots++];
+		snapshot->dict = stats[j].dict;
+		snapshot->maxId = stats[j].maxId;
+		snapshot->names = (SnapshotName *) MemoryContextAlloc(newContext,
+							sizeof(SnapshotName) * (snapshot->maxId + 1));
+		for (id = 0; id <= snapshot->maxId; id++)
+			snapshot->names[id].len = -1;
+		snapshot->referenced = (bool *) MemoryContextAllocZero(newContext,
+							sizeof(bool) * (snapshot->maxId + 1));
+		snapshot->slots = (int32 *) MemoryContextAllocZero(newContext,
+							sizeof(int32) * nslots);
+		snapshot->mask = nslots - 1;
+		snapshot->arena = (char *) MemoryContextAlloc(newContext,
+							Max(stats[j].arenaSize, 1));
+		/* arenaSize now counts the bytes used */
+		stats[j].arenaSize = 0;
+		stats[j].snapshot = snapshot;
+	}
+
+	/* Slots of unknown ids count, names are added below */
+	cacheBytes = 0;
+	for (j = 0; j < nNewSnapshots; j++)
+		cacheBytes += newSnapshots[j].maxId * SNAPSHOT_ENTRY_OVERHEAD;
+
+	/* Fill the snapshots, and move the rest of entries into new hashes */
+	dictCacheContext = AllocSetContextCreate(TopMemoryContext,
+											 "jsonbc dictionary cache",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+	createHashes(1024);
+
+	for (i = 0; i < nEntries; i++)
+	{
+		DictSnapshot *snapshot = NULL;
+		SnapshotName *name;
+		uint32		slot;
+
+		if (!entries[i].name.s)
+			continue;
+
+		if (entries[i].key.id > 0 && !pending[i])
+		{
+			for (j = 0; j < nStats; j++)
+			{
+				if (stats[j].dict == entries[i].key.dict)
+					break;
+			}
+			snapshot = stats[j].snapshot;
+		}
+
+		if (!snapshot)
+		{
+			addEntry(entries[i].key.dict, entries[i].key.id, entries[i].name);
+			continue;
+		}
+
+		name = &snapshot->names[entries[i].key.id];
+		if (name->len >= 0)
+			continue;
+		name->offset = stats[j].arenaSize;
+		name->len = entries[i].name.len;
+		memcpy(snapshot->arena + name->offset, entries[i].name.s, name->len);
+		stats[j].arenaSize += name->len;
+		snapshot->referenced[entries[i].key.id] = referenced[i];
+		cacheBytes += name->len;
+
+		slot = DatumGetUInt32(hash_any((unsigned char *) entries[i].name.s,
+									   entries[i].name.len)) & snapshot->mask;
+		while (snapshot->slots[slot] != InvalidKeyId)
+			slot = (slot + 1) & snapshot->mask;
+		snapshot->slots[slot] = entries[i].key.id;
+		nFolded++;
+	}
+
+	/* Pending entries now have their names in the new hashes */
+	for (i = 0, j = 0; i < nPendingEntries; i++)
+	{
+		DictId		key = makeDictId(pendingEntries[i].dict,
+									 pendingEntries[i].id);
+
+		idToName = (IdToName *) hash_search(idToNameHash, (const void *)&key,
+											HASH_FIND, NULL);
+		if (!idToName)
+		{
+			pendingEvicted = true;
+			continue;
+		}
+		pendingEntries[j] = pendingEntries[i];
+		pendingEntries[j].name = idToName->name;
+		j++;
+	}
+	nPendingEntries = j;
+
+	retireContext(oldCacheContext);
+	retireContext(snapshotContext);
+	snapshotContext = newContext;
+	snapshots = newSnapshots;
+	nSnapshots = nNewSnapshots;
+	snapshotEntries = nFolded;
+	unfoldedEntries = hash_get_num_entries(idToNameHash);
+	rebuildBytes = cacheBytes;
+
+	pfree(entries);
+	pfree(referenced);
+	pfree(pending);
+	pfree(stats);
+	if (pendingHash)
+		hash_destroy(pendingHash);
+}
+
+/*
+ * Estimate of the number of entries the shared dictionary can hold.
+ */
+static long
+sharedDictMaxEntries(void)
+{
+	Size		entrySize;
+
+	entrySize = 2 * (MAXALIGN(sizeof(IdToName)) + MAXALIGN(sizeof(NameToId))) +
+		SHARED_DICT_AVG_NAME_LEN;
+
+	return Max((long) ((Size) sharedDictSize * 1024 / entrySize), 64);
+}
+
+static Size
+sharedDictShmemSize(void)
+{
+	long		maxEntries = sharedDictMaxEntries();
+	Size		size;
+
+	size = offsetof(DictSharedState, arena);
+	size = add_size(size, mul_size(maxEntries, SHARED_DICT_AVG_NAME_LEN));
+	size = add_size(size, hash_estimate_size(maxEntries, sizeof(IdToName)));
+	size = add_size(size, hash_estimate_size(maxEntries, sizeof(NameToId)));
+
+	return size;
+}
+
+static void
+dictShmemRequest(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(sharedDictShmemSize());
+	RequestAddinShmemSpace(dictWorkerShmemSize());
+	RequestNamedLWLockTranche("jsonbc", 1);
+}
+
+static void
+dictShmemStartup(void)
+{
+	HASHCTL		ctl;
+	bool		found;
+	long		maxEntries = sharedDictMaxEntries();
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	dictShared = ShmemInitStruct("jsonbc dictionary",
+					offsetof(DictSharedState, arena) +
+					maxEntries * SHARED_DICT_AVG_NAME_LEN,
+					&found);
+	if (!found)
+	{
+		dictShared->lock = &(GetNamedLWLockTranche("jsonbc"))->lock;
+		pg_atomic_init_u64(&dictShared->generation, 0);
+		pg_atomic_init_u64(&dictShared->resets, 0);
+		dictShared->maxEntries = maxEntries;
+		dictShared->nEntries = 0;
+		dictShared->arenaSize = maxEntries * SHARED_DICT_AVG_NAME_LEN;
+		dictShared->arenaUsed = 0;
+		SpinLockInit(&dictShared->statsMutex);
+		memset(&dictShared->stats, 0, sizeof(DictStats));
+		pg_atomic_init_u32(&dictShared->resetting, 0);
+		dictShared->version = 0;
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(DictId);
+	ctl.entrysize = sizeof(IdToName);
+	ctl.hash = tag_hash;
+	sharedIdToNameHash = ShmemInitHash("jsonbc id to name map",
+									   maxEntries, maxEntries, &ctl,
+									   HASH_ELEM | HASH_FUNCTION);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(DictName);
+	ctl.entrysize = sizeof(NameToId);
+	ctl.hash = name_hash;
+	ctl.match = name_match;
+	sharedNameToIdHash = ShmemInitHash("jsonbc name to id map",
+									   maxEntries, maxEntries, &ctl,
+									   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+
+	dictWorkerShmemStartup();
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Look up name in the shared dictionary.  On success the entry is also
+ * copied into the backend-local cache.
+ */
+static bool
+sharedLookupName(int32 dict, KeyName name, int32 *id)
+{
+	NameToId   *nameToId;
+	DictName	key = makeDictName(dict, name);
+
+	if (!dictShared)
+		return false;
+
+	LWLockAcquire(dictShared->lock, LW_SHARED);
+	nameToId = (NameToId *) hash_search(sharedNameToIdHash,
+										(const void *)&key,
+										HASH_FIND, NULL);
+	if (nameToId)
+	{
+		*id = nameToId->id;
+		addEntry(dict, *id, nameToId->key.name);
+	}
+	LWLockRelease(dictShared->lock);
+
+	return nameToId != NULL;
+}
+
+/*
+ * Look up id in the shared dictionary.  On success the entry is copied into
+ * the backend-local cache, and the local copy is returned.
+ */
+static IdToName *
+sharedLookupId(int32 dict, int32 id)
+{
+	IdToName   *idToName,
+			   *result = NULL;
+	DictId		key = makeDictId(dict, id);
+
+	if (!dictShared)
+		return NULL;
+
+	LWLockAcquire(dictShared->lock, LW_SHARED);
+	idToName = (IdToName *) hash_search(sharedIdToNameHash,
+										(const void *)&key,
+										HASH_FIND, NULL);
+	if (idToName)
+		result = addEntry(dict, id, idToName->name);
+	LWLockRelease(dictShared->lock);
+
+	return result;
+}
+
+/*
+ * Publish entry into the shared dictionary.  Silently does nothing when the
+ * shared dictionary is full: lookups just fall back to SPI.
+ */
+static void
+sharedAddEntry(int32 dict, int32 id, KeyName name)
+{
+	NameToId   *nameToId;
+	IdToName   *idToName;
+	DictId		idKey = makeDictId(dict, id);
+	DictName	nameKey;
+	bool		found;
+
+	LWLockAcquire(dictShared->lock, LW_EXCLUSIVE);
+
+	/* The entry might have been resolved before the dictionary was changed */
+	if (pg_atomic_read_u64(&dictShared->resets) != cacheEpoch ||
+		dictShared->version != cacheVersion)
+	{
+		LWLockRelease(dictShared->lock);
+		return;
+	}
+
+	if (dictShared->nEntries >= dictShared->maxEntries ||
+		dictShared->arenaUsed + name.len > dictShared->arenaSize)
+	{
+		LWLockRelease(dictShared->lock);
+		return;
+	}
+
+	idToName = (IdToName *) hash_search(sharedIdToNameHash,
+										(const void *)&idKey,
+										HASH_FIND, NULL);
+	if (idToName)
+	{
+		LWLockRelease(dictShared->lock);
+		return;
+	}
+
+	memcpy(dictShared->arena + dictShared->arenaUsed, name.s, name.len);
+	name.s = dictShared->arena + dictShared->arenaUsed;
+	nameKey = makeDictName(dict, name);
+
+	nameToId = (NameToId *) hash_search(sharedNameToIdHash,
+										(const void *)&nameKey,
+										HASH_ENTER_NULL, &found);
+	if (!nameToId)
+	{
+		LWLockRelease(dictShared->lock);
+		return;
+	}
+	idToName = (IdToName *) hash_search(sharedIdToNameHash,
+										(const void *)&idKey,
+										HASH_ENTER_NULL, &found);
+	if (!idToName)
+	{
+		hash_search(sharedNameToIdHash, (const void *)&nameKey, HASH_REMOVE, NULL);
+		LWLockRelease(dictShared->lock);
+		return;
+	}
+
+	nameToId->id = id;
+	idToName->name = name;
+	dictShared->arenaUsed += name.len;
+	dictShared->nEntries++;
+
+	LWLockRelease(dictShared->lock);
+}
+
+/*
+ * Remove all the entries from the shared dictionary.  Caller must hold the
+ * lock exclusively.
+ */
+static void
+sharedClear(int64 version)
+{
+	HASH_SEQ_STATUS scan;
+	IdToName   *idToName;
+	NameToId   *nameToId;
+
+	hash_seq_init(&scan, sharedNameToIdHash);
+	while ((nameToId = (NameToId *) hash_seq_search(&scan)) != NULL)
+		hash_search(sharedNameToIdHash, (const void *)&nameToId->key,
+					HASH_REMOVE, NULL);
+
+	hash_seq_init(&scan, sharedIdToNameHash);
+	while ((idToName = (IdToName *) hash_seq_search(&scan)) != NULL)
+		hash_search(sharedIdToNameHash, (const void *)&idToName->key,
+					HASH_REMOVE, NULL);
+
+	dictShared->nEntries = 0;
+	dictShared->arenaUsed = 0;
+	dictShared->version = Max(dictShared->version, version);
+	pg_atomic_fetch_add_u64(&dictShared->resets, 1);
+}
+
+/*
+ * Clear the shared dictionary on behalf of a transaction which updated or
+ * deleted dictionary entries.
+ */
+static void
+sharedReset(int64 version)
+{
+	LWLockAcquire(dictShared->lock, LW_EXCLUSIVE);
+	sharedClear(version);
+	LWLockRelease(dictShared->lock);
+}
+
+/*
+ * Clear the shared dictionary if its entries belong to an older version than
+ * the one we see.
+ */
+static void
+sharedAdvance(int64 version)
+{
+	LWLockAcquire(dictShared->lock, LW_EXCLUSIVE);
+	if (dictShared->version < version)
+	{
+		sharedClear(version);
+		cacheEpoch = pg_atomic_read_u64(&dictShared->resets);
+	}
+	LWLockRelease(dictShared->lock);
+}
+
+/*
+ * Add statistics collected since the last call to the shared totals.
+ */
+static void
+flushStats(void)
+{
+	DictStats  *shared = &dictShared->stats;
+
+	if (memcmp(&localStats, &flushedStats, sizeof(DictStats)) == 0)
+		return;
+
+	SpinLockAcquire(&dictShared->statsMutex);
+	shared->nameHits += localStats.nameHits - flushedStats.nameHits;
+	shared->nameMisses += localStats.nameMisses - flushedStats.nameMisses;
+	shared->idHits += localStats.idHits - flushedStats.idHits;
+	shared->idMisses += localStats.idMisses - flushedStats.idMisses;
+	shared->spiCalls += localStats.spiCalls - flushedStats.spiCalls;
+	shared->inserts += localStats.inserts - flushedStats.inserts;
+	shared->spiTime += localStats.spiTime - flushedStats.spiTime;
+	SpinLockRelease(&dictShared->statsMutex);
+
+	flushedStats = localStats;
+}
+
+/*
+ * Current generation of the dictionary, used to invalidate the negative
+ * cache.  With the shared dictionary it is a counter bumped by every
+ * transaction which resolved new entries via SPI.  Otherwise we have no way
+ * to notice other backends' inserts, so negative entries only live until
+ * the end of the current statement.
+ */
+static uint64
+currentDictGeneration(void)
+{
+	if (dictShared)
+		return pg_atomic_read_u64(&dictShared->generation);
+	else
+		return (uint64) GetCurrentStatementStartTimestamp();
+}
+
+static void
+negCacheReset(void)
+{
+	if (negCacheContext)
+		MemoryContextReset(negCacheContext);
+	negNameHash = NULL;
+	negIdHash = NULL;
+	negCacheEntries = 0;
+}
+
+/*
+ * Make sure the negative cache is usable and up to date.  Returns false if
+ * the negative cache is disabled.
+ */
+static bool
+negCacheCheck(void)
+{
+	HASHCTL		ctl;
+	uint64		generation;
+
+	if (negativeCacheSize <= 0)
+	{
+		if (negCacheEntries > 0)
+			negCacheReset();
+		return false;
+	}
+
+	generation = currentDictGeneration();
+	if (generation != negCacheGeneration || negCacheEntries >= negativeCacheSize)
+	{
+		if (negCacheEntries > 0)
+			negCacheResets++;
+		negCacheReset();
+		negCacheGeneration = generation;
+	}
+
+	if (!negCacheContext)
+		negCacheContext = AllocSetContextCreate(TopMemoryContext,
+												"jsonbc negative cache",
+												ALLOCSET_SMALL_MINSIZE,
+												ALLOCSET_SMALL_INITSIZE,
+												ALLOCSET_SMALL_MAXSIZE);
+
+	if (!negNameHash)
+	{
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DictName);
+		ctl.entrysize = sizeof(DictName);
+		ctl.hash = name_hash;
+		ctl.match = name_match;
+		ctl.hcxt = negCacheContext;
+		negNameHash = hash_create("jsonbc negative name cache", 64, &ctl,
+					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DictId);
+		ctl.entrysize = sizeof(DictId);
+		ctl.hash = tag_hash;
+		ctl.hcxt = negCacheContext;
+		negIdHash = hash_create("jsonbc negative id cache", 64, &ctl,
+					HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	}
+
+	return true;
+}
+
+static bool
+negCacheHasName(int32 dict, KeyName name)
+{
+	DictName	key = makeDictName(dict, name);
+
+	if (!negCacheCheck())
+		return false;
+
+	if (hash_search(negNameHash, (const void *)&key, HASH_FIND, NULL))
+	{
+		negCacheHits++;
+		return true;
+	}
+	return false;
+}
+
+static bool
+negCacheHasId(int32 dict, int32 id)
+{
+	DictId		key = makeDictId(dict, id);
+
+	if (!negCacheCheck())
+		return false;
+
+	if (hash_search(negIdHash, (const void *)&key, HASH_FIND, NULL))
+	{
+		negCacheHits++;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Add name to the negative cache.  Caller must have called negCacheHasName()
+ * before running the query, so that the cache is tagged with a generation
+ * which is not newer than the query's snapshot.
+ */
+static void
+negCacheAddName(int32 dict, KeyName name)
+{
+	DictName   *entry;
+	DictName	key = makeDictName(dict, name);
+	bool		found;
+
+	negCacheMisses++;
+	if (!negNameHash)
+		return;
+
+	entry = (DictName *) hash_search(negNameHash, (const void *)&key,
+									 HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->name.s = MemoryContextAlloc(negCacheContext, name.len);
+		memcpy(entry->name.s, name.s, name.len);
+		entry->name.len = name.len;
+		negCacheEntries++;
+	}
+}
+
+static void
+negCacheAddId(int32 dict, int32 id)
+{
+	DictId		key = makeDictId(dict, id);
+	bool		found;
+
+	negCacheMisses++;
+	if (!negIdHash)
+		return;
+
+	hash_search(negIdHash, (const void *)&key, HASH_ENTER, &found);
+	if (!found)
+		negCacheEntries++;
+}
+
+/*
+ * Entry became known to this backend (for instance, it was just inserted by
+ * us): it must not be answered from the negative cache anymore.
+ */
+static void
+negCacheForgetName(int32 dict, KeyName name)
+{
+	DictName	key = makeDictName(dict, name);
+
+	if (negNameHash &&
+		hash_search(negNameHash, (const void *)&key, HASH_REMOVE, NULL))
+		negCacheEntries--;
+}
+
+static void
+negCacheForgetId(int32 dict, int32 id)
+{
+	DictId		key = makeDictId(dict, id);
+
+	if (negIdHash &&
+		hash_search(negIdHash, (const void *)&key, HASH_REMOVE, NULL))
+		negCacheEntries--;
+}
+
+/*
+ * Remember an entry resolved via SPI in the current transaction.  It gets
+ * published to the shared dictionary when the transaction commits, and
+ * removed from the local cache if the transaction aborts: the id might have
+ * been inserted by this very transaction and so be gone after rollback.
+ */
+static void
+addPendingEntry(int32 dict, int32 id, KeyName name)
+{
+	if (nPendingEntries >= pendingEntriesSize)
+	{
+		if (pendingEntriesSize == 0)
+		{
+			pendingEntriesSize = 16;
+			pendingEntries = (PendingEntry *) MemoryContextAlloc(TopMemoryContext,
+									sizeof(PendingEntry) * pendingEntriesSize);
+		}
+		else
+		{
+			pendingEntriesSize *= 2;
+			pendingEntries = (PendingEntry *) repalloc(pendingEntries,
+									sizeof(PendingEntry) * pendingEntriesSize);
+		}
+	}
+
+	pendingEntries[nPendingEntries].dict = dict;
+	pendingEntries[nPendingEntries].id = id;
+	pendingEntries[nPendingEntries].name = name;
+	pendingEntries[nPendingEntries].nestLevel = GetCurrentTransactionNestLevel();
+	nPendingEntries++;
+}
+
+/*
+ * Remove pending entries starting from the given one from the local cache.
+ * Names are only freed at top-level abort: after a subtransaction abort the
+ * outer transaction might still reference them, so they are leaked.
+ */
+static void
+forgetPendingEntries(int from, bool freeNames)
+{
+	int			i;
+
+	if (!initialized)
+	{
+		nPendingEntries = from;
+		return;
+	}
+
+	for (i = from; i < nPendingEntries; i++)
+	{
+		PendingEntry *entry = &pendingEntries[i];
+		IdToName   *idToName;
+		DictId		idKey = makeDictId(entry->dict, entry->id);
+		DictName	nameKey = makeDictName(entry->dict, entry->name);
+
+		idToName = (IdToName *) hash_search(idToNameHash,
+											(const void *)&idKey,
+											HASH_FIND, NULL);
+		if (!idToName || idToName->name.s != entry->name.s)
+			continue;
+
+		hash_search(nameToIdHash, (const void *)&nameKey, HASH_REMOVE, NULL);
+		hash_search(idToNameHash, (const void *)&idKey, HASH_REMOVE, NULL);
+		cacheBytes -= entry->name.len + HASH_ENTRY_OVERHEAD;
+		if (freeNames)
+			pfree(entry->name.s);
+	}
+	nPendingEntries = from;
+}
+
+/*
+ * Any invalidation of jsonbc_dict, including the ones not caused by our
+ * trigger (e.g. by VACUUM or a lost invalidation queue), makes the next
+ * lookup check whether the dictionary version has changed.
+ */
+static void
+dictRelcacheCallback(Datum arg, Oid relid)
+{
+	if (!OidIsValid(relid) || relid == dictRelid)
+		dictCacheCheck = true;
+}
+
+/*
+ * Executor hooks, tracking the end of the top-level statement.  Nested
+ * queries, including our own SPI queries, end while names handed out before
+ * might still be in use.  An error skips ExecutorEnd(), so the depth is also
+ * reset at the end of transaction; a subtransaction abort leaves it too high,
+ * which only postpones the release.
+ */
+static void
+dictExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+	executorDepth++;
+}
+
+static void
+dictExecutorEnd(QueryDesc *queryDesc)
+{
+	if (prev_ExecutorEnd)
+		prev_ExecutorEnd(queryDesc);
+	else
+		standard_ExecutorEnd(queryDesc);
+	if (executorDepth > 0 && --executorDepth == 0)
+		releaseRetired();
+}
+
+static void
+dictXactCallback(XactEvent event, void *arg)
+{
+	int			i;
+
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+			/*
+			 * Other backends must stop trusting their caches before our
+			 * changes become visible to them.
+			 */
+			if (dictShared && sharedResetPending)
+			{
+				pg_atomic_fetch_add_u32(&dictShared->resetting, 1);
+				sharedResetStarted = true;
+				sharedReset(pendingVersion);
+			}
+			break;
+		case XACT_EVENT_COMMIT:
+			if (dictShared)
+			{
+				for (i = 0; i < nPendingEntries; i++)
+					sharedAddEntry(pendingEntries[i].dict, pendingEntries[i].id,
+								   pendingEntries[i].name);
+				/* Dictionary might have grown: invalidate negative caches */
+				if (nPendingEntries > 0 || pendingEvicted)
+					pg_atomic_fetch_add_u64(&dictShared->generation, 1);
+				if (sharedResetStarted)
+				{
+					sharedReset(pendingVersion);
+					pg_atomic_fetch_sub_u32(&dictShared->resetting, 1);
+				}
+				flushStats();
+			}
+			nPendingEntries = 0;
+			pendingEvicted = false;
+			sharedResetPending = false;
+			sharedResetStarted = false;
+			releaseRetired();
+			executorDepth = 0;
+			dictCacheCheck |= dictRecheckAtEnd;
+			dictRecheckAtEnd = false;
+			break;
+		case XACT_EVENT_PREPARE:
+			/*
+			 * Nobody calls us at COMMIT PREPARED, so reset right away.  The
+			 * version is advanced by the first backend which sees it.
+			 */
+			if (dictShared && sharedResetPending)
+				sharedReset(0);
+			if (dictShared)
+				flushStats();
+			forgetPendingEntries(0, true);
+			pendingEvicted = false;
+			sharedResetPending = false;
+			releaseRetired();
+			executorDepth = 0;
+			dictCacheCheck |= dictRecheckAtEnd;
+			dictRecheckAtEnd = false;
+			break;
+		case XACT_EVENT_PARALLEL_COMMIT:
+			/*
+			 * A parallel worker shares the transaction of the leader, so it
+			 * might have seen keys the leader inserted.  Those are published
+			 * by the leader at commit, if at all.
+			 */
+			if (dictShared)
+				flushStats();
+			forgetPendingEntries(0, true);
+			pendingEvicted = false;
+			releaseRetired();
+			executorDepth = 0;
+			dictCacheCheck |= dictRecheckAtEnd;
+			dictRecheckAtEnd = false;
+			break;
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			if (dictShared && sharedResetStarted)
+				pg_atomic_fetch_sub_u32(&dictShared->resetting, 1);
+			if (dictShared)
+				flushStats();
+			forgetPendingEntries(0, true);
+			pendingEvicted = false;
+			sharedResetPending = false;
+			sharedResetStarted = false;
+			releaseRetired();
+			executorDepth = 0;
+			dictCacheCheck |= dictRecheckAtEnd;
+			dictRecheckAtEnd = false;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+dictSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+					SubTransactionId parentSubid, void *arg)
+{
+	int			nestLevel = GetCurrentTransactionNestLevel();
+	int			i;
+
+	switch (event)
+	{
+		case SUBXACT_EVENT_COMMIT_SUB:
+			/* Entries of the committed subtransaction now belong to parent */
+			for (i = nPendingEntries - 1; i >= 0; i--)
+			{
+				if (pendingEntries[i].nestLevel < nestLevel)
+					break;
+				pendingEntries[i].nestLevel = nestLevel - 1;
+			}
+			if (pendingVersionLevel >= nestLevel)
+				pendingVersionLevel = nestLevel - 1;
+			break;
+		case SUBXACT_EVENT_ABORT_SUB:
+			/* Forget the entries resolved within the aborted subtransaction */
+			i = nPendingEntries;
+			while (i > 0 && pendingEntries[i - 1].nestLevel >= nestLevel)
+				i--;
+			forgetPendingEntries(i, false);
+			/* The version we've bumped is rolled back as well */
+			if (pendingVersionLevel >= nestLevel)
+				pendingVersion = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+int32
+getIdByName(int32 dict, KeyName name)
+{
+	NameToId   *nameToId;
+	DictName	key = makeDictName(dict, name);
+	bool		found;
+	int32		id;
+
+	checkInit();
+
+	if (snapshotLookupName(dict, name, &id) ||
+		(dictFile && dictFileLookupName(dictFile, dict, name, &id)))
+	{
+		localStats.nameHits++;
+		return id;
+	}
+
+	nameToId = (NameToId *) hash_search(nameToIdHash,
+									 (const void *)&key,
+									 HASH_FIND, &found);
+	if (found)
+	{
+		localStats.nameHits++;
+		return nameToId->id;
+	}
+
+	/* Counts the miss */
+	getIdsByNames(dict, &name, &id, 1);
+	return id;
+}
+
+/*
+ * Parallel workers may only look keys up.  Functions which might add keys
+ * are parallel unsafe, so this is just a safety net.
+ */
+static void
+checkNotParallel(void)
+{
+	if (IsInParallelMode())
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TRANSACTION_STATE),
+				 errmsg("cannot add keys to jsonbc dictionary during a parallel operation")));
+}
+
+/*
+ * Revive retired entries which are about to be used again, see
+ * jsonbc_dict_gc().  Entries removed by the garbage collector in the
+ * meantime get their ids reset, so that they are inserted anew.
+ */
+static void
+reviveNamesSPI(int32 dict, int32 *ids, int *indexes, Datum *retiredIds,
+			   int nretired)
+{
+	Oid			argTypes[2] = {INT4OID, INT4ARRAYOID};
+	Datum		args[2];
+	int32	   *revived;
+	int			i;
+	uint64		j;
+
+	if (!savedPlanRevive)
+	{
+		savedPlanRevive = SPI_prepare(
+			"UPDATE jsonbc_dict SET retired = false, retired_at = NULL "
+			"	WHERE dict = $1 AND id = ANY($2) AND retired RETURNING id;",
+			2, argTypes);
+		if (!savedPlanRevive)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanRevive))
+			elog(ERROR, "Error keeping plan");
+	}
+
+	args[0] = Int32GetDatum(dict);
+	args[1] = PointerGetDatum(construct_array(retiredIds, nretired, INT4OID,
+											  sizeof(int32), true, 'i'));
+	if (dictExecutePlan(savedPlanRevive, args, false, 0) < 0)
+		elog(ERROR, "Failed to update dictionary");
+
+	revived = (int32 *) palloc(sizeof(int32) * Max(SPI_processed, 1));
+	for (j = 0; j < SPI_processed; j++)
+	{
+		bool		null;
+
+		revived[j] = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[j], SPI_tuptable->tupdesc, 1, &null));
+	}
+
+	for (i = 0; i < nretired; i++)
+	{
+		int32	   *id = &ids[indexes[i]];
+
+		for (j = 0; j < SPI_processed; j++)
+		{
+			if (revived[j] == *id)
+				break;
+		}
+		if (j == SPI_processed)
+			*id = InvalidKeyId;
+	}
+
+	pfree(revived);
+}
+
+/*
+ * Insert names missing from the dictionary and return ids of all of them.
+ * Names must be distinct.
+ *
+ * A single query takes the ids of the names which are already there and
+ * inserts the rest, with ids from the sequence of the dictionary in the
+ * order of names.  The sequences are created with a CACHE, so that new
+ * keys don't cost a sequence update each.  Cached values which are never
+ * used leave gaps, as usual.  So do values at or below the id_floor of the
+ * dictionary: those were cached by the session before a renumbering of the
+ * keys (see jsonbc_renumber_keys()), and the names they came up for are
+ * retried with the next values.
+ *
+ * Runs in the current transaction: called by the dictionary worker, or by
+ * the backend itself when the worker isn't available.
+ */
+void
+insertNamesSPI(int32 dict, KeyName *names, int32 *ids, int count)
+{
+	Oid			argTypes[2] = {TEXTARRAYOID, INT4OID};
+	Datum		args[2];
+	Datum	   *nameDatums,
+			   *retiredIds;
+	int		   *indexes,
+			   *retiredIndexes;
+	int			n,
+				nretired,
+				attempt = 0,
+				i;
+	uint64		j;
+	bool		belowFloor;
+
+	checkNotParallel();
+
+	SPI_connect();
+
+	for (i = 0; i < count; i++)
+		ids[i] = InvalidKeyId;
+
+	nameDatums = (Datum *) palloc(sizeof(Datum) * count);
+	indexes = (int *) palloc(sizeof(int) * count);
+	retiredIds = (Datum *) palloc(sizeof(Datum) * count);
+	retiredIndexes = (int *) palloc(sizeof(int) * count);
+
+	if (!savedPlanInsert)
+	{
+		/*
+		 * Both parts of the query see the same snapshot, so each name comes
+		 * out at most once.  Names inserted concurrently are skipped by both.
+		 */
+		savedPlanInsert = SPI_prepare(
+			"WITH added AS ("
+			"	SELECT i.name, i.ord, nextval(s.seq)::int4 AS id, s.id_floor "
+			"		FROM (SELECT i.name, i.ord "
+			"				FROM unnest($1) WITH ORDINALITY AS i(name, ord) "
+			"				WHERE NOT EXISTS (SELECT 1 FROM jsonbc_dict d "
+			"					WHERE d.dict = $2 AND d.name = i.name) "
+			"				ORDER BY i.ord) i, "
+			"			 jsonbc_dicts s "
+			"		WHERE s.id = $2), "
+			"ins AS ("
+			"	INSERT INTO jsonbc_dict (dict, id, name) "
+			"	SELECT $2, a.id, a.name FROM added a WHERE a.id > a.id_floor "
+			"	ON CONFLICT DO NOTHING RETURNING id, name) "
+			"SELECT ins.id, i.ord, true, false "
+			"	FROM ins JOIN unnest($1) WITH ORDINALITY AS i(name, ord) "
+			"		ON i.name = ins.name "
+			"UNION ALL "
+			"SELECT NULL, a.ord, false, false "
+			"	FROM added a WHERE a.id <= a.id_floor "
+			"UNION ALL "
+			"SELECT d.id, i.ord, false, d.retired "
+			"	FROM unnest($1) WITH ORDINALITY AS i(name, ord) "
+			"	JOIN jsonbc_dict d ON d.dict = $2 AND d.name = i.name;",
+			2, argTypes);
+		if (!savedPlanInsert)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanInsert))
+			elog(ERROR, "Error keeping plan");
+	}
+
+	for (;;)
+	{
+		n = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (ids[i] != InvalidKeyId)
+				continue;
+			nameDatums[n] = PointerGetDatum(
+				cstring_to_text_with_len(names[i].s, names[i].len));
+			indexes[n++] = i;
+		}
+		if (n == 0)
+			break;
+
+		/*
+		 * Names are left without ids when they were inserted concurrently by
+		 * someone else, when their id collided with one given away by
+		 * renumbering of the dictionary, or when it was below the floor: the
+		 * next round takes the ids from the dictionary or from the sequence
+		 * again.  Rounds spent on values below the floor don't count, the
+		 * session only has as many of them as the sequence caches.
+		 */
+		if (attempt > 2)
+			elog(ERROR, "Failed to insert into dictionary");
+
+		args[0] = PointerGetDatum(construct_array(nameDatums, n, TEXTOID,
+												  -1, false, 'i'));
+		args[1] = Int32GetDatum(dict);
+		if (dictExecutePlan(savedPlanInsert, args, false, 0) < 0)
+			elog(ERROR, "Failed to insert into dictionary");
+		/* Nothing at all comes back for a dictionary we can't see */
+		if (SPI_processed == 0 && attempt == 0 && getDictName(dict) == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("jsonbc dictionary %d does not exist", dict)));
+
+		nretired = 0;
+		belowFloor = false;
+		for (j = 0; j < SPI_processed; j++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[j];
+			TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+			bool		null;
+			int64		ord;
+			int			index;
+			Datum		id;
+
+			ord = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &null));
+			Assert(ord >= 1 && ord <= n);
+			index = indexes[ord - 1];
+			id = SPI_getbinval(tuple, tupdesc, 1, &null);
+			if (null)
+			{
+				belowFloor = true;
+				continue;
+			}
+			ids[index] = DatumGetInt32(id);
+
+			if (DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &null)))
+				localStats.inserts++;
+			else if (DatumGetBool(SPI_getbinval(tuple, tupdesc, 4, &null)))
+			{
+				retiredIds[nretired] = Int32GetDatum(ids[index]);
+				retiredIndexes[nretired++] = index;
+			}
+		}
+
+		if (nretired > 0)
+			reviveNamesSPI(dict, ids, retiredIndexes, retiredIds, nretired);
+		if (!belowFloor)
+			attempt++;
+	}
+
+	pfree(nameDatums);
+	pfree(indexes);
+	pfree(retiredIds);
+	pfree(retiredIndexes);
+
+	SPI_finish();
+}
+
+/*
+ * Resolve several names at once, inserting the missing ones into the
+ * dictionary.  Names which are not cached are resolved with a single query,
+ * and new ids are assigned in the order the names first appear in the
+ * input, exactly as if getIdByName() was called for each of them in turn.
+ */
+void
+getIdsByNames(int32 dict, KeyName *names, int32 *ids, int count)
+{
+	HTAB	   *batchHash = NULL;
+	KeyName	   *missing = NULL;
+	int32	   *missingIds;
+	int			nmissing = 0;
+	bool		committed;
+	int			i;
+
+	checkInit();
+
+	for (i = 0; i < count; i++)
+	{
+		NameToId   *nameToId;
+		DictName	key = makeDictName(dict, names[i]);
+		bool		found;
+
+		if (snapshotLookupName(dict, names[i], &ids[i]) ||
+			(dictFile && dictFileLookupName(dictFile, dict, names[i], &ids[i])))
+		{
+			localStats.nameHits++;
+			continue;
+		}
+
+		nameToId = (NameToId *) hash_search(nameToIdHash,
+											(const void *)&key,
+											HASH_FIND, &found);
+		if (found)
+		{
+			localStats.nameHits++;
+			ids[i] = nameToId->id;
+			continue;
+		}
+		if (sharedLookupName(dict, names[i], &ids[i]))
+		{
+			localStats.nameHits++;
+			continue;
+		}
+		localStats.nameMisses++;
+
+		/* Remember the name for the batch, unless it's already there */
+		if (!batchHash)
+		{
+			HASHCTL		ctl;
+
+			memset(&ctl, 0, sizeof(ctl));
+			ctl.keysize = sizeof(DictName);
+			ctl.entrysize = sizeof(NameToId);
+			ctl.hash = name_hash;
+			ctl.match = name_match;
+			ctl.hcxt = CurrentMemoryContext;
+			batchHash = hash_create("jsonbc batch map", count, &ctl,
+					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+			missing = (KeyName *) palloc(sizeof(KeyName) * count);
+		}
+
+		/* id field temporarily holds the index in the missing array */
+		nameToId = (NameToId *) hash_search(batchHash,
+											(const void *)&key,
+											HASH_ENTER, &found);
+		if (!found)
+		{
+			nameToId->id = nmissing;
+			missing[nmissing++] = names[i];
+		}
+		ids[i] = InvalidKeyId;
+	}
+
+	if (nmissing == 0)
+		return;
+
+	/*
+	 * Prefer the dictionary worker, which allocates ids in its own
+	 * transactions.  Otherwise insert in the current transaction, in which
+	 * case new entries may only be published once it commits.
+	 */
+	missingIds = (int32 *) palloc(sizeof(int32) * nmissing);
+	committed = dictWorkerInsertNames(dict, missing, missingIds, nmissing);
+	if (!committed)
+		insertNamesSPI(dict, missing, missingIds, nmissing);
+
+	for (i = 0; i < nmissing; i++)
+	{
+		IdToName   *result;
+
+		result = addEntry(dict, missingIds[i], missing[i]);
+		if (committed)
+			sharedAddEntry(dict, missingIds[i], result->name);
+		else
+			addPendingEntry(dict, missingIds[i], result->name);
+	}
+	if (committed && dictShared)
+		pg_atomic_fetch_add_u64(&dictShared->generation, 1);
+
+	for (i = 0; i < count; i++)
+	{
+		NameToId   *nameToId;
+		DictName	key = makeDictName(dict, names[i]);
+
+		if (ids[i] != InvalidKeyId)
+			continue;
+
+		nameToId = (NameToId *) hash_search(batchHash,
+											(const void *)&key,
+											HASH_FIND, NULL);
+		Assert(nameToId);
+		ids[i] = missingIds[nameToId->id];
+	}
+
+	hash_destroy(batchHash);
+	pfree(missing);
+	pfree(missingIds);
+}
+
+/*
+ * Read-only variant of getIdByName: resolve name without ever inserting it
+ * into jsonbc_dict.  Returns InvalidKeyId if there is no such key, so
+ * callers can answer "absent" right away.  Used by query operators, which
+ * must stay read-only (and work on a hot standby).
+ */
+int32
+lookupIdByName(int32 dict, KeyName name)
+{
+	NameToId   *nameToId;
+	DictName	key = makeDictName(dict, name);
+	bool		found;
+	int32		id;
+
+	checkInit();
+
+	if (snapshotLookupName(dict, name, &id) ||
+		(dictFile && dictFileLookupName(dictFile, dict, name, &id)))
+	{
+		localStats.nameHits++;
+		return id;
+	}
+
+	nameToId = (NameToId *) hash_search(nameToIdHash,
+									 (const void *)&key,
+									 HASH_FIND, &found);
+	if (found)
+	{
+		localStats.nameHits++;
+		return nameToId->id;
+	}
+	else if (sharedLookupName(dict, name, &id))
+	{
+		localStats.nameHits++;
+		return id;
+	}
+	else if (negCacheHasName(dict, name))
+	{
+		localStats.nameMisses++;
+		return InvalidKeyId;
+	}
+	else
+	{
+		Oid		argTypes[2] = {INT4OID, TEXTOID};
+		Datum	args[2];
+		bool	null;
+		IdToName *result;
+
+		localStats.nameMisses++;
+		SPI_connect();
+
+		if (!savedPlanSelectId)
+		{
+			savedPlanSelectId = SPI_prepare(
+				"SELECT id, retired FROM jsonbc_dict WHERE dict = $1 AND name = $2;", 2, argTypes);
+			if (!savedPlanSelectId)
+				elog(ERROR, "Error preparing query");
+			if (SPI_keepplan(savedPlanSelectId))
+				elog(ERROR, "Error keeping plan");
+		}
+
+		args[0] = Int32GetDatum(dict);
+		args[1] = PointerGetDatum(cstring_to_text_with_len(name.s, name.len));
+		if (dictExecutePlan(savedPlanSelectId, args, true, 1) < 0)
+			elog(ERROR, "Failed to select from dictionary");
+
+		if (SPI_processed < 1)
+		{
+			SPI_finish();
+			negCacheAddName(dict, name);
+			return InvalidKeyId;
+		}
+
+		id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
+
+		/*
+		 * Retired entries are not cached: encoding must see them through
+		 * insertNamesSPI(), which revives them.
+		 */
+		if (!DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &null)))
+		{
+			result = addEntry(dict, id, name);
+			addPendingEntry(dict, id, result->name);
+		}
+
+		SPI_finish();
+		return id;
+	}
+}
+
+KeyName
+getNameById(int32 dict, int32 id)
+{
+	IdToName   *result;
+	DictId		key = makeDictId(dict, id);
+	KeyName		name;
+	bool		found;
+
+	checkInit();
+
+	if (snapshotLookupId(dict, id, &name) ||
+		(dictFile && dictFileLookupId(dictFile, dict, id, &name)))
+	{
+		localStats.idHits++;
+		return name;
+	}
+
+	result = (IdToName *) hash_search(idToNameHash,
+									 (const void *)&key,
+									 HASH_FIND, &found);
+	if (found)
+	{
+		localStats.idHits++;
+		return result->name;
+	}
+	else if ((result = sharedLookupId(dict, id)) != NULL)
+	{
+		localStats.idHits++;
+		return result->name;
+	}
+	else if (negCacheHasId(dict, id))
+	{
+		localStats.idMisses++;
+		name.s = NULL;
+		name.len = 0;
+		return name;
+	}
+	else if (prevLookupId(dict, id, &name))
+	{
+		localStats.idHits++;
+		return name;
+	}
+	else
+	{
+		Oid		argTypes[2] = {INT4OID, INT4OID};
+		Datum	args[2];
+		bool	null;
+		text   *nameText;
+
+		localStats.idMisses++;
+		SPI_connect();
+
+		if (!savedPlanSelect)
+		{
+			savedPlanSelect = SPI_prepare(
+				"SELECT name, retired FROM jsonbc_dict WHERE dict = $1 AND id = $2;", 2, argTypes);
+			if (!savedPlanSelect)
+				elog(ERROR, "Error preparing query");
+			if (SPI_keepplan(savedPlanSelect))
+				elog(ERROR, "Error keeping plan");
+		}
+
+		/*
+		 * Parallel workers can't bump the command counter.  They don't need
+		 * to: nobody inserts keys during a parallel operation.
+		 */
+		args[0] = Int32GetDatum(dict);
+		args[1] = Int32GetDatum(id);
+		if (dictExecutePlan(savedPlanSelect, args, IsInParallelMode(), 1) < 0)
+			elog(ERROR, "Failed to select from dictionary");
+
+		if (SPI_processed < 1)
+		{
+			SPI_finish();
+			negCacheAddId(dict, id);
+
+			name.s = NULL;
+			name.len = 0;
+			return name;
+		}
+
+		nameText = DatumGetTextPP(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
+		name.len = VARSIZE_ANY_EXHDR(nameText);
+
+		/* Retired entries are not cached, see lookupIdByName() */
+		if (DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &null)))
+		{
+			char	   *s = MemoryContextAlloc(getRetiredContext(), name.len);
+
+			memcpy(s, VARDATA_ANY(nameText), name.len);
+			name.s = s;
+			SPI_finish();
+			return name;
+		}
+
+		name.s = VARDATA_ANY(nameText);
+		result = addEntry(dict, id, name);
+		addPendingEntry(dict, id, result->name);
+
+		SPI_finish();
+		return result->name;
+	}
+}
+
+/*
+ * Load previous ids of the dictionary, unless they are loaded already.
+ */
+static void
+loadPrevIds(int32 dict)
+{
+	DictId		key = makeDictId(dict, InvalidKeyId);
+	Oid			argTypes[1] = {INT4OID};
+	Datum		args[1];
+	uint64		i;
+	bool		found;
+
+	if (!prevIdsContext)
+	{
+		HASHCTL		ctl;
+
+		prevIdsContext = AllocSetContextCreate(TopMemoryContext,
+											   "jsonbc previous ids",
+											   ALLOCSET_DEFAULT_MINSIZE,
+											   ALLOCSET_DEFAULT_INITSIZE,
+											   ALLOCSET_DEFAULT_MAXSIZE);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DictId);
+		ctl.entrysize = sizeof(IdToName);
+		ctl.hash = tag_hash;
+		ctl.hcxt = prevIdsContext;
+		prevIdToNameHash = hash_create("jsonbc previous id to name map", 64, &ctl,
+									   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DictName);
+		ctl.entrysize = sizeof(NameToId);
+		ctl.hash = name_hash;
+		ctl.match = name_match;
+		ctl.hcxt = prevIdsContext;
+		prevNameToIdHash = hash_create("jsonbc name to previous id map", 64, &ctl,
+						HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+	}
+
+	hash_search(prevIdToNameHash, &key, HASH_FIND, &found);
+	if (found)
+		return;
+
+	SPI_connect();
 
-	if (name1->len == name2->len)
+	if (!savedPlanSelectPrevIds)
 	{
-		return memcmp(name1->s, name2->s, name1->len);
+		savedPlanSelectPrevIds = SPI_prepare(
+			"SELECT m.old_id, d.name FROM jsonbc_dict_map m "
+			"	JOIN jsonbc_dict d ON d.dict = m.dict AND d.id = m.new_id "
+			"	WHERE m.dict = $1;",
+			1, argTypes);
+		if (!savedPlanSelectPrevIds)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanSelectPrevIds))
+			elog(ERROR, "Error keeping plan");
 	}
-	else
+
+	/* Same snapshot as of getNameById() */
+	args[0] = Int32GetDatum(dict);
+	if (dictExecutePlan(savedPlanSelectPrevIds, args, IsInParallelMode(), 0) < 0)
+		elog(ERROR, "Failed to select from dictionary map");
+
+	for (i = 0; i < SPI_processed; i++)
 	{
-		return (name1->len > name2->len) ? 1 : -1;
+		bool		null;
+		text	   *nameText;
+		KeyName		name;
+		DictId		idKey;
+		DictName	nameKey;
+		IdToName   *idToName;
+		NameToId   *nameToId;
+
+		idKey = makeDictId(dict,
+			DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &null)));
+		nameText = DatumGetTextPP(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &null));
+		name.len = VARSIZE_ANY_EXHDR(nameText);
+		name.s = MemoryContextAlloc(prevIdsContext, name.len);
+		memcpy(name.s, VARDATA_ANY(nameText), name.len);
+
+		idToName = (IdToName *) hash_search(prevIdToNameHash, &idKey,
+											HASH_ENTER, NULL);
+		idToName->name = name;
+		nameKey = makeDictName(dict, name);
+		nameToId = (NameToId *) hash_search(prevNameToIdHash, &nameKey,
+											HASH_ENTER, NULL);
+		nameToId->id = idKey.id;
 	}
+
+	SPI_finish();
+
+	hash_search(prevIdToNameHash, &key, HASH_ENTER, NULL);
 }
 
-static void
-checkInit()
+/*
+ * Name of the key which had the id before its dictionary was renumbered.
+ */
+static bool
+prevLookupId(int32 dict, int32 id, KeyName *name)
 {
-	HASHCTL ctl;
-
-	if (initialized)
-		return;
+	DictId		key = makeDictId(dict, id);
+	IdToName   *idToName;
 
-	memset(&ctl, 0, sizeof(ctl));
-	ctl.hash = tag_hash;
-	ctl.hcxt = TopMemoryContext;
-	ctl.keysize = sizeof(int32);
-	ctl.entrysize = sizeof(IdToName);
-	idToNameHash = hash_create("Id to name map", 1024, &ctl,
-							 HASH_FUNCTION | HASH_CONTEXT | HASH_ELEM);
+	loadPrevIds(dict);
 
-	memset(&ctl, 0, sizeof(ctl));
-	ctl.keysize = sizeof(KeyName);
-	ctl.entrysize = sizeof(NameToId);
-	ctl.hash = name_hash;
-	ctl.match = name_match;
-	ctl.hcxt = TopMemoryContext;
-	nameToIdHash = hash_create("Name to id map", 1024, &ctl,
-					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+	idToName = (IdToName *) hash_search(prevIdToNameHash, &key,
+										HASH_FIND, NULL);
+	if (!idToName)
+		return false;
 
-	initialized = true;
+	*name = idToName->name;
+	return true;
 }
 
-static IdToName *
-addEntry(int id, KeyName name)
+/*
+ * Id the key had before its dictionary was renumbered, or InvalidKeyId if
+ * the dictionary is not being renumbered.  Values not rewritten yet are
+ * searched for it.
+ */
+int32
+lookupPrevIdByName(int32 dict, KeyName name)
 {
+	DictName	key = makeDictName(dict, name);
 	NameToId   *nameToId;
-	IdToName   *idToName;
-	bool		found;
-	char	   *copy;
-
-	copy = MemoryContextAlloc(TopMemoryContext, name.len);
-	memcpy(copy, name.s, name.len);
-	name.s = copy;
 
-	nameToId = (NameToId *) hash_search(nameToIdHash,
-									 (const void *)&name,
-									 HASH_ENTER, &found);
-	nameToId->id = id;
+	checkInit();
+	loadPrevIds(dict);
 
-	idToName = (IdToName *) hash_search(idToNameHash,
-									 (const void *)&id,
-									 HASH_ENTER, &found);
-	idToName->name = name;
+	nameToId = (NameToId *) hash_search(prevNameToIdHash, &key,
+										HASH_FIND, NULL);
 
-	return idToName;
+	return nameToId ? nameToId->id : InvalidKeyId;
 }
 
-int32
-getIdByName(KeyName name)
+/*
+ * Are string values of the key stored as dictionary ids?  Keys are marked
+ * so in the encode_values column of jsonbc_dict.
+ */
+bool
+dictEncodesValues(int32 dict, int32 keyId)
 {
-	NameToId   *nameToId;
+	DictId		key;
 	bool		found;
 
 	checkInit();
 
-	nameToId = (NameToId *) hash_search(nameToIdHash,
-									 (const void *)&name,
-									 HASH_FIND, &found);
-	if (found)
+	if (!valueKeysHash)
 	{
-		return nameToId->id;
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DictId);
+		ctl.entrysize = sizeof(DictId);
+		ctl.hash = tag_hash;
+		ctl.hcxt = TopMemoryContext;
+		valueKeysHash = hash_create("jsonbc value keys", 64, &ctl,
+									HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
 	}
-	else
+
+	key = makeDictId(dict, InvalidKeyId);
+	hash_search(valueKeysHash, &key, HASH_FIND, &found);
+	if (!found)
 	{
-		Oid		argTypes[1] = {TEXTOID};
-		Datum	args[1];
-		bool	null;
-		int		id;
+		Oid			argTypes[1] = {INT4OID};
+		Datum		args[1];
+		uint64		i;
 
 		SPI_connect();
 
-		if (!savedPlanInsert)
+		if (!savedPlanSelectValueKeys)
 		{
-			savedPlanInsert = SPI_prepare(
-				"WITH select_data AS ( "
-				"	SELECT id FROM jsonbc_dict WHERE name = $1 "
-				"), "
-				"insert_data AS ( "
-				"	INSERT INTO jsonbc_dict (name) "
-				"		(SELECT $1 WHERE NOT EXISTS "
-				"			(SELECT id FROM select_data)) RETURNING id "
-				") "
-				"SELECT id FROM select_data "
-				"	UNION ALL "
-				"SELECT id FROM insert_data;", 1, argTypes);
-			if (!savedPlanInsert)
+			savedPlanSelectValueKeys = SPI_prepare(
+				"SELECT id FROM jsonbc_dict WHERE dict = $1 AND encode_values;",
+				1, argTypes);
+			if (!savedPlanSelectValueKeys)
 				elog(ERROR, "Error preparing query");
-			if (SPI_keepplan(savedPlanInsert))
+			if (SPI_keepplan(savedPlanSelectValueKeys))
 				elog(ERROR, "Error keeping plan");
 		}
 
-		args[0] = PointerGetDatum(cstring_to_text_with_len(name.s, name.len));
-		if (SPI_execute_plan(savedPlanInsert, args, NULL, false, 1) < 0 ||
-				SPI_processed != 1)
-			elog(ERROR, "Failed to insert into dictionary");
+		args[0] = Int32GetDatum(dict);
+		if (dictExecutePlan(savedPlanSelectValueKeys, args, true, 0) < 0)
+			elog(ERROR, "Failed to select from dictionary");
 
-		id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
-		addEntry(id, name);
+		for (i = 0; i < SPI_processed; i++)
+		{
+			bool		null;
+			DictId		valueKey;
+
+			valueKey = makeDictId(dict,
+				DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &null)));
+			hash_search(valueKeysHash, &valueKey, HASH_ENTER, NULL);
+		}
 
 		SPI_finish();
-		return id;
+
+		hash_search(valueKeysHash, &key, HASH_ENTER, NULL);
 	}
+
+	key = makeDictId(dict, keyId);
+	hash_search(valueKeysHash, &key, HASH_FIND, &found);
+
+	return found;
 }
 
-KeyName
-getNameById(int32 id)
+/*
+ * Ids of the keys of the dictionary whose names match a LIKE pattern, or a
+ * regular expression if "regex" is set, in ascending order.  Retired keys
+ * are included, since values might still have them, and so are the previous
+ * ids of a dictionary being renumbered.  The array is palloc'd
+ * in the caller's memory context.  Returns the number of ids.
+ *
+ * Keys allocated by the dictionary worker are committed on their own, so
+ * they might be invisible to the transaction snapshot although values of
+ * the transaction have them.  The latest snapshot is used instead: keys are
+ * only deleted once no value has them.  No new snapshot can be taken in
+ * parallel mode, so the active one is used there.  The pattern functions
+ * are parallel restricted, thus only the leader gets here, with the
+ * statement snapshot, which sees the keys of the previous statements.
+ */
+int
+getIdsByPattern(int32 dict, text *pattern, bool regex, int32 **ids)
 {
-	IdToName   *result;
-	bool		found;
+	Oid			argTypes[2] = {INT4OID, TEXTOID};
+	Datum		args[2];
+	SPIPlanPtr *plan = regex ? &savedPlanSelectRegex : &savedPlanSelectLike;
+	MemoryContext oldcxt = CurrentMemoryContext;
+	instr_time	start;
+	int32	   *result;
+	uint64		i;
 
-	checkInit();
+	SPI_connect();
 
-	result = (IdToName *) hash_search(idToNameHash,
-									 (const void *)&id,
-									 HASH_FIND, &found);
-	if (found)
+	if (!*plan)
 	{
-		return result->name;
+		*plan = SPI_prepare(regex ?
+			"SELECT id FROM jsonbc_dict WHERE dict = $1 AND name ~ $2 "
+			"UNION ALL "
+			"SELECT m.old_id FROM jsonbc_dict_map m "
+			"	JOIN jsonbc_dict d ON d.dict = m.dict AND d.id = m.new_id "
+			"	WHERE m.dict = $1 AND d.name ~ $2 "
+			"ORDER BY 1;" :
+			"SELECT id FROM jsonbc_dict WHERE dict = $1 AND name LIKE $2 "
+			"UNION ALL "
+			"SELECT m.old_id FROM jsonbc_dict_map m "
+			"	JOIN jsonbc_dict d ON d.dict = m.dict AND d.id = m.new_id "
+			"	WHERE m.dict = $1 AND d.name LIKE $2 "
+			"ORDER BY 1;",
+			2, argTypes);
+		if (!*plan)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(*plan))
+			elog(ERROR, "Error keeping plan");
 	}
-	else
+
+	args[0] = Int32GetDatum(dict);
+	args[1] = PointerGetDatum(pattern);
+
+	INSTR_TIME_SET_CURRENT(start);
+	if (SPI_execute_snapshot(*plan, args, NULL,
+							 IsInParallelMode() ?
+							 GetActiveSnapshot() : GetLatestSnapshot(),
+							 InvalidSnapshot, true, false, 0) < 0)
+		elog(ERROR, "Failed to select from dictionary");
+	accountSPI(start);
+
+	result = (int32 *) MemoryContextAlloc(oldcxt,
+										  sizeof(int32) * (SPI_processed + 1));
+	for (i = 0; i < SPI_processed; i++)
 	{
-		Oid		argTypes[1] = {INT4OID};
-		Datum	args[1];
-		bool	null;
-		text   *nameText;
-		KeyName	name;
+		bool		null;
 
-		SPI_connect();
+		result[i] = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i],
+												SPI_tuptable->tupdesc, 1,
+												&null));
+	}
 
-		if (!savedPlanSelect)
-		{
-			savedPlanSelect = SPI_prepare(
-				"SELECT name FROM jsonbc_dict WHERE id = $1;", 1, argTypes);
-			if (!savedPlanSelect)
-				elog(ERROR, "Error preparing query");
-			if (SPI_keepplan(savedPlanSelect))
-				elog(ERROR, "Error keeping plan");
-		}
+	SPI_finish();
 
-		args[0] = Int32GetDatum(id);
-		if (SPI_execute_plan(savedPlanSelect, args, NULL, false, 1) < 0)
-			elog(ERROR, "Failed to select from dictionary");
+	*ids = result;
+	return (int) i;
+}
 
-		if (SPI_processed < 1)
-		{
-			SPI_finish();
+/*
+ * Find dictionary by name.  Returns -1 if there is no such dictionary and
+ * missingOk is true.
+ */
+int32
+getDictByName(const char *name, bool missingOk)
+{
+	Oid			argTypes[1] = {TEXTOID};
+	Datum		args[1];
+	bool		null;
+	int32		dict = -1;
 
-			name.s = NULL;
-			name.len = 0;
-			return name;
-		}
+	SPI_connect();
 
-		nameText = DatumGetTextPP(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
-		name.s = VARDATA_ANY(nameText);
-		name.len = VARSIZE_ANY_EXHDR(nameText);
-		result = addEntry(id, name);
+	if (!savedPlanSelectDict)
+	{
+		savedPlanSelectDict = SPI_prepare(
+			"SELECT id FROM jsonbc_dicts WHERE name = $1;", 1, argTypes);
+		if (!savedPlanSelectDict)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanSelectDict))
+			elog(ERROR, "Error keeping plan");
+	}
 
-		SPI_finish();
-		return result->name;
+	args[0] = CStringGetTextDatum(name);
+	if (dictExecutePlan(savedPlanSelectDict, args, true, 1) < 0)
+		elog(ERROR, "Failed to select from jsonbc_dicts");
+
+	if (SPI_processed > 0)
+		dict = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
+
+	SPI_finish();
+
+	if (dict < 0 && !missingOk)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("jsonbc dictionary \"%s\" does not exist", name)));
+
+	return dict;
+}
+
+/*
+ * Name of the dictionary, palloc'd in the caller's memory context, or NULL
+ * if there is no such dictionary.
+ */
+char *
+getDictName(int32 dict)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+	Oid			argTypes[1] = {INT4OID};
+	Datum		args[1];
+	char	   *result = NULL;
+
+	SPI_connect();
+
+	if (!savedPlanSelectDictName)
+	{
+		savedPlanSelectDictName = SPI_prepare(
+			"SELECT name FROM jsonbc_dicts WHERE id = $1;", 1, argTypes);
+		if (!savedPlanSelectDictName)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanSelectDictName))
+			elog(ERROR, "Error keeping plan");
 	}
+
+	args[0] = Int32GetDatum(dict);
+	if (dictExecutePlan(savedPlanSelectDictName, args, true, 1) < 0)
+		elog(ERROR, "Failed to select from jsonbc_dicts");
+
+	if (SPI_processed > 0)
+		result = MemoryContextStrdup(oldcxt,
+					SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1));
+
+	SPI_finish();
+
+	return result;
+}
+	}
+}
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	DefineCustomIntVariable("jsonbc.shared_dict_size",
+							"Size of the shared memory dictionary cache.",
+							"Only used when jsonbc is loaded via shared_preload_libraries.",
+							&sharedDictSize,
+							4096,
+							0,
+							MAX_KILOBYTES,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("jsonbc.negative_cache_size",
+							"Maximum number of entries in the dictionary negative cache.",
+							"Names and ids found missing from the dictionary are remembered, "
+							"so repeated lookups don't query jsonbc_dict. Zero disables the cache.",
+							&negativeCacheSize,
+							1024,
+							0,
+							INT_MAX / 2,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("jsonbc.dict_prewarm",
+							 "Load the whole dictionary at first use.",
+							 NULL,
+							 &dictPrewarm,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("jsonbc.dict_cache_size",
+							"Maximum size of the backend's dictionary cache.",
+							"Least recently used keys are evicted from the cache "
+							"once it grows beyond that. Zero means no limit.",
+							&dictCacheSize,
+							65536,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	dictWorkerDefineGUC();
+	dictFileDefineGUC();
+
+	RegisterXactCallback(dictXactCallback, NULL);
+	RegisterSubXactCallback(dictSubXactCallback, NULL);
+	CacheRegisterRelcacheCallback(dictRelcacheCallback, (Datum) 0);
+
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = dictExecutorStart;
+	prev_ExecutorEnd = ExecutorEnd_hook;
+	ExecutorEnd_hook = dictExecutorEnd;
+
+	JsonbcInitDeferredInput();
+
+	if (!process_shared_preload_libraries_in_progress || sharedDictSize == 0)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = dictShmemRequest;
+#else
+	dictShmemRequest();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = dictShmemStartup;
 }
 
 PG_FUNCTION_INFO_V1(get_id_by_name);
 PG_FUNCTION_INFO_V1(get_name_by_id);
+PG_FUNCTION_INFO_V1(jsonbc_negative_cache_stats);
+PG_FUNCTION_INFO_V1(jsonbc_dict_prewarm);
+PG_FUNCTION_INFO_V1(jsonbc_dict_generation);
+PG_FUNCTION_INFO_V1(jsonbc_dict_invalidate);
+PG_FUNCTION_INFO_V1(jsonbc_dict_bump_version);
+PG_FUNCTION_INFO_V1(jsonbc_dict_stats);
+PG_FUNCTION_INFO_V1(jsonbc_dict_stats_reset);
+PG_FUNCTION_INFO_V1(jsonbc_dict_encode_values);
+PG_FUNCTION_INFO_V1(jsonbc_dict_export);
 
 Datum
 get_id_by_name(PG_FUNCTION_ARGS)
@@ -236,7 +2913,7 @@ get_id_by_name(PG_FUNCTION_ARGS)
 
 	name.s = VARDATA_ANY(nameText);
 	name.len = VARSIZE_ANY_EXHDR(nameText);
-	id = getIdByName(name);
+	id = getIdByName(DefaultDictId, name);
 
 	PG_RETURN_INT32(id);
 }
@@ -247,7 +2924,7 @@ get_name_by_id(PG_FUNCTION_ARGS)
 	int32 id = PG_GETARG_INT32(0);
 	KeyName  name;
 
-	name = getNameById(id);
+	name = getNameById(DefaultDictId, id);
 	if (name.s)
 	{
 		PG_RETURN_TEXT_P(cstring_to_text_with_len(name.s, name.len));
@@ -257,3 +2934,265 @@ get_name_by_id(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 }
+
+/*
+ * Load the whole dictionary into the backend's cache.
+ */
+Datum
+jsonbc_dict_prewarm(PG_FUNCTION_ARGS)
+{
+	if (!initialized && dictPrewarm)
+	{
+		/* checkInit() will do the job */
+		checkInit();
+		PG_RETURN_INT64(initPrewarmed);
+	}
+
+	checkInit();
+
+	PG_RETURN_INT64(prewarmDict());
+}
+
+/*
+ * Statistics of the backend's negative cache.
+ */
+Datum
+jsonbc_negative_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[4];
+	bool		nulls[4];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(negCacheHits);
+	values[1] = Int64GetDatum(negCacheMisses);
+	values[2] = Int64GetDatum((int64) negCacheEntries);
+	values[3] = Int64GetDatum(negCacheResets);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * Number of times the backend's dictionary cache was invalidated.
+ */
+Datum
+jsonbc_dict_generation(PG_FUNCTION_ARGS)
+{
+	checkInit();
+
+	PG_RETURN_INT64(cacheGeneration);
+}
+
+/*
+ * Bump the dictionary version: caches and dictionary files of older versions
+ * are stale once we commit.  nspid is the schema of the extension.
+ */
+static void
+invalidateDict(Oid nspid)
+{
+	bool		isnull;
+
+	SPI_connect();
+	if (SPI_execute("UPDATE jsonbc_dict_version SET version = version + 1 "
+					"RETURNING version;",
+					false, 0) != SPI_OK_UPDATE_RETURNING || SPI_processed == 0)
+		elog(ERROR, "Failed to update jsonbc_dict_version");
+	pendingVersion = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+												 SPI_tuptable->tupdesc, 1,
+												 &isnull));
+	pendingVersionLevel = GetCurrentTransactionNestLevel();
+	SPI_finish();
+
+	/* Caches watch jsonbc_dict */
+	CacheInvalidateRelcacheByRelid(get_relname_relid("jsonbc_dict", nspid));
+	sharedResetPending = true;
+	dictCacheStale = true;
+}
+
+/*
+ * Statement trigger on jsonbc_dict and jsonbc_dict_map, fired by the
+ * commands which might make cached entries stale.  Updates of jsonbc_dict
+ * only fire it for the columns cached entries are made of: reviving a retired
+ * entry, which is never cached, doesn't take the row lock on
+ * jsonbc_dict_version.
+ */
+Datum
+jsonbc_dict_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "jsonbc_dict_invalidate: not called by trigger manager");
+
+	invalidateDict(RelationGetNamespace(trigdata->tg_relation));
+
+	PG_RETURN_POINTER(NULL);
+}
+
+/*
+ * Invalidate the dictionary explicitly, for changes the trigger doesn't
+ * fire for, i.e. retiring entries in jsonbc_dict_gc().
+ */
+Datum
+jsonbc_dict_bump_version(PG_FUNCTION_ARGS)
+{
+	invalidateDict(get_func_namespace(fcinfo->flinfo->fn_oid));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Dictionary statistics of the backend, and the totals of all the backends
+ * when the shared dictionary is enabled.  The totals only include the
+ * statistics of the transactions finished so far.
+ */
+Datum
+jsonbc_dict_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	Datum		values[10];
+	bool		nulls[10];
+	DictStats	stats;
+	int64		entries,
+				bytes;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		funcctx->max_calls = dictShared ? 2 : 1;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+
+	if (funcctx->call_cntr >= funcctx->max_calls)
+		SRF_RETURN_DONE(funcctx);
+
+	if (funcctx->call_cntr == 0)
+	{
+		stats = localStats;
+		entries = initialized ?
+			snapshotEntries + hash_get_num_entries(idToNameHash) : 0;
+		bytes = cacheBytes;
+		values[0] = CStringGetTextDatum("backend");
+	}
+	else
+	{
+		SpinLockAcquire(&dictShared->statsMutex);
+		stats = dictShared->stats;
+		SpinLockRelease(&dictShared->statsMutex);
+
+		LWLockAcquire(dictShared->lock, LW_SHARED);
+		entries = dictShared->nEntries;
+		bytes = dictShared->arenaUsed;
+		LWLockRelease(dictShared->lock);
+		values[0] = CStringGetTextDatum("shared");
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+	values[1] = Int64GetDatum(stats.nameHits);
+	values[2] = Int64GetDatum(stats.nameMisses);
+	values[3] = Int64GetDatum(stats.idHits);
+	values[4] = Int64GetDatum(stats.idMisses);
+	values[5] = Int64GetDatum(stats.spiCalls);
+	values[6] = Int64GetDatum(stats.inserts);
+	values[7] = Float8GetDatum(stats.spiTime / 1000.0);
+	values[8] = Int64GetDatum(entries);
+	values[9] = Int64GetDatum(bytes);
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+															   values, nulls)));
+}
+
+/*
+ * Reset statistics of the backend and the shared totals.
+ */
+Datum
+jsonbc_dict_stats_reset(PG_FUNCTION_ARGS)
+{
+	memset(&localStats, 0, sizeof(DictStats));
+	memset(&flushedStats, 0, sizeof(DictStats));
+
+	if (dictShared)
+	{
+		SpinLockAcquire(&dictShared->statsMutex);
+		memset(&dictShared->stats, 0, sizeof(DictStats));
+		SpinLockRelease(&dictShared->statsMutex);
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Store string values of the key as dictionary ids from now on, or stop
+ * doing so.  Values stored before are left as they are.  Returns the key id.
+ */
+Datum
+jsonbc_dict_encode_values(PG_FUNCTION_ARGS)
+{
+	char	   *dictName = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	text	   *keyText = PG_GETARG_TEXT_PP(1);
+	bool		enable = PG_GETARG_BOOL(2);
+	Oid			argTypes[3] = {INT4OID, INT4OID, BOOLOID};
+	Datum		args[3];
+	int32		dict;
+	KeyName		name;
+	int32		id;
+
+	dict = getDictByName(dictName, false);
+	name.s = VARDATA_ANY(keyText);
+	name.len = VARSIZE_ANY_EXHDR(keyText);
+	id = getIdByName(dict, name);
+
+	SPI_connect();
+
+	if (!savedPlanSetValueKey)
+	{
+		savedPlanSetValueKey = SPI_prepare(
+			"UPDATE jsonbc_dict SET encode_values = $3 "
+			"	WHERE dict = $1 AND id = $2 AND encode_values <> $3;",
+			3, argTypes);
+		if (!savedPlanSetValueKey)
+			elog(ERROR, "Error preparing query");
+		if (SPI_keepplan(savedPlanSetValueKey))
+			elog(ERROR, "Error keeping plan");
+	}
+
+	/* The update invalidates the caches of all the sessions at commit */
+	args[0] = Int32GetDatum(dict);
+	args[1] = Int32GetDatum(id);
+	args[2] = BoolGetDatum(enable);
+	if (dictExecutePlan(savedPlanSetValueKey, args, false, 0) < 0)
+		elog(ERROR, "Failed to update dictionary");
+
+	SPI_finish();
+
+	PG_RETURN_INT32(id);
+}
+
+/*
+ * Write the dictionary file of the current database.  Returns the number of
+ * entries exported.
+ */
+Datum
+jsonbc_dict_export(PG_FUNCTION_ARGS)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to export jsonbc dictionary")));
+
+	PG_RETURN_INT64(dictFileExport());
+}
@@ -7,7 +7,53 @@ typedef struct
 	int		len;
 } KeyName;
 
-extern int32 getIdByName(KeyName name);
-extern KeyName getNameById(int32 id);
+/*
+ * Key ids are assigned by the serial column of jsonbc_dict, so they start
+ * from 1 and zero is never a valid id.
+ */
+#define InvalidKeyId	0
+
+/*
+ * Dictionaries are listed in jsonbc_dicts, each of them has an id space of
+ * its own.  Values which don't say otherwise use the default dictionary.
+ */
+#define DefaultDictId	0
+
+extern int32 getIdByName(int32 dict, KeyName name);
+extern int32 lookupIdByName(int32 dict, KeyName name);
+extern int32 lookupPrevIdByName(int32 dict, KeyName name);
+extern void getIdsByNames(int32 dict, KeyName *names, int32 *ids, int count);
+extern void insertNamesSPI(int32 dict, KeyName *names, int32 *ids, int count);
+extern KeyName getNameById(int32 dict, int32 id);
+extern int32 getDictByName(const char *name, bool missingOk);
+extern char *getDictName(int32 dict);
+extern bool dictEncodesValues(int32 dict, int32 keyId);
+extern int getIdsByPattern(int32 dict, text *pattern, bool regex, int32 **ids);
+
+/* dict_worker.c */
+extern Size dictWorkerShmemSize(void);
+extern void dictWorkerShmemStartup(void);
+extern void dictWorkerDefineGUC(void);
+extern bool dictWorkerInsertNames(int32 dict, KeyName *names, int32 *ids,
+								  int count);
+extern void dictWorkerRequestExport(void);
+
+/* dict_file.c */
+typedef struct DictFile DictFile;
+
+extern bool dictFileEnabled;
+
+extern void dictFileDefineGUC(void);
+extern DictFile *dictFileOpen(void);
+extern void dictFileClose(DictFile *file);
+extern int64 dictFileVersion(DictFile *file);
+extern bool dictFileLookupId(DictFile *file, int32 dict, int32 id,
+							 KeyName *name);
+extern bool dictFileLookupName(DictFile *file, int32 dict, KeyName name,
+							   int32 *id);
+extern int64 dictFileExport(void);
+
+/* jsonbc.c */
+extern void JsonbcInitDeferredInput(void);
 
 #endif /* DICT_H_ */
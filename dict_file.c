@@ -0,0 +1,437 @@
+/*
+ * dict_file.c
+ *
+ * Memory-mapped dictionary file.
+ *
+ * Loading a large dictionary via SPI takes a while, and every new backend
+ * has to do it again, notably after a restart or failover.  Instead, the
+ * dictionary of a database can be exported into a compact file,
+ * pg_jsonbc/dict_<database oid> under the data directory, which backends map
+ * read-only.  A fresh backend then resolves every key known at the time of
+ * the export without querying jsonbc_dict, and the pages of the file are
+ * shared by all the backends through the OS page cache.
+ *
+ * The file consists of a header, the entries sorted by dictionary and id
+ * (searched by id with binary search), an open addressing table of entry
+ * numbers (searched by name), and the names.  The header holds a format
+ * version and a checksum of the rest.  Retired entries are not exported.
+ *
+ * The file stays valid as long as no existing entry is changed.  Keys added
+ * later are simply not found in it, and are resolved as usual.  Changes of
+ * existing entries bump the counter in jsonbc_dict_version in the same
+ * transaction (see jsonbc_dict_invalidate()), and the file records the
+ * counter it was exported at, so the caller can tell a stale file from a
+ * valid one.
+ *
+ * The file is written by jsonbc_dict_export(), and by the dictionary worker
+ * shortly after it has allocated new ids.  A new file is written under a
+ * temporary name and renamed over the old one, so a backend always maps a
+ * complete file.
+ */
+
+#include "postgres.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/hash.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "port/pg_crc32c.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+
+#include "dict.h"
+
+#define DICT_FILE_DIR		"pg_jsonbc"
+#define DICT_FILE_MAGIC		0x4A424344	/* "JBCD" */
+#define DICT_FILE_FORMAT	1
+
+typedef struct
+{
+	uint32		magic;			/* DICT_FILE_MAGIC */
+	uint32		format;			/* DICT_FILE_FORMAT */
+	int64		version;		/* jsonbc_dict_version at the export */
+	uint32		nEntries;
+	uint32		nSlots;			/* power of two */
+	uint32		namesSize;
+	pg_crc32c	crc;			/* of everything after the header */
+} DictFileHeader;
+
+typedef struct
+{
+	int32		dict;
+	int32		id;
+	uint32		offset;			/* offset of the name */
+	uint32		len;
+} DictFileEntry;
+
+struct DictFile
+{
+	char	   *base;
+	Size		size;
+	int64		version;
+	uint32		nEntries;
+	uint32		mask;			/* number of slots minus one */
+	DictFileEntry *entries;
+	uint32	   *slots;			/* entry numbers plus one, zero if empty */
+	char	   *names;
+};
+
+bool		dictFileEnabled = false;
+
+void
+dictFileDefineGUC(void)
+{
+	DefineCustomBoolVariable("jsonbc.dict_file",
+							 "Look keys up in the memory-mapped dictionary file.",
+							 "The dictionary worker keeps the file up to date, and "
+							 "backends consult it before querying jsonbc_dict.",
+							 &dictFileEnabled,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
+
+static void
+dictFilePath(char *path)
+{
+	snprintf(path, MAXPGPATH, DICT_FILE_DIR "/dict_%u", MyDatabaseId);
+}
+
+static uint32
+dictFileHash(int32 dict, const char *s, int len)
+{
+	return DatumGetUInt32(hash_any((const unsigned char *) s, len)) ^
+		DatumGetUInt32(hash_uint32((uint32) dict));
+}
+
+/*
+ * Map the dictionary file of the current database.  Returns NULL if there is
+ * no file, or it's damaged.  The caller still has to check the version.
+ */
+DictFile *
+dictFileOpen(void)
+{
+	char		path[MAXPGPATH];
+	struct stat st;
+	DictFileHeader *header;
+	DictFile   *file;
+	char	   *base;
+	pg_crc32c	crc;
+	Size		size;
+	int			fd;
+
+	dictFilePath(path);
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY
+#if PG_VERSION_NUM < 110000
+						   , 0
+#endif
+		);
+	if (fd < 0)
+	{
+		if (errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", path)));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", path)));
+		CloseTransientFile(fd);
+		return NULL;
+	}
+	if (st.st_size < sizeof(DictFileHeader))
+	{
+		CloseTransientFile(fd);
+		elog(LOG, "jsonbc dictionary file \"%s\" is truncated", path);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	CloseTransientFile(fd);
+	if (base == MAP_FAILED)
+	{
+		ereport(LOG,
+				(errmsg("could not map file \"%s\": %m", path)));
+		return NULL;
+	}
+
+	header = (DictFileHeader *) base;
+	size = sizeof(DictFileHeader) +
+		(Size) header->nEntries * sizeof(DictFileEntry) +
+		(Size) header->nSlots * sizeof(uint32) +
+		header->namesSize;
+	if (header->magic != DICT_FILE_MAGIC ||
+		header->format != DICT_FILE_FORMAT ||
+		header->nSlots == 0 ||
+		(header->nSlots & (header->nSlots - 1)) != 0 ||
+		size != st.st_size)
+	{
+		munmap(base, st.st_size);
+		elog(LOG, "jsonbc dictionary file \"%s\" is invalid", path);
+		return NULL;
+	}
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, base + sizeof(DictFileHeader),
+				st.st_size - sizeof(DictFileHeader));
+	FIN_CRC32C(crc);
+	if (!EQ_CRC32C(crc, header->crc))
+	{
+		munmap(base, st.st_size);
+		elog(LOG, "jsonbc dictionary file \"%s\" has wrong checksum", path);
+		return NULL;
+	}
+
+	file = (DictFile *) MemoryContextAlloc(TopMemoryContext, sizeof(DictFile));
+	file->base = base;
+	file->size = st.st_size;
+	file->version = header->version;
+	file->nEntries = header->nEntries;
+	file->mask = header->nSlots - 1;
+	file->entries = (DictFileEntry *) (base + sizeof(DictFileHeader));
+	file->slots = (uint32 *) (file->entries + header->nEntries);
+	file->names = (char *) (file->slots + header->nSlots);
+
+	return file;
+}
+
+/*
+ * Unmap the file.  Names returned by the lookups become invalid.
+ */
+void
+dictFileClose(DictFile *file)
+{
+	munmap(file->base, file->size);
+	pfree(file);
+}
+
+int64
+dictFileVersion(DictFile *file)
+{
+	return file->version;
+}
+
+bool
+dictFileLookupId(DictFile *file, int32 dict, int32 id, KeyName *name)
+{
+	uint32		lo = 0,
+				hi = file->nEntries;
+	DictFileEntry *entry;
+
+	while (lo < hi)
+	{
+		uint32		mid = lo + (hi - lo) / 2;
+
+		entry = &file->entries[mid];
+		if (entry->dict < dict || (entry->dict == dict && entry->id < id))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo >= file->nEntries)
+		return false;
+	entry = &file->entries[lo];
+	if (entry->dict != dict || entry->id != id)
+		return false;
+
+	name->s = file->names + entry->offset;
+	name->len = entry->len;
+	return true;
+}
+
+bool
+dictFileLookupName(DictFile *file, int32 dict, KeyName name, int32 *id)
+{
+	uint32		i;
+
+	i = dictFileHash(dict, name.s, name.len) & file->mask;
+	while (file->slots[i] != 0)
+	{
+		DictFileEntry *entry = &file->entries[file->slots[i] - 1];
+
+		if (entry->dict == dict && entry->len == name.len &&
+			memcmp(file->names + entry->offset, name.s, name.len) == 0)
+		{
+			*id = entry->id;
+			return true;
+		}
+		i = (i + 1) & file->mask;
+	}
+	return false;
+}
+
+static void
+dictFileWrite(int fd, const char *path, const void *data, Size len)
+{
+	errno = 0;
+	if (write(fd, data, len) != len)
+	{
+		int			save_errno = errno;
+
+		CloseTransientFile(fd);
+		unlink(path);
+		errno = save_errno ? save_errno : ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+	}
+}
+
+/*
+ * Export the dictionary of the current database into the file.  Returns the
+ * number of entries written.
+ */
+int64
+dictFileExport(void)
+{
+	char		path[MAXPGPATH],
+				tmpPath[MAXPGPATH];
+	DictFileHeader header;
+	DictFileEntry *entries;
+	uint32	   *slots;
+	char	   *names;
+	Size		namesSize = 0;
+	uint64		nrows,
+				i;
+	uint32		nEntries = 0,
+				nSlots = 16;
+	bool		null;
+	int			fd;
+
+	SPI_connect();
+
+	/* The counter and the entries must come from the same snapshot */
+	if (SPI_execute("SELECT v.version, d.dict, d.id, d.name "
+					"FROM jsonbc_dict_version v "
+					"LEFT JOIN jsonbc_dict d ON NOT d.retired "
+					"ORDER BY d.dict, d.id;", true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "Failed to select from dictionary");
+	nrows = SPI_processed;
+	if (nrows < 1)
+		elog(ERROR, "jsonbc_dict_version is empty");
+
+	for (i = 0; i < nrows; i++)
+	{
+		Datum		name;
+
+		/* No entries at all gives a single row of nulls */
+		name = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 4, &null);
+		if (null)
+			continue;
+		namesSize += VARSIZE_ANY_EXHDR(DatumGetTextPP(name));
+		nEntries++;
+	}
+	if (namesSize > PG_UINT32_MAX)
+		elog(ERROR, "jsonbc dictionary is too large to be exported");
+
+	while (nSlots < 2 * (Size) nEntries)
+		nSlots *= 2;
+
+	entries = (DictFileEntry *) palloc(sizeof(DictFileEntry) * Max(nEntries, 1));
+	slots = (uint32 *) palloc0(sizeof(uint32) * nSlots);
+	names = (char *) palloc(Max(namesSize, 1));
+
+	memset(&header, 0, sizeof(header));
+	header.magic = DICT_FILE_MAGIC;
+	header.format = DICT_FILE_FORMAT;
+	header.version = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &null));
+	header.nEntries = nEntries;
+	header.nSlots = nSlots;
+	header.namesSize = (uint32) namesSize;
+
+	namesSize = 0;
+	nEntries = 0;
+	for (i = 0; i < nrows; i++)
+	{
+		DictFileEntry *entry;
+		Datum		name;
+		text	   *nameText;
+		uint32		slot;
+
+		name = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 4, &null);
+		if (null)
+			continue;
+		nameText = DatumGetTextPP(name);
+
+		entry = &entries[nEntries];
+		entry->dict = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &null));
+		entry->id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 3, &null));
+		entry->offset = (uint32) namesSize;
+		entry->len = VARSIZE_ANY_EXHDR(nameText);
+		memcpy(names + namesSize, VARDATA_ANY(nameText), entry->len);
+		namesSize += entry->len;
+
+		slot = dictFileHash(entry->dict, VARDATA_ANY(nameText), entry->len) & (nSlots - 1);
+		while (slots[slot] != 0)
+			slot = (slot + 1) & (nSlots - 1);
+		slots[slot] = ++nEntries;
+	}
+
+	SPI_finish();
+
+	INIT_CRC32C(header.crc);
+	COMP_CRC32C(header.crc, entries, sizeof(DictFileEntry) * nEntries);
+	COMP_CRC32C(header.crc, slots, sizeof(uint32) * nSlots);
+	COMP_CRC32C(header.crc, names, namesSize);
+	FIN_CRC32C(header.crc);
+
+#if PG_VERSION_NUM >= 110000
+	if (MakePGDirectory(DICT_FILE_DIR) < 0 && errno != EEXIST)
+#else
+	if (mkdir(DICT_FILE_DIR, S_IRWXU) < 0 && errno != EEXIST)
+#endif
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", DICT_FILE_DIR)));
+
+	dictFilePath(path);
+	snprintf(tmpPath, MAXPGPATH, "%s.tmp.%d", path, MyProcPid);
+
+	fd = OpenTransientFile(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY
+#if PG_VERSION_NUM < 110000
+						   , S_IRUSR | S_IWUSR
+#endif
+		);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", tmpPath)));
+
+	dictFileWrite(fd, tmpPath, &header, sizeof(header));
+	dictFileWrite(fd, tmpPath, entries, sizeof(DictFileEntry) * nEntries);
+	dictFileWrite(fd, tmpPath, slots, sizeof(uint32) * nSlots);
+	dictFileWrite(fd, tmpPath, names, namesSize);
+
+	if (pg_fsync(fd) != 0)
+	{
+		int			save_errno = errno;
+
+		CloseTransientFile(fd);
+		unlink(tmpPath);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", tmpPath)));
+	}
+	CloseTransientFile(fd);
+
+	(void) durable_rename(tmpPath, path, ERROR);
+
+	pfree(entries);
+	pfree(slots);
+	pfree(names);
+
+	return nEntries;
+}
@@ -0,0 +1,781 @@
+/*
+ * dict_worker.c
+ *
+ * Background worker allocating dictionary ids outside of user transactions.
+ *
+ * When the key dictionary is inserted into by the transaction which
+ * encounters a new key, concurrent transactions introducing the same key
+ * wait on the unique index until it finishes, and ids allocated by a
+ * transaction which is rolled back vanish.  Instead, backends hand new names
+ * to a per-database worker, which inserts them in its own short
+ * transactions.  Ids returned by the worker are committed, so they can be
+ * cached and published right away.
+ *
+ * Requests are passed through a fixed set of slots in shared memory.  A
+ * backend fills a free slot, wakes up the worker of its database (starting
+ * it if needed) and sleeps until the worker marks the slot as done.  The
+ * worker exits after a period of inactivity.
+ *
+ * The worker must never wait for the requesting backend, which is waiting
+ * for the worker in turn: a backend which has inserted a name in its own
+ * transaction holds the unique index entry the worker would wait on.  So the
+ * worker runs with a short lock_timeout, and a request failing on it is
+ * handed back to the backend, which inserts the names itself.
+ *
+ * The worker also rewrites the dictionary file (see dict_file.c) a few
+ * seconds after it has allocated new ids, or when a backend finds the file
+ * missing or stale.
+ *
+ * Only available when jsonbc is loaded via shared_preload_libraries; the
+ * caller falls back to inserting in its own transaction otherwise.
+ */
+
+#include "postgres.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+#include "dict.h"
+
+#define DICT_WORKER_MAX_WORKERS		8
+#define DICT_WORKER_NSLOTS			32
+#define DICT_WORKER_SLOT_DATA_SIZE	8192
+#define DICT_WORKER_SLOT_MAX_NAMES	512
+#define DICT_WORKER_ERRMSG_SIZE		256
+
+/* Worker exits after this many milliseconds without requests */
+#define DICT_WORKER_IDLE_TIMEOUT	60000
+/* Backend rechecks that the worker is alive this often, milliseconds */
+#define DICT_WORKER_CHECK_INTERVAL	1000
+/* Worker gives up waiting on a lock after this many milliseconds */
+#define DICT_WORKER_LOCK_TIMEOUT	100
+/* Dictionary file is rewritten this many milliseconds after a change */
+#define DICT_WORKER_EXPORT_DELAY	5000
+
+typedef enum
+{
+	SLOT_FREE,
+	SLOT_PENDING,				/* filled by backend, waiting for worker */
+	SLOT_IN_PROGRESS,			/* taken by worker */
+	SLOT_DONE,					/* ids are filled in */
+	SLOT_ERROR,					/* worker failed, errmsg is filled in */
+	SLOT_RETRY,					/* worker would wait on a lock, the backend
+								 * should insert the names itself */
+	SLOT_ABANDONED				/* backend stopped waiting */
+} DictWorkerSlotState;
+
+typedef struct
+{
+	DictWorkerSlotState state;
+	Oid			dbid;
+	Latch	   *latch;			/* requesting backend's latch */
+	pid_t		worker;			/* worker which took the request */
+	int32		dict;			/* dictionary to insert the names into */
+	int			nnames;
+	/* names, each one is int length followed by the bytes */
+	char		data[DICT_WORKER_SLOT_DATA_SIZE];
+	int32		ids[DICT_WORKER_SLOT_MAX_NAMES];
+	char		errmsg[DICT_WORKER_ERRMSG_SIZE];
+} DictWorkerSlot;
+
+typedef struct
+{
+	Oid			dbid;			/* InvalidOid if the entry is free */
+	pid_t		pid;			/* zero until the worker has started */
+	Latch	   *latch;
+	bool		exportRequested;	/* dictionary file is missing or stale */
+} DictWorkerEntry;
+
+typedef struct
+{
+	slock_t		mutex;
+	ConditionVariable slotFreed;	/* signaled when a slot becomes free */
+	DictWorkerEntry workers[DICT_WORKER_MAX_WORKERS];
+	DictWorkerSlot slots[DICT_WORKER_NSLOTS];
+} DictWorkerShared;
+
+static DictWorkerShared *workerShared = NULL;
+static bool dictWorkerEnabled = true;
+static bool amDictWorker = false;
+static int	myWorkerIndex = -1;
+
+PGDLLEXPORT void jsonbc_dict_worker_main(Datum main_arg);
+
+Size
+dictWorkerShmemSize(void)
+{
+	return sizeof(DictWorkerShared);
+}
+
+/*
+ * Called from the shmem startup hook, with AddinShmemInitLock held.
+ */
+void
+dictWorkerShmemStartup(void)
+{
+	bool		found;
+
+	workerShared = ShmemInitStruct("jsonbc dictionary worker",
+								   sizeof(DictWorkerShared), &found);
+	if (!found)
+	{
+		int			i;
+
+		SpinLockInit(&workerShared->mutex);
+		ConditionVariableInit(&workerShared->slotFreed);
+		for (i = 0; i < DICT_WORKER_MAX_WORKERS; i++)
+		{
+			workerShared->workers[i].dbid = InvalidOid;
+			workerShared->workers[i].pid = 0;
+			workerShared->workers[i].latch = NULL;
+			workerShared->workers[i].exportRequested = false;
+		}
+		for (i = 0; i < DICT_WORKER_NSLOTS; i++)
+			workerShared->slots[i].state = SLOT_FREE;
+	}
+}
+
+void
+dictWorkerDefineGUC(void)
+{
+	DefineCustomBoolVariable("jsonbc.dict_worker",
+							 "Allocate dictionary ids in a background worker.",
+							 "New keys are inserted by a worker in its own transactions, "
+							 "so they don't depend on the fate of the inserting transaction.",
+							 &dictWorkerEnabled,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
+
+/*
+ * Find the worker of the current database, launching it if there is none.
+ * Returns index of the worker entry, or -1 if no worker could be started.
+ */
+static int
+ensureWorker(void)
+{
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *handle;
+	pid_t		pid;
+	int			i,
+				freeIndex = -1;
+
+	SpinLockAcquire(&workerShared->mutex);
+	for (i = 0; i < DICT_WORKER_MAX_WORKERS; i++)
+	{
+		if (workerShared->workers[i].dbid == MyDatabaseId)
+		{
+			SpinLockRelease(&workerShared->mutex);
+			return i;
+		}
+		if (freeIndex < 0 && workerShared->workers[i].dbid == InvalidOid)
+			freeIndex = i;
+	}
+	if (freeIndex < 0)
+	{
+		SpinLockRelease(&workerShared->mutex);
+		return -1;
+	}
+	workerShared->workers[freeIndex].dbid = MyDatabaseId;
+	workerShared->workers[freeIndex].pid = 0;
+	workerShared->workers[freeIndex].latch = NULL;
+	workerShared->workers[freeIndex].exportRequested = false;
+	SpinLockRelease(&workerShared->mutex);
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "jsonbc");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "jsonbc_dict_worker_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "jsonbc dictionary worker");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "jsonbc dictionary worker");
+#endif
+	worker.bgw_main_arg = Int32GetDatum(freeIndex);
+	worker.bgw_notify_pid = MyProcPid;
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle) ||
+		WaitForBackgroundWorkerStartup(handle, &pid) != BGWH_STARTED)
+	{
+		SpinLockAcquire(&workerShared->mutex);
+		workerShared->workers[freeIndex].dbid = InvalidOid;
+		SpinLockRelease(&workerShared->mutex);
+		elog(DEBUG1, "could not start jsonbc dictionary worker");
+		return -1;
+	}
+
+	return freeIndex;
+}
+
+/*
+ * Is there a worker serving the current database?  Caller must hold the
+ * mutex.
+ */
+static bool
+workerExists(void)
+{
+	int			i;
+
+	for (i = 0; i < DICT_WORKER_MAX_WORKERS; i++)
+		if (workerShared->workers[i].dbid == MyDatabaseId)
+			return true;
+	return false;
+}
+
+/*
+ * Mark a slot free, and wake up backends waiting for one.
+ */
+static void
+releaseSlot(DictWorkerSlot *slot)
+{
+	SpinLockAcquire(&workerShared->mutex);
+	slot->state = SLOT_FREE;
+	SpinLockRelease(&workerShared->mutex);
+
+	ConditionVariableBroadcast(&workerShared->slotFreed);
+}
+
+/*
+ * Pass names to the worker and wait for the ids.  Returns false if the
+ * request couldn't be queued, or the worker handed it back.
+ */
+static bool
+workerRequest(int32 dict, KeyName *names, int32 *ids, int count)
+{
+	DictWorkerSlot *slot = NULL;
+	Latch	   *workerLatch;
+	char	   *ptr;
+	int			workerIndex,
+				i;
+
+	workerIndex = ensureWorker();
+	if (workerIndex < 0)
+		return false;
+
+	/* Grab a free slot, waiting for one if needed */
+	for (;;)
+	{
+		SpinLockAcquire(&workerShared->mutex);
+		for (i = 0; i < DICT_WORKER_NSLOTS; i++)
+		{
+			if (workerShared->slots[i].state == SLOT_FREE)
+			{
+				slot = &workerShared->slots[i];
+				slot->state = SLOT_IN_PROGRESS;	/* reserved, not filled yet */
+				slot->dbid = InvalidOid;
+				slot->worker = 0;
+				break;
+			}
+		}
+		SpinLockRelease(&workerShared->mutex);
+		if (slot)
+			break;
+
+		ConditionVariableSleep(&workerShared->slotFreed, PG_WAIT_EXTENSION);
+	}
+	ConditionVariableCancelSleep();
+
+	ptr = slot->data;
+	for (i = 0; i < count; i++)
+	{
+		memcpy(ptr, &names[i].len, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(ptr, names[i].s, names[i].len);
+		ptr += names[i].len;
+	}
+	slot->dict = dict;
+	slot->nnames = count;
+	slot->latch = MyLatch;
+
+	SpinLockAcquire(&workerShared->mutex);
+	slot->dbid = MyDatabaseId;
+	slot->state = SLOT_PENDING;
+	workerLatch = workerShared->workers[workerIndex].dbid == MyDatabaseId ?
+		workerShared->workers[workerIndex].latch : NULL;
+	SpinLockRelease(&workerShared->mutex);
+
+	/* If the worker hasn't registered its latch yet, it will scan slots */
+	if (workerLatch)
+		SetLatch(workerLatch);
+
+	PG_TRY();
+	{
+		for (;;)
+		{
+			DictWorkerSlotState state;
+			bool		restart = false;
+
+			SpinLockAcquire(&workerShared->mutex);
+			state = slot->state;
+			if (state == SLOT_PENDING && !workerExists())
+				restart = true;
+			SpinLockRelease(&workerShared->mutex);
+
+			if (state == SLOT_DONE || state == SLOT_ERROR ||
+				state == SLOT_RETRY)
+				break;
+
+			/* Worker exited before taking our request: start a new one */
+			if (restart && ensureWorker() < 0)
+				elog(ERROR, "jsonbc dictionary worker is not available");
+
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+							 DICT_WORKER_CHECK_INTERVAL, PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		bool		abandoned = false;
+
+		SpinLockAcquire(&workerShared->mutex);
+		if (slot->state == SLOT_IN_PROGRESS)
+		{
+			slot->state = SLOT_ABANDONED;
+			abandoned = true;
+		}
+		SpinLockRelease(&workerShared->mutex);
+		if (!abandoned)
+			releaseSlot(slot);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (slot->state == SLOT_ERROR)
+	{
+		char		errmsg[DICT_WORKER_ERRMSG_SIZE];
+
+		strlcpy(errmsg, slot->errmsg, DICT_WORKER_ERRMSG_SIZE);
+		releaseSlot(slot);
+
+		ereport(ERROR,
+				(errmsg("could not insert keys into jsonbc dictionary: %s",
+						errmsg)));
+	}
+
+	if (slot->state == SLOT_RETRY)
+	{
+		elog(DEBUG1, "jsonbc dictionary worker handed the request back: %s",
+			 slot->errmsg);
+		releaseSlot(slot);
+		return false;
+	}
+
+	memcpy(ids, slot->ids, sizeof(int32) * count);
+	releaseSlot(slot);
+
+	return true;
+}
+
+/*
+ * Allocate ids for the given distinct names through the dictionary worker.
+ * Returns false if the worker can't be used, in which case the caller
+ * should insert the names itself.
+ */
+bool
+dictWorkerInsertNames(int32 dict, KeyName *names, int32 *ids, int count)
+{
+	int			start = 0;
+
+	if (!workerShared || !dictWorkerEnabled || amDictWorker ||
+		!OidIsValid(MyDatabaseId) || RecoveryInProgress() ||
+		IsInParallelMode())
+		return false;
+
+	/* Names which don't fit into a slot are left to the caller */
+	for (start = 0; start < count; start++)
+		if (names[start].len + sizeof(int) > DICT_WORKER_SLOT_DATA_SIZE)
+			return false;
+
+	/* Split the request into chunks which fit into a slot */
+	start = 0;
+	while (start < count)
+	{
+		Size		size = 0;
+		int			end = start;
+
+		while (end < count && end - start < DICT_WORKER_SLOT_MAX_NAMES &&
+			   size + sizeof(int) + names[end].len <= DICT_WORKER_SLOT_DATA_SIZE)
+		{
+			size += sizeof(int) + names[end].len;
+			end++;
+		}
+
+		/*
+		 * The caller takes over the whole request.  It finds the names of
+		 * the chunks done already, since the worker has committed them.
+		 */
+		if (!workerRequest(dict, names + start, ids + start, end - start))
+			return false;
+		start = end;
+	}
+
+	return true;
+}
+
+/*
+ * Ask the worker of the current database to rewrite the dictionary file.
+ */
+void
+dictWorkerRequestExport(void)
+{
+	Latch	   *workerLatch = NULL;
+	int			workerIndex;
+
+	if (!workerShared || !dictWorkerEnabled || !dictFileEnabled ||
+		amDictWorker || !OidIsValid(MyDatabaseId) || RecoveryInProgress() ||
+		IsInParallelMode())
+		return;
+
+	workerIndex = ensureWorker();
+	if (workerIndex < 0)
+		return;
+
+	SpinLockAcquire(&workerShared->mutex);
+	if (workerShared->workers[workerIndex].dbid == MyDatabaseId)
+	{
+		workerShared->workers[workerIndex].exportRequested = true;
+		workerLatch = workerShared->workers[workerIndex].latch;
+	}
+	SpinLockRelease(&workerShared->mutex);
+
+	if (workerLatch)
+		SetLatch(workerLatch);
+}
+
+/*
+ * Worker exit callback: release the worker entry, and hand requests which
+ * were taken but not completed back to their backends.
+ */
+static void
+dictWorkerExit(int code, Datum arg)
+{
+	Latch	   *latches[DICT_WORKER_NSLOTS];
+	int			nlatches = 0;
+	bool		freed = false;
+	int			i;
+
+	SpinLockAcquire(&workerShared->mutex);
+	/* The entry might have been released and reused already */
+	if (workerShared->workers[myWorkerIndex].pid == MyProcPid)
+	{
+		workerShared->workers[myWorkerIndex].dbid = InvalidOid;
+		workerShared->workers[myWorkerIndex].pid = 0;
+		workerShared->workers[myWorkerIndex].latch = NULL;
+	}
+	for (i = 0; i < DICT_WORKER_NSLOTS; i++)
+	{
+		DictWorkerSlot *slot = &workerShared->slots[i];
+
+		if (slot->worker != MyProcPid)
+			continue;
+
+		if (slot->state == SLOT_IN_PROGRESS)
+		{
+			strlcpy(slot->errmsg, "dictionary worker exited",
+					DICT_WORKER_ERRMSG_SIZE);
+			slot->state = SLOT_RETRY;
+			latches[nlatches++] = slot->latch;
+		}
+		else if (slot->state == SLOT_ABANDONED)
+		{
+			slot->state = SLOT_FREE;
+			freed = true;
+		}
+	}
+	SpinLockRelease(&workerShared->mutex);
+
+	for (i = 0; i < nlatches; i++)
+		SetLatch(latches[i]);
+	if (freed)
+		ConditionVariableBroadcast(&workerShared->slotFreed);
+}
+
+/*
+ * Process one request in a transaction of its own.
+ */
+static void
+processSlot(DictWorkerSlot *slot)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+	Latch	   *latch;
+	KeyName    *names;
+	char	   *ptr;
+	DictWorkerSlotState result = SLOT_DONE;
+	int			i;
+
+	names = (KeyName *) palloc(sizeof(KeyName) * slot->nnames);
+	ptr = slot->data;
+	for (i = 0; i < slot->nnames; i++)
+	{
+		memcpy(&names[i].len, ptr, sizeof(int));
+		ptr += sizeof(int);
+		names[i].s = ptr;
+		ptr += names[i].len;
+	}
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "allocating jsonbc dictionary ids");
+
+	PG_TRY();
+	{
+		insertNamesSPI(slot->dict, names, slot->ids, slot->nnames);
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		/*
+		 * Lock waits are left to the backend, which might hold the lock.  So
+		 * are dictionaries we don't see, which the backend might have just
+		 * created.
+		 */
+		strlcpy(slot->errmsg, edata->message, DICT_WORKER_ERRMSG_SIZE);
+		result = (edata->sqlerrcode == ERRCODE_LOCK_NOT_AVAILABLE ||
+				  edata->sqlerrcode == ERRCODE_UNDEFINED_OBJECT) ?
+			SLOT_RETRY : SLOT_ERROR;
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+	MemoryContextSwitchTo(oldcxt);
+	pfree(names);
+
+	SpinLockAcquire(&workerShared->mutex);
+	if (slot->state == SLOT_ABANDONED)
+	{
+		slot->state = SLOT_FREE;
+		latch = NULL;
+	}
+	else
+	{
+		slot->state = result;
+		latch = slot->latch;
+	}
+	SpinLockRelease(&workerShared->mutex);
+
+	if (latch)
+		SetLatch(latch);
+	else
+		ConditionVariableBroadcast(&workerShared->slotFreed);
+}
+
+/*
+ * Rewrite the dictionary file in a transaction of its own.  Failures are
+ * only logged: backends keep resolving keys via jsonbc_dict meanwhile.
+ */
+static void
+exportDictFile(void)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "exporting jsonbc dictionary file");
+
+	PG_TRY();
+	{
+		dictFileExport();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		ereport(LOG,
+				(errmsg("could not export jsonbc dictionary file: %s",
+						edata->message)));
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Take the next pending request of our database, if any.
+ */
+static DictWorkerSlot *
+takeSlot(void)
+{
+	DictWorkerSlot *result = NULL;
+	int			i;
+
+	SpinLockAcquire(&workerShared->mutex);
+	for (i = 0; i < DICT_WORKER_NSLOTS; i++)
+	{
+		DictWorkerSlot *slot = &workerShared->slots[i];
+
+		if (slot->state == SLOT_PENDING && slot->dbid == MyDatabaseId)
+		{
+			slot->state = SLOT_IN_PROGRESS;
+			slot->worker = MyProcPid;
+			result = slot;
+			break;
+		}
+	}
+	SpinLockRelease(&workerShared->mutex);
+
+	return result;
+}
+
+void
+jsonbc_dict_worker_main(Datum main_arg)
+{
+	Oid			dbid;
+	MemoryContext workerContext;
+	char		lockTimeout[32];
+	TimestampTz exportAt = 0;	/* when to rewrite the file, 0 if not needed */
+
+	myWorkerIndex = DatumGetInt32(main_arg);
+	amDictWorker = true;
+
+	BackgroundWorkerUnblockSignals();
+
+	SpinLockAcquire(&workerShared->mutex);
+	dbid = workerShared->workers[myWorkerIndex].dbid;
+	workerShared->workers[myWorkerIndex].pid = MyProcPid;
+	SpinLockRelease(&workerShared->mutex);
+
+	before_shmem_exit(dictWorkerExit, (Datum) 0);
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid);
+#endif
+
+	/* Never wait long for a lock: it might be held by a waiting backend */
+	snprintf(lockTimeout, sizeof(lockTimeout), "%d", DICT_WORKER_LOCK_TIMEOUT);
+	SetConfigOption("lock_timeout", lockTimeout, PGC_SUSET, PGC_S_OVERRIDE);
+
+	workerContext = AllocSetContextCreate(TopMemoryContext,
+										  "jsonbc dictionary worker",
+										  ALLOCSET_DEFAULT_MINSIZE,
+										  ALLOCSET_DEFAULT_INITSIZE,
+										  ALLOCSET_DEFAULT_MAXSIZE);
+
+	SpinLockAcquire(&workerShared->mutex);
+	workerShared->workers[myWorkerIndex].latch = MyLatch;
+	SpinLockRelease(&workerShared->mutex);
+
+	for (;;)
+	{
+		DictWorkerSlot *slot;
+		int			rc;
+		long		timeout = DICT_WORKER_IDLE_TIMEOUT;
+		bool		processed = false,
+					exportRequested;
+
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		while ((slot = takeSlot()) != NULL)
+		{
+			MemoryContextSwitchTo(workerContext);
+			processSlot(slot);
+			MemoryContextReset(workerContext);
+			processed = true;
+		}
+
+		SpinLockAcquire(&workerShared->mutex);
+		exportRequested = workerShared->workers[myWorkerIndex].exportRequested;
+		workerShared->workers[myWorkerIndex].exportRequested = false;
+		SpinLockRelease(&workerShared->mutex);
+
+		/* Batch the changes of the next few seconds into one export */
+		if ((processed || exportRequested) && dictFileEnabled && exportAt == 0)
+			exportAt = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												   DICT_WORKER_EXPORT_DELAY);
+		if (processed)
+			continue;
+
+		if (exportAt != 0)
+		{
+			TimestampTz now = GetCurrentTimestamp();
+			long		secs;
+			int			usecs;
+
+			if (now >= exportAt)
+			{
+				MemoryContextSwitchTo(workerContext);
+				exportDictFile();
+				MemoryContextReset(workerContext);
+				exportAt = 0;
+				continue;
+			}
+			TimestampDifference(now, exportAt, &secs, &usecs);
+			timeout = secs * 1000 + usecs / 1000 + 1;
+		}
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   timeout, PG_WAIT_EXTENSION);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		if ((rc & WL_TIMEOUT) && !(rc & WL_LATCH_SET) && exportAt == 0)
+		{
+			bool		idle = true;
+			int			i;
+
+			/* Exit unless a request sneaked in */
+			SpinLockAcquire(&workerShared->mutex);
+			for (i = 0; i < DICT_WORKER_NSLOTS; i++)
+				if (workerShared->slots[i].state == SLOT_PENDING &&
+					workerShared->slots[i].dbid == MyDatabaseId)
+					idle = false;
+			if (workerShared->workers[myWorkerIndex].exportRequested)
+				idle = false;
+			if (idle)
+			{
+				workerShared->workers[myWorkerIndex].dbid = InvalidOid;
+				workerShared->workers[myWorkerIndex].pid = 0;
+				workerShared->workers[myWorkerIndex].latch = NULL;
+			}
+			SpinLockRelease(&workerShared->mutex);
+
+			if (idle)
+				proc_exit(0);
+		}
+	}
+}
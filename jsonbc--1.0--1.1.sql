@@ -0,0 +1,795 @@
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION jsonbc UPDATE TO '1.1'" to load this file. \quit
+
+--
+-- jsonbc 1.1 compares objects by key name, whatever their dictionaries, and
+-- orders containers by their number of elements rather than by their size.
+-- Values stored by 1.0 stay readable, but btree and hash indexes on jsonbc
+-- columns are ordered and hashed the 1.0 way, so after the update they must
+-- be rebuilt:
+--
+--   REINDEX INDEX <index>;
+--
+-- for every btree or hash index over jsonbc, including expression indexes
+-- and unique constraints.  GIN indexes are not affected.  The indexes to
+-- rebuild can be listed with:
+--
+--   SELECT DISTINCT i.indexrelid::regclass
+--   FROM pg_index i
+--   JOIN pg_class c ON c.oid = i.indexrelid
+--   JOIN pg_am am ON am.oid = c.relam
+--   JOIN pg_opclass o ON o.oid = ANY (i.indclass)
+--   WHERE am.amname IN ('btree', 'hash') AND o.opcintype = 'jsonbc'::regtype;
+--
+
+--
+-- Dictionaries.  Each of them has an id space of its own, allocated from
+-- its own sequence.  Dictionary 0 is the default one, other dictionaries are
+-- selected per column by type modifier, as in jsonbc(name).
+--
+CREATE TABLE jsonbc_dicts
+(
+	id serial PRIMARY KEY,
+	name text NOT NULL,
+	seq regclass NOT NULL,
+	id_floor int NOT NULL DEFAULT 0,	-- new ids must be above it
+	UNIQUE (name)
+);
+
+INSERT INTO jsonbc_dicts (id, name, seq)
+	VALUES (0, 'default', pg_get_serial_sequence('jsonbc_dict', 'id')::regclass);
+
+-- Keys of 1.0 all belong to the default dictionary
+ALTER TABLE jsonbc_dict
+	DROP CONSTRAINT jsonbc_dict_pkey,
+	DROP CONSTRAINT jsonbc_dict_name_key,
+	ADD COLUMN dict int NOT NULL DEFAULT 0 REFERENCES jsonbc_dicts (id),
+	ADD COLUMN retired boolean NOT NULL DEFAULT false,
+	ADD COLUMN retired_at timestamptz,
+	ADD COLUMN encode_values boolean NOT NULL DEFAULT false,
+	ADD PRIMARY KEY (dict, id),
+	ADD UNIQUE (dict, name);
+
+-- New keys take their ids straight from the sequence, in cached blocks
+ALTER SEQUENCE jsonbc_dict_id_seq CACHE 64;
+
+CREATE OR REPLACE FUNCTION jsonbc_create_dict(dict_name text)
+  RETURNS integer AS
+$$
+DECLARE
+	dict_id integer;
+	seq text;
+BEGIN
+	dict_id := nextval(pg_get_serial_sequence('jsonbc_dicts', 'id'));
+	SELECT format('%I.%I', n.nspname, 'jsonbc_dict_' || dict_id || '_seq') INTO seq
+	FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace
+	WHERE c.oid = 'jsonbc_dicts'::regclass;
+
+	EXECUTE 'CREATE SEQUENCE ' || seq || ' MINVALUE 1 CACHE 64';
+	INSERT INTO jsonbc_dicts (id, name, seq) VALUES (dict_id, dict_name, seq::regclass);
+	RETURN dict_id;
+END;
+$$ LANGUAGE plpgsql VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_create_dict(text) IS 'create a new jsonbc key dictionary';
+
+ALTER FUNCTION get_name_by_id(int) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_prewarm()
+  RETURNS bigint AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_prewarm() IS 'load the whole key dictionary into the backend cache';
+
+--
+-- Store short string values of the key as ids from the dictionary, like the
+-- keys themselves.  Meant for keys with a few distinct values repeated over
+-- many rows.  Values already stored are not rewritten, and comparisons work
+-- the same for both forms.
+--
+CREATE OR REPLACE FUNCTION jsonbc_dict_encode_values(dict_name text, key_name text, enable boolean DEFAULT true)
+  RETURNS int AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_encode_values(text, text, boolean) IS 'store string values of the key as dictionary ids';
+
+CREATE OR REPLACE FUNCTION jsonbc_negative_cache_stats(OUT hits bigint, OUT misses bigint, OUT entries bigint, OUT resets bigint)
+  RETURNS record AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_negative_cache_stats() IS 'statistics of the dictionary negative cache of the current backend';
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_generation()
+  RETURNS bigint AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_generation() IS 'number of times the dictionary cache of the current backend was invalidated';
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_stats(OUT scope text,
+	OUT name_hits bigint, OUT name_misses bigint,
+	OUT id_hits bigint, OUT id_misses bigint,
+	OUT spi_calls bigint, OUT inserts bigint, OUT spi_time double precision,
+	OUT entries bigint, OUT bytes bigint)
+  RETURNS SETOF record AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_stats() IS 'dictionary statistics of the current backend and of all the backends';
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_stats_reset()
+  RETURNS void AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_stats_reset() IS 'reset dictionary statistics';
+
+CREATE VIEW pg_stat_jsonbc_dict AS
+	SELECT * FROM jsonbc_dict_stats();
+
+--
+-- Cached dictionary entries are dropped in all the backends whenever
+-- existing entries are changed.  Such changes also bump the version, which
+-- tells whether an exported dictionary file is still valid.  Retired entries
+-- are never cached, so reviving one doesn't count as a change, while
+-- retiring one is, and bumps the version explicitly.
+--
+CREATE TABLE jsonbc_dict_version
+(
+	version bigint NOT NULL
+);
+
+INSERT INTO jsonbc_dict_version VALUES (0);
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_invalidate()
+  RETURNS trigger AS
+'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_bump_version()
+  RETURNS void AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+
+CREATE TRIGGER jsonbc_dict_invalidate
+	AFTER UPDATE OF id, name, encode_values OR DELETE OR TRUNCATE ON jsonbc_dict
+	FOR EACH STATEMENT EXECUTE PROCEDURE jsonbc_dict_invalidate();
+
+--
+-- Export the dictionary into pg_jsonbc/dict_<database oid> under the data
+-- directory.  With jsonbc.dict_file on, backends map the file and look keys
+-- up in it, and the dictionary worker keeps it up to date.
+--
+CREATE OR REPLACE FUNCTION jsonbc_dict_export()
+  RETURNS bigint AS
+'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION jsonbc_dict_export() IS 'write the dictionary file of the current database';
+
+--
+-- The type keeps its 1.0 input and receive functions, which are passed the
+-- type modifier all the same.
+--
+ALTER FUNCTION jsonbc_out(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_send(jsonbc) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_typmod_in(cstring[])
+  RETURNS integer AS
+'MODULE_PATHNAME', 'jsonbc_typmod_in'
+  LANGUAGE C STABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION jsonbc_typmod_in(cstring[]) IS 'I/O typmod';
+
+CREATE OR REPLACE FUNCTION jsonbc_typmod_out(integer)
+  RETURNS cstring AS
+'MODULE_PATHNAME', 'jsonbc_typmod_out'
+  LANGUAGE C STABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION jsonbc_typmod_out(integer) IS 'I/O typmod';
+
+ALTER TYPE jsonbc SET (
+    TYPMOD_IN = jsonbc_typmod_in,
+    TYPMOD_OUT = jsonbc_typmod_out
+);
+
+CREATE OR REPLACE FUNCTION jsonbc(jsonbc, integer, boolean)
+  RETURNS jsonbc AS
+'MODULE_PATHNAME', 'jsonbc_set_dict'
+  LANGUAGE C IMMUTABLE STRICT;
+COMMENT ON FUNCTION jsonbc(jsonbc, integer, boolean) IS 'move jsonbc to the dictionary of the type modifier';
+
+CREATE CAST (jsonbc AS jsonbc) WITH FUNCTION jsonbc(jsonbc, integer, boolean) AS IMPLICIT;
+
+CREATE OR REPLACE FUNCTION jsonbc_dict_id(jsonbc)
+  RETURNS integer AS
+'MODULE_PATHNAME', 'jsonbc_dict_id'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION jsonbc_dict_id(jsonbc) IS 'dictionary the keys of jsonbc belong to';
+
+ALTER FUNCTION jsonbc_array_element(jsonbc, integer) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_array_element_text(jsonbc, integer) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_array_elements(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_array_elements_text(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_array_length(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_cmp(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_contained(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_contains(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_each(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_each_text(jsonbc) PARALLEL SAFE;
+
+-- Key patterns are expanded through the dictionary, in the leader only
+CREATE OR REPLACE FUNCTION jsonbc_each_key_like(IN from_json jsonbc, IN pattern text, OUT key text, OUT value jsonbc)
+  RETURNS SETOF record AS
+'MODULE_PATHNAME', 'jsonbc_each_key_like'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED
+  COST 1
+  ROWS 10;
+COMMENT ON FUNCTION jsonbc_each_key_like(jsonbc, text) IS 'key value pairs of a jsonbc object with keys matching a LIKE pattern';
+
+CREATE OR REPLACE FUNCTION jsonbc_each_key_regex(IN from_json jsonbc, IN pattern text, OUT key text, OUT value jsonbc)
+  RETURNS SETOF record AS
+'MODULE_PATHNAME', 'jsonbc_each_key_regex'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED
+  COST 1
+  ROWS 10;
+COMMENT ON FUNCTION jsonbc_each_key_regex(jsonbc, text) IS 'key value pairs of a jsonbc object with keys matching a regular expression';
+
+ALTER FUNCTION jsonbc_eq(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_exists(jsonbc, text) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_exists_all(jsonbc, text[]) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_exists_any(jsonbc, text[]) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_exists_key_like(jsonbc, text)
+  RETURNS boolean AS
+'MODULE_PATHNAME', 'jsonbc_exists_key_like'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED
+  COST 1;
+COMMENT ON FUNCTION jsonbc_exists_key_like(jsonbc, text) IS 'implementation of ?~~ operator';
+
+CREATE OR REPLACE FUNCTION jsonbc_exists_key_regex(jsonbc, text)
+  RETURNS boolean AS
+'MODULE_PATHNAME', 'jsonbc_exists_key_regex'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED
+  COST 1;
+COMMENT ON FUNCTION jsonbc_exists_key_regex(jsonbc, text) IS 'implementation of ?~ operator';
+
+CREATE OR REPLACE FUNCTION jsonbc_exists_path(jsonbc, text[])
+  RETURNS boolean AS
+'MODULE_PATHNAME', 'jsonbc_exists_path'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION jsonbc_exists_path(jsonbc, text[]) IS 'implementation of ?# operator';
+
+ALTER FUNCTION jsonbc_extract_path(jsonbc, text[]) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_extract_path_op(jsonbc, text[]) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_extract_path_text(jsonbc, text[]) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_extract_path_text_op(jsonbc, text[]) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_ge(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_gt(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_hash(jsonbc) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_ids(jsonbc)
+  RETURNS integer[] AS
+'MODULE_PATHNAME', 'jsonbc_key_ids'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION jsonbc_key_ids(jsonbc) IS 'dictionary ids of all object keys and dictionary-encoded strings in jsonbc';
+
+ALTER FUNCTION jsonbc_le(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_lt(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_ne(jsonbc, jsonbc) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_object_field(jsonbc, text) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_object_field_text(jsonbc, text) PARALLEL SAFE;
+ALTER FUNCTION jsonbc_object_keys(jsonbc) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_remap_keys(jsonbc, integer[])
+  RETURNS jsonbc AS
+'MODULE_PATHNAME', 'jsonbc_remap_keys'
+  LANGUAGE C IMMUTABLE STRICT
+  COST 1;
+COMMENT ON FUNCTION jsonbc_remap_keys(jsonbc, integer[]) IS 'replace key ids of jsonbc according to the map';
+
+CREATE TYPE jsonbc_key_stat AS (
+	dict integer,
+	id integer,
+	count bigint,
+	nulls bigint,
+	strings bigint,
+	numbers bigint,
+	booleans bigint,
+	arrays bigint,
+	objects bigint,
+	distinct_values bigint,
+	avg_size double precision
+);
+
+CREATE OR REPLACE FUNCTION jsonbc_key_stats_transfn(internal, jsonbc)
+  RETURNS internal AS
+'MODULE_PATHNAME', 'jsonbc_key_stats_transfn'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_stats_combine(internal, internal)
+  RETURNS internal AS
+'MODULE_PATHNAME', 'jsonbc_key_stats_combine'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_stats_serialize(internal)
+  RETURNS bytea AS
+'MODULE_PATHNAME', 'jsonbc_key_stats_serialize'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_stats_deserialize(bytea, internal)
+  RETURNS internal AS
+'MODULE_PATHNAME', 'jsonbc_key_stats_deserialize'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_stats_finalfn(internal)
+  RETURNS jsonbc_key_stat[] AS
+'MODULE_PATHNAME', 'jsonbc_key_stats_finalfn'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE AGGREGATE jsonbc_key_stats(jsonbc) (
+	SFUNC = jsonbc_key_stats_transfn,
+	STYPE = internal,
+	FINALFUNC = jsonbc_key_stats_finalfn,
+	COMBINEFUNC = jsonbc_key_stats_combine,
+	SERIALFUNC = jsonbc_key_stats_serialize,
+	DESERIALFUNC = jsonbc_key_stats_deserialize,
+	PARALLEL = SAFE
+);
+COMMENT ON AGGREGATE jsonbc_key_stats(jsonbc) IS 'per-key statistics of jsonbc values: occurrences, value types, distinct values and average size';
+
+ALTER FUNCTION jsonbc_typeof(jsonbc) PARALLEL SAFE;
+ALTER FUNCTION gin_extract_jsonbc(internal, internal, internal) PARALLEL SAFE;
+ALTER FUNCTION gin_extract_jsonbc_path(internal, internal, internal) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION gin_extract_jsonbc_key_path(internal, internal, internal)
+  RETURNS internal AS
+'MODULE_PATHNAME', 'gin_extract_jsonbc_key_path'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION gin_extract_jsonbc_key_path(internal, internal, internal) IS 'GIN support';
+
+ALTER FUNCTION gin_extract_jsonbc_query(anyarray, internal, smallint, internal, internal, internal, internal) PARALLEL SAFE;
+ALTER FUNCTION gin_extract_jsonbc_query_path(anyarray, internal, smallint, internal, internal, internal, internal) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION gin_extract_jsonbc_query_key_path(anyarray, internal, smallint, internal, internal, internal, internal)
+  RETURNS internal AS
+'MODULE_PATHNAME', 'gin_extract_jsonbc_query_key_path'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION gin_extract_jsonbc_query_key_path(anyarray, internal, smallint, internal, internal, internal, internal) IS 'GIN support';
+
+ALTER FUNCTION gin_consistent_jsonbc(internal, smallint, anyarray, integer, internal, internal, internal, internal) PARALLEL SAFE;
+ALTER FUNCTION gin_consistent_jsonbc_path(internal, smallint, anyarray, integer, internal, internal, internal, internal) PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION gin_consistent_jsonbc_key_path(internal, smallint, anyarray, integer, internal, internal, internal, internal)
+  RETURNS boolean AS
+'MODULE_PATHNAME', 'gin_consistent_jsonbc_key_path'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+COMMENT ON FUNCTION gin_consistent_jsonbc_key_path(internal, smallint, anyarray, integer, internal, internal, internal, internal) IS 'GIN support';
+
+ALTER FUNCTION gin_compare_jsonbc(text, text) PARALLEL SAFE;
+
+CREATE OPERATOR ?~~ (
+    PROCEDURE = jsonbc_exists_key_like,
+    LEFTARG = jsonbc,
+    RIGHTARG = text,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+COMMENT ON OPERATOR ?~~ (jsonbc, text) IS 'key matches LIKE pattern';
+
+CREATE OPERATOR ?~ (
+    PROCEDURE = jsonbc_exists_key_regex,
+    LEFTARG = jsonbc,
+    RIGHTARG = text,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+COMMENT ON OPERATOR ?~ (jsonbc, text) IS 'key matches regular expression';
+
+CREATE OPERATOR ?# (
+    PROCEDURE = jsonbc_exists_path,
+    LEFTARG = jsonbc,
+    RIGHTARG = text[],
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+COMMENT ON OPERATOR ?# (jsonbc, text[]) IS 'key path exists';
+
+CREATE OPERATOR CLASS jsonbc_key_path_ops
+   FOR TYPE jsonbc USING gin AS
+   OPERATOR 12  ?#(jsonbc, _text),
+   FUNCTION 1  btint4cmp(integer, integer),
+   FUNCTION 2  gin_extract_jsonbc_key_path(internal, internal, internal),
+   FUNCTION 3  gin_extract_jsonbc_query_key_path(anyarray, internal, smallint, internal, internal, internal, internal),
+   FUNCTION 4  gin_consistent_jsonbc_key_path(internal, smallint, anyarray, integer, internal, internal, internal, internal),
+   STORAGE int4;
+
+CREATE OR REPLACE FUNCTION jsonbc_key_frequencies(dict_name text DEFAULT 'default', OUT id integer, OUT freq bigint)
+  RETURNS SETOF record AS
+$$
+DECLARE
+	dict_id integer;
+	col record;
+	query text := '';
+BEGIN
+	SELECT d.id INTO dict_id FROM jsonbc_dicts d WHERE d.name = dict_name;
+	IF NOT FOUND THEN
+		RAISE EXCEPTION 'jsonbc dictionary "%" does not exist', dict_name;
+	END IF;
+
+	-- Columns with a type modifier only hold values of their dictionary
+	FOR col IN
+		SELECT a.attrelid::regclass AS rel, a.attname
+		FROM pg_attribute a JOIN pg_class c ON c.oid = a.attrelid
+		WHERE a.atttypid = 'jsonbc'::regtype AND a.attnum > 0 AND
+			  NOT a.attisdropped AND c.relkind = 'r' AND
+			  (c.relpersistence <> 't' OR c.relnamespace = pg_my_temp_schema()) AND
+			  (a.atttypmod < 0 OR a.atttypmod = dict_id)
+	LOOP
+		IF query <> '' THEN
+			query := query || ' UNION ALL ';
+		END IF;
+		query := query || format('SELECT unnest(jsonbc_key_ids(%I)) FROM %s WHERE jsonbc_dict_id(%I) = %s',
+								 col.attname, col.rel, col.attname, dict_id);
+	END LOOP;
+
+	IF query <> '' THEN
+		RETURN QUERY EXECUTE
+			'SELECT k, count(*) FROM (' || query || ') s(k) GROUP BY k';
+	END IF;
+END;
+$$ LANGUAGE plpgsql STABLE;
+COMMENT ON FUNCTION jsonbc_key_frequencies(text) IS 'number of occurrences of each key of the dictionary in all jsonbc columns';
+
+--
+-- Give the smallest ids of the dictionary to the most frequent keys, so that
+-- key deltas within objects take fewer bytes, and rewrite all the jsonbc
+-- columns accordingly.  Columns of domains, arrays or composite types over
+-- jsonbc are not supported, and neither are temporary tables of other
+-- sessions.
+--
+-- Runs online, alongside reads and ingest, in two phases: first every key
+-- moves to a temporary id above anything handed out so far, then to its
+-- final id.  Each phase changes the ids in jsonbc_dict at once, and keeps
+-- the previous ids in jsonbc_dict_map, through which values not rewritten
+-- yet are read.  The previous and the current ids never overlap, and new
+-- keys take ids above both, so values of either kind can be told apart.
+--
+-- Once every transaction which might have cached the previous ids is gone,
+-- the columns are rewritten in batches of pages, each committed on its own.
+-- Once the transactions which might have copied values not rewritten yet are
+-- gone as well, every column is checked for the previous ids, and scanned
+-- again if some are left.  Only then the next phase starts.
+--
+-- Each call scans at most batch_pages pages, and returns the current phase,
+-- or 0 once renumbering is complete, along with the number of rows
+-- rewritten.  Call it, each time in a transaction of its own, until it
+-- returns 0.  Calls made while the previous ids might be in use do nothing.
+--
+CREATE TABLE jsonbc_renumber
+(
+	dict int PRIMARY KEY REFERENCES jsonbc_dicts (id),
+	phase int NOT NULL,
+	base int NOT NULL,			-- temporary ids are base + final id
+	nkeys int NOT NULL,
+	changed_at timestamptz NOT NULL,	-- ids in jsonbc_dict changed
+	rewritten_at timestamptz NOT NULL,	-- last rows rewritten
+	rel oid,					-- column to scan next, in attrelid order
+	att int2,
+	next_block bigint NOT NULL DEFAULT 0,
+	checking boolean NOT NULL DEFAULT false	-- scan is over, check is due
+);
+
+CREATE TABLE jsonbc_dict_map
+(
+	dict int NOT NULL REFERENCES jsonbc_dicts (id),
+	old_id int NOT NULL,
+	new_id int NOT NULL,
+	PRIMARY KEY (dict, old_id)
+);
+
+CREATE TRIGGER jsonbc_dict_map_invalidate
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON jsonbc_dict_map
+	FOR EACH STATEMENT EXECUTE PROCEDURE jsonbc_dict_invalidate();
+
+CREATE OR REPLACE FUNCTION jsonbc_renumber_keys(dict_name text DEFAULT 'default',
+												batch_pages integer DEFAULT 1024,
+												OUT phase integer, OUT rewritten bigint)
+  RETURNS record AS
+$$
+DECLARE
+	dict_id integer;
+	dict_seq regclass;
+	state jsonbc_renumber%ROWTYPE;
+	base integer;
+	nkeys integer;
+	col record;
+	entry record;
+	map integer[];
+	map_min integer;
+	map_max integer;
+	pages bigint := 0;
+	nblocks bigint;
+	last_block bigint;
+	nrewritten bigint;
+	found_old boolean;
+BEGIN
+	SELECT d.id, d.seq INTO dict_id, dict_seq FROM jsonbc_dicts d WHERE d.name = dict_name;
+	IF NOT FOUND THEN
+		RAISE EXCEPTION 'jsonbc dictionary "%" does not exist', dict_name;
+	END IF;
+
+	IF current_setting('transaction_isolation') <> 'read committed' THEN
+		RAISE EXCEPTION 'jsonbc_renumber_keys must run in read committed mode';
+	END IF;
+
+	-- Keep concurrent runs apart, and away from jsonbc_dict_gc()
+	LOCK TABLE jsonbc_dict IN SHARE UPDATE EXCLUSIVE MODE;
+
+	rewritten := 0;
+	SELECT * INTO state FROM jsonbc_renumber r WHERE r.dict = dict_id;
+	IF NOT FOUND THEN
+		-- Rank the keys before new keys are locked out, it takes a while
+		CREATE TEMP TABLE jsonbc_renumber_rank ON COMMIT DROP AS
+			SELECT d.id, coalesce(f.freq, 0) AS freq
+			FROM jsonbc_dict d LEFT JOIN jsonbc_key_frequencies(dict_name) f ON f.id = d.id
+			WHERE d.dict = dict_id;
+
+		LOCK TABLE jsonbc_dict IN SHARE ROW EXCLUSIVE MODE;
+
+		-- Keys added in the meantime come last
+		INSERT INTO jsonbc_renumber_rank
+			SELECT d.id, -1 FROM jsonbc_dict d
+			WHERE d.dict = dict_id AND
+				  NOT EXISTS (SELECT 1 FROM jsonbc_renumber_rank r WHERE r.id = d.id);
+
+		IF NOT EXISTS (SELECT 1
+					   FROM (SELECT r.id, row_number() OVER (ORDER BY r.freq DESC, r.id) AS rank
+							 FROM jsonbc_renumber_rank r) s
+					   WHERE s.rank <> s.id) THEN
+			DROP TABLE jsonbc_renumber_rank;
+			phase := 0;
+			RETURN;
+		END IF;
+
+		-- The sequence's last value covers the values cached by all sessions
+		EXECUTE format('SELECT last_value FROM %s', dict_seq) INTO base;
+		base := greatest(base, (SELECT max(d.id) FROM jsonbc_dict d WHERE d.dict = dict_id));
+
+		INSERT INTO jsonbc_dict_map (dict, old_id, new_id)
+			SELECT dict_id, r.id,
+				   base + (row_number() OVER (ORDER BY r.freq DESC, r.id))::integer
+			FROM jsonbc_renumber_rank r;
+		GET DIAGNOSTICS nkeys = ROW_COUNT;
+		DROP TABLE jsonbc_renumber_rank;
+
+		-- New keys go above the temporary ids, even from cached values
+		UPDATE jsonbc_dicts d SET id_floor = base + nkeys WHERE d.id = dict_id;
+		PERFORM setval(dict_seq, base + nkeys);
+
+		UPDATE jsonbc_dict d SET id = m.new_id
+		FROM jsonbc_dict_map m
+		WHERE d.dict = dict_id AND m.dict = dict_id AND m.old_id = d.id;
+
+		INSERT INTO jsonbc_renumber (dict, phase, base, nkeys, changed_at, rewritten_at)
+			VALUES (dict_id, 1, base, nkeys, now(), now());
+		phase := 1;
+		RETURN;
+	END IF;
+
+	phase := state.phase;
+	IF jsonbc_dict_horizon() <= state.changed_at THEN
+		RETURN;
+	END IF;
+
+	-- Values are rewritten through a map indexed by the previous ids
+	SELECT min(m.old_id), max(m.old_id) INTO map_min, map_max
+	FROM jsonbc_dict_map m WHERE m.dict = dict_id;
+	map := array_fill(0, ARRAY[map_max - map_min + 1], ARRAY[map_min]);
+	FOR entry IN SELECT m.old_id, m.new_id FROM jsonbc_dict_map m WHERE m.dict = dict_id LOOP
+		map[entry.old_id] := entry.new_id;
+	END LOOP;
+
+	LOOP
+		IF state.checking THEN
+			IF jsonbc_dict_horizon() <= state.rewritten_at THEN
+				EXIT;
+			END IF;
+
+			found_old := false;
+			FOR col IN
+				SELECT a.attrelid::regclass AS rel, a.attname
+				FROM pg_attribute a JOIN pg_class c ON c.oid = a.attrelid
+				WHERE a.atttypid = 'jsonbc'::regtype AND a.attnum > 0 AND
+					  NOT a.attisdropped AND c.relkind = 'r' AND
+					  (c.relpersistence <> 't' OR c.relnamespace = pg_my_temp_schema()) AND
+					  (a.atttypmod < 0 OR a.atttypmod = dict_id)
+			LOOP
+				EXECUTE format('SELECT EXISTS (SELECT 1 FROM %s t WHERE jsonbc_dict_id(t.%I) = $1 AND '
+							   'EXISTS (SELECT 1 FROM unnest(jsonbc_key_ids(t.%I)) k WHERE k BETWEEN $2 AND $3))',
+							   col.rel, col.attname, col.attname)
+					INTO found_old USING dict_id, map_min, map_max;
+				EXIT WHEN found_old;
+			END LOOP;
+
+			IF found_old THEN
+				-- Rows moved by concurrent updates, scan once again
+				state.checking := false;
+				state.rel := NULL;
+				state.att := NULL;
+				state.next_block := 0;
+				CONTINUE;
+			END IF;
+
+			DELETE FROM jsonbc_dict_map m WHERE m.dict = dict_id;
+			IF state.phase = 2 THEN
+				DELETE FROM jsonbc_renumber r WHERE r.dict = dict_id;
+				phase := 0;
+				RETURN;
+			END IF;
+
+			-- Move on to the final ids
+			INSERT INTO jsonbc_dict_map (dict, old_id, new_id)
+				SELECT dict_id, d.id, d.id - state.base
+				FROM jsonbc_dict d
+				WHERE d.dict = dict_id AND
+					  d.id > state.base AND d.id <= state.base + state.nkeys;
+			UPDATE jsonbc_dict d SET id = m.new_id
+			FROM jsonbc_dict_map m
+			WHERE d.dict = dict_id AND m.dict = dict_id AND m.old_id = d.id;
+
+			UPDATE jsonbc_renumber r
+			SET phase = 2, changed_at = now(), rewritten_at = now(), rel = NULL,
+				att = NULL, next_block = 0, checking = false
+			WHERE r.dict = dict_id;
+			phase := 2;
+			RETURN;
+		END IF;
+
+		-- Columns with a type modifier only hold values of their dictionary
+		SELECT a.attrelid, a.attrelid::regclass AS rel, a.attnum, a.attname INTO col
+		FROM pg_attribute a JOIN pg_class c ON c.oid = a.attrelid
+		WHERE a.atttypid = 'jsonbc'::regtype AND a.attnum > 0 AND
+			  NOT a.attisdropped AND c.relkind = 'r' AND
+			  (c.relpersistence <> 't' OR c.relnamespace = pg_my_temp_schema()) AND
+			  (a.atttypmod < 0 OR a.atttypmod = dict_id) AND
+			  (a.attrelid, a.attnum) >= (coalesce(state.rel, 0), coalesce(state.att, 0))
+		ORDER BY a.attrelid, a.attnum
+		LIMIT 1;
+
+		IF NOT FOUND THEN
+			state.checking := true;
+			CONTINUE;
+		ELSIF col.attrelid IS DISTINCT FROM state.rel OR col.attnum IS DISTINCT FROM state.att THEN
+			state.rel := col.attrelid;
+			state.att := col.attnum;
+			state.next_block := 0;
+		END IF;
+
+		EXIT WHEN pages >= batch_pages;
+
+		-- Rows appended while the column is scanned are caught up with
+		nblocks := pg_relation_size(col.rel) / current_setting('block_size')::bigint;
+		IF state.next_block >= nblocks THEN
+			state.att := col.attnum + 1;
+			CONTINUE;
+		END IF;
+
+		last_block := least(state.next_block + batch_pages - pages, nblocks);
+		EXECUTE format(
+			'WITH upd AS ('
+			'	UPDATE %s t SET %I = jsonbc_remap_keys(t.%I, $1) '
+			'	WHERE t.ctid >= $2 AND t.ctid < $3 AND jsonbc_dict_id(t.%I) = $4 AND '
+			'		  EXISTS (SELECT 1 FROM unnest(jsonbc_key_ids(t.%I)) k '
+			'				  WHERE k BETWEEN $5 AND $6) '
+			'	RETURNING 1) '
+			'SELECT count(*) FROM upd',
+			col.rel, col.attname, col.attname, col.attname, col.attname)
+			INTO nrewritten
+			USING map, format('(%s,0)', state.next_block)::tid,
+				  format('(%s,0)', last_block)::tid, dict_id, map_min, map_max;
+
+		pages := pages + last_block - state.next_block;
+		state.next_block := last_block;
+		IF nrewritten > 0 THEN
+			rewritten := rewritten + nrewritten;
+			state.rewritten_at := now();
+		END IF;
+	END LOOP;
+
+	UPDATE jsonbc_renumber r
+	SET rewritten_at = state.rewritten_at, rel = state.rel, att = state.att,
+		next_block = state.next_block, checking = state.checking
+	WHERE r.dict = dict_id;
+END;
+$$ LANGUAGE plpgsql VOLATILE;
+COMMENT ON FUNCTION jsonbc_renumber_keys(text, integer) IS 'renumber keys of the dictionary by frequency and rewrite jsonbc columns, a batch at a time';
+
+--
+-- Start time of the oldest transaction which might still use ids cached
+-- before now.  Every process connected to the database counts: client
+-- backends as well as background workers, such as the dictionary worker,
+-- logical replication workers or parallel workers.  Autovacuum workers are
+-- left out, they never encode jsonbc.  Sessions whose transactions are not
+-- visible to us hold the horizon back, and so do prepared transactions.
+--
+CREATE OR REPLACE FUNCTION jsonbc_dict_horizon()
+  RETURNS timestamptz AS
+$$
+DECLARE
+	horizon timestamptz;
+BEGIN
+	SELECT min(coalesce(a.xact_start, '-infinity')) INTO horizon
+	FROM pg_stat_activity a
+	WHERE a.datname = current_database() AND a.pid <> pg_backend_pid() AND
+		  a.backend_type IS DISTINCT FROM 'autovacuum worker' AND
+		  (a.xact_start IS NOT NULL OR a.query = '<insufficient privilege>');
+	IF EXISTS (SELECT 1 FROM pg_prepared_xacts p WHERE p.database = current_database()) THEN
+		horizon := '-infinity';
+	END IF;
+	RETURN coalesce(horizon, now());
+END;
+$$ LANGUAGE plpgsql VOLATILE;
+COMMENT ON FUNCTION jsonbc_dict_horizon() IS 'start time of the oldest transaction which might use cached dictionary ids';
+
+--
+-- Remove keys of the dictionary which are not used in any jsonbc column.
+-- Runs online, alongside ingest, so it never removes a key in one go:
+--
+--  1. A key found unused is marked retired.  Sessions which encode it again
+--     revive it, and at commit all the sessions drop their cached ids.
+--  2. The next run stamps it with its start time.  Transactions which might
+--     still use a cached id of the key all started before that.
+--  3. A later run removes it, once every transaction older than the stamp
+--     is gone and the key is still unused.
+--
+-- Keys found in use are revived, and keys set up with
+-- jsonbc_dict_encode_values() are kept.  Must run in read committed mode, so
+-- that the scan sees everything committed by the transactions it waited for.
+--
+CREATE OR REPLACE FUNCTION jsonbc_dict_gc(dict_name text DEFAULT 'default',
+										  OUT retired bigint, OUT removed bigint, OUT revived bigint)
+  RETURNS record AS
+$$
+DECLARE
+	dict_id integer;
+	horizon timestamptz;
+BEGIN
+	SELECT d.id INTO dict_id FROM jsonbc_dicts d WHERE d.name = dict_name;
+	IF NOT FOUND THEN
+		RAISE EXCEPTION 'jsonbc dictionary "%" does not exist', dict_name;
+	END IF;
+
+	IF current_setting('transaction_isolation') <> 'read committed' THEN
+		RAISE EXCEPTION 'jsonbc_dict_gc must run in read committed mode';
+	END IF;
+
+	-- Keep concurrent runs apart, ingest is not blocked
+	LOCK TABLE jsonbc_dict IN SHARE UPDATE EXCLUSIVE MODE;
+
+	-- Keys in use might not be found by their current ids
+	IF EXISTS (SELECT 1 FROM jsonbc_renumber r WHERE r.dict = dict_id) THEN
+		RAISE EXCEPTION 'jsonbc dictionary "%" is being renumbered', dict_name;
+	END IF;
+
+	horizon := jsonbc_dict_horizon();
+
+	CREATE TEMP TABLE jsonbc_gc_live ON COMMIT DROP AS
+		SELECT f.id FROM jsonbc_key_frequencies(dict_name) f;
+	ANALYZE jsonbc_gc_live;
+
+	DELETE FROM jsonbc_dict d
+	WHERE d.dict = dict_id AND d.retired AND d.retired_at < horizon AND
+		  NOT EXISTS (SELECT 1 FROM jsonbc_gc_live l WHERE l.id = d.id);
+	GET DIAGNOSTICS removed = ROW_COUNT;
+
+	UPDATE jsonbc_dict d SET retired = false, retired_at = NULL
+	WHERE d.dict = dict_id AND d.retired AND
+		  EXISTS (SELECT 1 FROM jsonbc_gc_live l WHERE l.id = d.id);
+	GET DIAGNOSTICS revived = ROW_COUNT;
+
+	UPDATE jsonbc_dict d SET retired_at = now()
+	WHERE d.dict = dict_id AND d.retired AND d.retired_at IS NULL;
+
+	UPDATE jsonbc_dict d SET retired = true
+	WHERE d.dict = dict_id AND NOT d.retired AND NOT d.encode_values AND
+		  NOT EXISTS (SELECT 1 FROM jsonbc_gc_live l WHERE l.id = d.id);
+	GET DIAGNOSTICS retired = ROW_COUNT;
+	IF retired > 0 THEN
+		PERFORM jsonbc_dict_bump_version();
+	END IF;
+
+	DROP TABLE jsonbc_gc_live;
+END;
+$$ LANGUAGE plpgsql VOLATILE;
+COMMENT ON FUNCTION jsonbc_dict_gc(text) IS 'retire and remove keys of the dictionary not used in any jsonbc column';
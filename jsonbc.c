@@ -12,11 +12,19 @@
  */
 #include "postgres.h"
 
+#include "catalog/pg_type.h"
 #include "libpq/pqformat.h"
 #include "jsonbc.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/planner.h"
+#include "parser/analyze.h"
 #include "utils/builtins.h"
+#include "utils/expandeddatum.h"
 #include "utils/json.h"
 #include "utils/jsonapi.h"
+#include "utils/memutils.h"
+
+#include "dict.h"
 
 PG_MODULE_MAGIC;
 
@@ -28,12 +36,18 @@ PG_FUNCTION_INFO_V1(jsonbc_array_length);
 PG_FUNCTION_INFO_V1(jsonbc_cmp);
 PG_FUNCTION_INFO_V1(jsonbc_contained);
 PG_FUNCTION_INFO_V1(jsonbc_contains);
+PG_FUNCTION_INFO_V1(jsonbc_dict_id);
 PG_FUNCTION_INFO_V1(jsonbc_each);
+PG_FUNCTION_INFO_V1(jsonbc_each_key_like);
+PG_FUNCTION_INFO_V1(jsonbc_each_key_regex);
 PG_FUNCTION_INFO_V1(jsonbc_each_text);
 PG_FUNCTION_INFO_V1(jsonbc_eq);
 PG_FUNCTION_INFO_V1(jsonbc_exists);
 PG_FUNCTION_INFO_V1(jsonbc_exists_all);
 PG_FUNCTION_INFO_V1(jsonbc_exists_any);
+PG_FUNCTION_INFO_V1(jsonbc_exists_key_like);
+PG_FUNCTION_INFO_V1(jsonbc_exists_key_regex);
+PG_FUNCTION_INFO_V1(jsonbc_exists_path);
 PG_FUNCTION_INFO_V1(jsonbc_extract_path);
 PG_FUNCTION_INFO_V1(jsonbc_extract_path_op);
 PG_FUNCTION_INFO_V1(jsonbc_extract_path_text);
@@ -42,6 +56,12 @@ PG_FUNCTION_INFO_V1(jsonbc_ge);
 PG_FUNCTION_INFO_V1(jsonbc_gt);
 PG_FUNCTION_INFO_V1(jsonbc_hash);
 PG_FUNCTION_INFO_V1(jsonbc_in);
+PG_FUNCTION_INFO_V1(jsonbc_key_ids);
+PG_FUNCTION_INFO_V1(jsonbc_key_stats_combine);
+PG_FUNCTION_INFO_V1(jsonbc_key_stats_deserialize);
+PG_FUNCTION_INFO_V1(jsonbc_key_stats_finalfn);
+PG_FUNCTION_INFO_V1(jsonbc_key_stats_serialize);
+PG_FUNCTION_INFO_V1(jsonbc_key_stats_transfn);
 PG_FUNCTION_INFO_V1(jsonbc_le);
 PG_FUNCTION_INFO_V1(jsonbc_lt);
 PG_FUNCTION_INFO_V1(jsonbc_ne);
@@ -52,26 +72,66 @@ PG_FUNCTION_INFO_V1(jsonbc_out);
 PG_FUNCTION_INFO_V1(jsonbc_populate_record);
 PG_FUNCTION_INFO_V1(jsonbc_populate_recordset);
 PG_FUNCTION_INFO_V1(jsonbc_recv);
+PG_FUNCTION_INFO_V1(jsonbc_remap_keys);
 PG_FUNCTION_INFO_V1(jsonbc_send);
+PG_FUNCTION_INFO_V1(jsonbc_set_dict);
 PG_FUNCTION_INFO_V1(jsonbc_to_record);
 PG_FUNCTION_INFO_V1(jsonbc_to_recordset);
 PG_FUNCTION_INFO_V1(jsonbc_typeof);
+PG_FUNCTION_INFO_V1(jsonbc_typmod_in);
+PG_FUNCTION_INFO_V1(jsonbc_typmod_out);
 PG_FUNCTION_INFO_V1(gin_extract_jsonbc);
 PG_FUNCTION_INFO_V1(gin_extract_jsonbc_path);
+PG_FUNCTION_INFO_V1(gin_extract_jsonbc_key_path);
 PG_FUNCTION_INFO_V1(gin_extract_jsonbc_query);
 PG_FUNCTION_INFO_V1(gin_extract_jsonbc_query_path);
+PG_FUNCTION_INFO_V1(gin_extract_jsonbc_query_key_path);
 PG_FUNCTION_INFO_V1(gin_consistent_jsonbc);
 PG_FUNCTION_INFO_V1(gin_consistent_jsonbc_path);
+PG_FUNCTION_INFO_V1(gin_consistent_jsonbc_key_path);
 PG_FUNCTION_INFO_V1(gin_compare_jsonbc);
 
 typedef struct JsonbcInState
 {
-	JsonbcParseState *parseState;
-	JsonbcValue *res;
+	JsonbcEncoder *encoder;
+	int			depth;			/* number of containers open */
+	bool		inField;		/* next value is an object field's */
 } JsonbcInState;
 
-static inline Datum jsonbc_from_cstring(char *json, int len);
+/*
+ * Untyped input, see jsonbc_in().  It's kept as text, along with its key
+ * names, until the dictionary it goes to is known.
+ */
+typedef struct DeferredJsonbc
+{
+	ExpandedObjectHeader hdr;
+	char	   *json;
+	int			len;
+	JsonbcEncoder *keys;		/* key names of the input, not resolved */
+	Jsonbc	   *flat;			/* in the default dictionary, once needed */
+} DeferredJsonbc;
+
+static Size deferred_get_flat_size(ExpandedObjectHeader *eohptr);
+static void deferred_flatten_into(ExpandedObjectHeader *eohptr,
+					  void *result, Size allocated_size);
+
+static const ExpandedObjectMethods deferred_methods =
+{
+	deferred_get_flat_size,
+	deferred_flatten_into
+};
+
+static post_parse_analyze_hook_type prev_post_parse_analyze_hook = NULL;
+static planner_hook_type prev_planner_hook = NULL;
+
+static inline Datum jsonbc_from_cstring(char *json, int len, int32 dict);
+static JsonbcEncoder *jsonbc_collect_keys(char *json, int len);
+static Jsonbc *jsonbc_encode(char *json, int len, JsonbcEncoder *encoder,
+			  int32 dict);
 static size_t checkStringLen(size_t len);
+static void jsonbc_collect_container(void *pstate);
+static void jsonbc_collect_field(void *pstate, char *fname, bool isnull);
+static void jsonbc_collect_scalar(void *pstate, char *token, JsonTokenType tokentype);
 static void jsonbc_in_object_start(void *pstate);
 static void jsonbc_in_object_end(void *pstate);
 static void jsonbc_in_array_start(void *pstate);
@@ -80,15 +140,247 @@ static void jsonbc_in_object_field_start(void *pstate, char *fname, bool isnull)
 static void jsonbc_put_escaped_value(StringInfo out, JsonbcValue *scalarVal);
 static void jsonbc_in_scalar(void *pstate, char *token, JsonTokenType tokentype);
 
+/*
+ * Dictionary selected by type modifier.
+ */
+static int32
+typmodGetDict(int32 typmod)
+{
+	return (typmod >= 0) ? typmod : DefaultDictId;
+}
+
+/*
+ * Keep untyped input as a DeferredJsonbc.  The input is checked, and its key
+ * names are collected, but not resolved.
+ */
+static Datum
+jsonbc_defer(char *json, int len)
+{
+	MemoryContext objcxt;
+	MemoryContext oldcxt;
+	DeferredJsonbc *djb;
+
+	objcxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "deferred jsonbc",
+								   ALLOCSET_SMALL_MINSIZE,
+								   ALLOCSET_SMALL_INITSIZE,
+								   ALLOCSET_DEFAULT_MAXSIZE);
+
+	djb = (DeferredJsonbc *) MemoryContextAlloc(objcxt, sizeof(DeferredJsonbc));
+	EOH_init_header(&djb->hdr, &deferred_methods, objcxt);
+
+	oldcxt = MemoryContextSwitchTo(objcxt);
+	djb->json = palloc(len);
+	memcpy(djb->json, json, len);
+	djb->len = len;
+	djb->keys = jsonbc_collect_keys(djb->json, len);
+	djb->flat = NULL;
+	MemoryContextSwitchTo(oldcxt);
+
+	return EOHPGetRODatum(&djb->hdr);
+}
+
+/*
+ * DeferredJsonbc behind a datum, or NULL if it's not one.
+ */
+static DeferredJsonbc *
+jsonbc_get_deferred(Datum d)
+{
+	ExpandedObjectHeader *eohptr;
+
+	if (!VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(d)))
+		return NULL;
+
+	eohptr = DatumGetEOHP(d);
+	if (eohptr->eoh_methods != &deferred_methods)
+		return NULL;
+
+	return (DeferredJsonbc *) eohptr;
+}
+
+/*
+ * Serialize deferred input into dictionary "dict".
+ */
+static Jsonbc *
+jsonbc_resolve_deferred(DeferredJsonbc *djb, int32 dict)
+{
+	if (dict == DefaultDictId && djb->flat)
+		return djb->flat;
+
+	return jsonbc_encode(djb->json, djb->len, JsonbcEncoderInit(djb->keys),
+						 dict);
+}
+
+/*
+ * Anything but the length coercion flattens deferred input, which then
+ * goes into the default dictionary.
+ */
+static Size
+deferred_get_flat_size(ExpandedObjectHeader *eohptr)
+{
+	DeferredJsonbc *djb = (DeferredJsonbc *) eohptr;
+
+	if (!djb->flat)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(eohptr->eoh_context);
+
+		djb->flat = jsonbc_resolve_deferred(djb, DefaultDictId);
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	return VARSIZE(djb->flat);
+}
+
+static void
+deferred_flatten_into(ExpandedObjectHeader *eohptr,
+					  void *result, Size allocated_size)
+{
+	DeferredJsonbc *djb = (DeferredJsonbc *) eohptr;
+
+	Assert(djb->flat && allocated_size == VARSIZE(djb->flat));
+	memcpy(result, djb->flat, allocated_size);
+}
+
+/*
+ * Tree walker of the hooks below: serialize deferred input which is coerced
+ * to jsonbc(name) straight into that dictionary, whether it's a literal or a
+ * parameter of the query.  Parsed queries are copied before they are
+ * planned, and substituted parameters are copied while planning, which
+ * would flatten the input into the default dictionary first.
+ */
+static bool
+jsonbc_deferred_walker(Node *node, ParamListInfo params)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Query))
+		return query_tree_walker((Query *) node, jsonbc_deferred_walker,
+								 (void *) params, 0);
+
+	/*
+	 * The only length coercion of deferred input there is, is
+	 * jsonbc_set_dict()
+	 */
+	if (IsA(node, FuncExpr) &&
+		(((FuncExpr *) node)->funcformat == COERCE_IMPLICIT_CAST ||
+		 ((FuncExpr *) node)->funcformat == COERCE_EXPLICIT_CAST) &&
+		list_length(((FuncExpr *) node)->args) == 3 &&
+		IsA(lsecond(((FuncExpr *) node)->args), Const))
+	{
+		FuncExpr   *expr = (FuncExpr *) node;
+		Node	   *arg = linitial(expr->args);
+		Const	   *typmod = (Const *) lsecond(expr->args);
+		DeferredJsonbc *djb;
+
+		if (!typmod->constisnull && DatumGetInt32(typmod->constvalue) >= 0)
+		{
+			int32		dict = typmodGetDict(DatumGetInt32(typmod->constvalue));
+
+			if (IsA(arg, Const) && !((Const *) arg)->constisnull &&
+				((Const *) arg)->consttype == expr->funcresulttype &&
+				(djb = jsonbc_get_deferred(((Const *) arg)->constvalue)) != NULL)
+			{
+				((Const *) arg)->constvalue =
+					PointerGetDatum(jsonbc_resolve_deferred(djb, dict));
+			}
+			else if (IsA(arg, Param) && params && !params->paramFetch &&
+					 ((Param *) arg)->paramkind == PARAM_EXTERN &&
+					 ((Param *) arg)->paramid > 0 &&
+					 ((Param *) arg)->paramid <= params->numParams)
+			{
+				ParamExternData *prm = &params->params[((Param *) arg)->paramid - 1];
+
+				if (!prm->isnull && prm->ptype == expr->funcresulttype &&
+					(djb = jsonbc_get_deferred(prm->value)) != NULL)
+				{
+					/* The value has to live as long as the parameters */
+					MemoryContext oldcxt;
+
+					oldcxt = MemoryContextSwitchTo(GetMemoryChunkContext(params));
+					prm->value = PointerGetDatum(jsonbc_resolve_deferred(djb, dict));
+					MemoryContextSwitchTo(oldcxt);
+				}
+			}
+		}
+	}
+
+	return expression_tree_walker(node, jsonbc_deferred_walker, (void *) params);
+}
+
+#if PG_VERSION_NUM >= 140000
+static void
+jsonbc_post_parse_analyze(ParseState *pstate, Query *query, JumbleState *jstate)
+#else
+static void
+jsonbc_post_parse_analyze(ParseState *pstate, Query *query)
+#endif
+{
+#if PG_VERSION_NUM >= 140000
+	if (prev_post_parse_analyze_hook)
+		prev_post_parse_analyze_hook(pstate, query, jstate);
+#else
+	if (prev_post_parse_analyze_hook)
+		prev_post_parse_analyze_hook(pstate, query);
+#endif
+
+	(void) jsonbc_deferred_walker((Node *) query, NULL);
+}
+
+#if PG_VERSION_NUM >= 130000
+static PlannedStmt *
+jsonbc_planner(Query *parse, const char *query_string, int cursorOptions,
+			   ParamListInfo boundParams)
+#else
+static PlannedStmt *
+jsonbc_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+#endif
+{
+	if (boundParams)
+		(void) jsonbc_deferred_walker((Node *) parse, boundParams);
+
+#if PG_VERSION_NUM >= 130000
+	if (prev_planner_hook)
+		return prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+	return standard_planner(parse, query_string, cursorOptions, boundParams);
+#else
+	if (prev_planner_hook)
+		return prev_planner_hook(parse, cursorOptions, boundParams);
+	return standard_planner(parse, cursorOptions, boundParams);
+#endif
+}
+
+/*
+ * Install the hooks which resolve deferred input, called by _PG_init().
+ */
+void
+JsonbcInitDeferredInput(void)
+{
+	prev_post_parse_analyze_hook = post_parse_analyze_hook;
+	post_parse_analyze_hook = jsonbc_post_parse_analyze;
+	prev_planner_hook = planner_hook;
+	planner_hook = jsonbc_planner;
+}
+
 /*
  * jsonbc type input function
+ *
+ * COPY passes the type modifier of the column, so keys go straight into its
+ * dictionary.  Literals and parameters are parsed with typmod -1 before they
+ * are coerced to the column type, so their keys are not resolved until the
+ * coercion picks the dictionary, see DeferredJsonbc.  Untyped input which is
+ * used otherwise goes into the default dictionary.
  */
 Datum
 jsonbc_in(PG_FUNCTION_ARGS)
 {
 	char	   *json = PG_GETARG_CSTRING(0);
+	int32		typmod = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
+
+	if (typmod < 0)
+		PG_RETURN_DATUM(jsonbc_defer(json, strlen(json)));
 
-	return jsonbc_from_cstring(json, strlen(json));
+	return jsonbc_from_cstring(json, strlen(json), typmodGetDict(typmod));
 }
 
 /*
@@ -103,6 +395,7 @@ Datum
 jsonbc_recv(PG_FUNCTION_ARGS)
 {
 	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int32		typmod = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
 	int			version = pq_getmsgint(buf, 1);
 	char	   *str;
 	int			nbytes;
@@ -112,7 +405,10 @@ jsonbc_recv(PG_FUNCTION_ARGS)
 	else
 		elog(ERROR, "unsupported jsonbc version number %d", version);
 
-	return jsonbc_from_cstring(str, nbytes);
+	if (typmod < 0)
+		PG_RETURN_DATUM(jsonbc_defer(str, nbytes));
+
+	return jsonbc_from_cstring(str, nbytes, typmodGetDict(typmod));
 }
 
 /*
@@ -124,7 +420,7 @@ jsonbc_out(PG_FUNCTION_ARGS)
 	Jsonbc	   *jb = PG_GETARG_JSONB(0);
 	char	   *out;
 
-	out = JsonbcToCString(NULL, &jb->root, VARSIZE(jb));
+	out = JsonbcToCString(NULL, &jb->root, DefaultDictId, VARSIZE(jb));
 
 	PG_RETURN_CSTRING(out);
 }
@@ -142,7 +438,7 @@ jsonbc_send(PG_FUNCTION_ARGS)
 	StringInfo	jtext = makeStringInfo();
 	int			version = 1;
 
-	(void) JsonbcToCString(jtext, &jb->root, VARSIZE(jb));
+	(void) JsonbcToCString(jtext, &jb->root, DefaultDictId, VARSIZE(jb));
 
 	pq_begintypsend(&buf);
 	pq_sendint(&buf, version, 1);
@@ -207,14 +503,130 @@ jsonbc_typeof(PG_FUNCTION_ARGS)
 }
 
 /*
- * jsonbc_from_cstring
+ * jsonbc type modifier input function
  *
- * Turns json string into a jsonbc Datum.
+ * The modifier is the name of the dictionary keys of the column go to, as in
+ * jsonbc(name).  It is stored as the dictionary id.
+ */
+Datum
+jsonbc_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType  *ta = PG_GETARG_ARRAYTYPE_P(0);
+	Datum	   *elems;
+	int			n;
+
+	deconstruct_array(ta, CSTRINGOID, -2, false, 'c', &elems, NULL, &n);
+	if (n != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid type modifier"),
+				 errhint("Type modifier of jsonbc is a dictionary name.")));
+
+	PG_RETURN_INT32(getDictByName(DatumGetCString(elems[0]), false));
+}
+
+/*
+ * jsonbc type modifier output function
+ */
+Datum
+jsonbc_typmod_out(PG_FUNCTION_ARGS)
+{
+	int32		typmod = PG_GETARG_INT32(0);
+	char	   *name;
+
+	if (typmod < 0)
+		PG_RETURN_CSTRING(pstrdup(""));
+
+	name = getDictName(typmod);
+	if (name)
+		PG_RETURN_CSTRING(psprintf("(%s)", quote_identifier(name)));
+	else
+		PG_RETURN_CSTRING(psprintf("(%d)", typmod));
+}
+
+/*
+ * Length coercion function, which moves the value into the dictionary
+ * selected by the type modifier.  Untyped input is serialized right into it.
+ */
+Datum
+jsonbc_set_dict(PG_FUNCTION_ARGS)
+{
+	DeferredJsonbc *djb = jsonbc_get_deferred(PG_GETARG_DATUM(0));
+	int32		typmod = PG_GETARG_INT32(1);
+	Jsonbc	   *jb;
+
+	if (djb && typmod >= 0)
+		PG_RETURN_JSONB(jsonbc_resolve_deferred(djb, typmodGetDict(typmod)));
+
+	jb = PG_GETARG_JSONB(0);
+	if (typmod < 0)
+		PG_RETURN_JSONB(jb);
+
+	PG_RETURN_JSONB(JsonbcSetDict(jb, typmodGetDict(typmod)));
+}
+
+/*
+ * SQL function jsonbc_dict_id(jsonbc) -> int
+ */
+Datum
+jsonbc_dict_id(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+
+	PG_RETURN_INT32(JsonbcGetDict(jb));
+}
+
+/*
+ * jsonbc_from_cstring
  *
- * Uses the json parser (with hooks) to construct a jsonbc.
+ * Turns json string into a jsonbc Datum with keys from dictionary "dict".
  */
 static inline Datum
-jsonbc_from_cstring(char *json, int len)
+jsonbc_from_cstring(char *json, int len, int32 dict)
+{
+	PG_RETURN_POINTER(jsonbc_encode(json, len, jsonbc_collect_keys(json, len),
+									dict));
+}
+
+/*
+ * jsonbc_collect_keys
+ *
+ * Parses json string, and returns an encoder with its key names collected,
+ * whatever the dictionary they go to.
+ */
+static JsonbcEncoder *
+jsonbc_collect_keys(char *json, int len)
+{
+	JsonbcInState state;
+	JsonSemAction sem;
+
+	memset(&state, 0, sizeof(state));
+	memset(&sem, 0, sizeof(sem));
+
+	state.encoder = JsonbcEncoderInit(NULL);
+
+	sem.semstate = (void *) &state;
+	sem.object_field_start = jsonbc_collect_field;
+
+	pg_parse_json(makeJsonLexContextCstringLen(json, len, true), &sem);
+
+	return state.encoder;
+}
+
+/*
+ * jsonbc_encode
+ *
+ * Turns json string into a jsonbc with keys from dictionary "dict", given an
+ * encoder with its key names collected.
+ *
+ * Uses the json parser (with hooks) to construct a jsonbc.  The string is
+ * parsed once more for the string values of the keys which have them in the
+ * dictionary, if any, so that they are resolved at once as well.  The value
+ * is then serialized as it's parsed, see JsonbcEncoderPush(), so the tokens
+ * are freed as soon as they are consumed.
+ */
+static Jsonbc *
+jsonbc_encode(char *json, int len, JsonbcEncoder *encoder, int32 dict)
 {
 	JsonLexContext *lex;
 	JsonbcInState state;
@@ -222,10 +634,23 @@ jsonbc_from_cstring(char *json, int len)
 
 	memset(&state, 0, sizeof(state));
 	memset(&sem, 0, sizeof(sem));
-	lex = makeJsonLexContextCstringLen(json, len, true);
+
+	state.encoder = encoder;
 
 	sem.semstate = (void *) &state;
 
+	if (JsonbcEncoderResolveKeys(encoder, dict))
+	{
+		sem.object_start = jsonbc_collect_container;
+		sem.array_start = jsonbc_collect_container;
+		sem.object_field_start = jsonbc_collect_field;
+		sem.scalar = jsonbc_collect_scalar;
+		pg_parse_json(makeJsonLexContextCstringLen(json, len, true), &sem);
+		state.inField = false;
+	}
+
+	lex = makeJsonLexContextCstringLen(json, len, true);
+
 	sem.object_start = jsonbc_in_object_start;
 	sem.array_start = jsonbc_in_array_start;
 	sem.object_end = jsonbc_in_object_end;
@@ -235,8 +660,7 @@ jsonbc_from_cstring(char *json, int len)
 
 	pg_parse_json(lex, &sem);
 
-	/* after parsing, the item member has the composed jsonbc structure */
-	PG_RETURN_POINTER(JsonbcValueToJsonbc(state.res));
+	return JsonbcEncoderFinish(state.encoder);
 }
 
 static size_t
@@ -252,12 +676,47 @@ checkStringLen(size_t len)
 	return len;
 }
 
+static void
+jsonbc_collect_container(void *pstate)
+{
+	JsonbcInState *_state = (JsonbcInState *) pstate;
+
+	_state->inField = false;
+}
+
+static void
+jsonbc_collect_field(void *pstate, char *fname, bool isnull)
+{
+	JsonbcInState *_state = (JsonbcInState *) pstate;
+
+	Assert(fname != NULL);
+	JsonbcEncoderAddKey(_state->encoder, fname, checkStringLen(strlen(fname)));
+	_state->inField = true;
+	pfree(fname);
+}
+
+static void
+jsonbc_collect_scalar(void *pstate, char *token, JsonTokenType tokentype)
+{
+	JsonbcInState *_state = (JsonbcInState *) pstate;
+
+	if (_state->inField && tokentype == JSON_TOKEN_STRING)
+		JsonbcEncoderAddValue(_state->encoder, token,
+							  checkStringLen(strlen(token)));
+	_state->inField = false;
+
+	if (token)
+		pfree(token);
+}
+
 static void
 jsonbc_in_object_start(void *pstate)
 {
 	JsonbcInState *_state = (JsonbcInState *) pstate;
 
-	_state->res = pushJsonbcValue(&_state->parseState, WJB_BEGIN_OBJECT, NULL);
+	JsonbcEncoderPush(_state->encoder, WJB_BEGIN_OBJECT, NULL);
+	_state->depth++;
+	_state->inField = false;
 }
 
 static void
@@ -265,7 +724,8 @@ jsonbc_in_object_end(void *pstate)
 {
 	JsonbcInState *_state = (JsonbcInState *) pstate;
 
-	_state->res = pushJsonbcValue(&_state->parseState, WJB_END_OBJECT, NULL);
+	JsonbcEncoderPush(_state->encoder, WJB_END_OBJECT, NULL);
+	_state->depth--;
 }
 
 static void
@@ -273,7 +733,9 @@ jsonbc_in_array_start(void *pstate)
 {
 	JsonbcInState *_state = (JsonbcInState *) pstate;
 
-	_state->res = pushJsonbcValue(&_state->parseState, WJB_BEGIN_ARRAY, NULL);
+	JsonbcEncoderPush(_state->encoder, WJB_BEGIN_ARRAY, NULL);
+	_state->depth++;
+	_state->inField = false;
 }
 
 static void
@@ -281,7 +743,8 @@ jsonbc_in_array_end(void *pstate)
 {
 	JsonbcInState *_state = (JsonbcInState *) pstate;
 
-	_state->res = pushJsonbcValue(&_state->parseState, WJB_END_ARRAY, NULL);
+	JsonbcEncoderPush(_state->encoder, WJB_END_ARRAY, NULL);
+	_state->depth--;
 }
 
 static void
@@ -294,8 +757,11 @@ jsonbc_in_object_field_start(void *pstate, char *fname, bool isnull)
 	v.type = jbvString;
 	v.val.string.len = checkStringLen(strlen(fname));
 	v.val.string.val = fname;
+	v.val.string.id = InvalidKeyId;
 
-	_state->res = pushJsonbcValue(&_state->parseState, WJB_KEY, &v);
+	JsonbcEncoderPush(_state->encoder, WJB_KEY, &v);
+	_state->inField = true;
+	pfree(fname);
 }
 
 static void
@@ -342,6 +808,7 @@ jsonbc_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 			v.type = jbvString;
 			v.val.string.len = checkStringLen(strlen(token));
 			v.val.string.val = token;
+			v.val.string.id = InvalidKeyId;
 			break;
 		case JSON_TOKEN_NUMBER:
 
@@ -371,7 +838,7 @@ jsonbc_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 			break;
 	}
 
-	if (_state->parseState == NULL)
+	if (_state->depth == 0)
 	{
 		/* single scalar */
 		JsonbcValue	va;
@@ -380,26 +847,23 @@ jsonbc_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 		va.val.array.rawScalar = true;
 		va.val.array.nElems = 1;
 
-		_state->res = pushJsonbcValue(&_state->parseState, WJB_BEGIN_ARRAY, &va);
-		_state->res = pushJsonbcValue(&_state->parseState, WJB_ELEM, &v);
-		_state->res = pushJsonbcValue(&_state->parseState, WJB_END_ARRAY, NULL);
+		JsonbcEncoderPush(_state->encoder, WJB_BEGIN_ARRAY, &va);
+		JsonbcEncoderPush(_state->encoder, WJB_ELEM, &v);
+		JsonbcEncoderPush(_state->encoder, WJB_END_ARRAY, NULL);
 	}
-	else
+	else if (_state->inField)
 	{
-		JsonbcValue *o = &_state->parseState->contVal;
-
-		switch (o->type)
-		{
-			case jbvArray:
-				_state->res = pushJsonbcValue(&_state->parseState, WJB_ELEM, &v);
-				break;
-			case jbvObject:
-				_state->res = pushJsonbcValue(&_state->parseState, WJB_VALUE, &v);
-				break;
-			default:
-				elog(ERROR, "unexpected parent of nested structure");
-		}
+		JsonbcEncoderPush(_state->encoder, WJB_VALUE, &v);
+		_state->inField = false;
 	}
+	else
+		JsonbcEncoderPush(_state->encoder, WJB_ELEM, &v);
+
+	/* The value is copied into the jsonbc */
+	if (v.type == jbvNumeric)
+		pfree(v.val.numeric);
+	if (token)
+		pfree(token);
 }
 
 /*
@@ -412,9 +876,13 @@ jsonbc_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
  * A typical case for passing the StringInfo in rather than NULL is where the
  * caller wants access to the len attribute without having to call strlen, e.g.
  * if they are converting it to a text* object.
+ *
+ * 'dict' is the dictionary of a nested container, see
+ * JsonbcIteratorInitDict().
  */
 char *
-JsonbcToCString(StringInfo out, JsonbcContainer *in, int estimated_len)
+JsonbcToCString(StringInfo out, JsonbcContainer *in, int32 dict,
+				int estimated_len)
 {
 	bool		first = true;
 	JsonbcIterator *it;
@@ -428,7 +896,7 @@ JsonbcToCString(StringInfo out, JsonbcContainer *in, int estimated_len)
 
 	enlargeStringInfo(out, (estimated_len >= 0) ? estimated_len : 64);
 
-	it = JsonbcIteratorInit(in);
+	it = JsonbcIteratorInitDict(in, dict);
 
 	while (redo_switch ||
 		   ((type = JsonbcIteratorNext(&it, &v, false)) != WJB_DONE))
@@ -34,6 +34,7 @@ typedef enum
 #define JsonbcExistsStrategyNumber		9
 #define JsonbcExistsAnyStrategyNumber	10
 #define JsonbcExistsAllStrategyNumber	11
+#define JsonbcExistsPathStrategyNumber	12
 
 /*
  * In the standard jsonbc_ops GIN opclass for jsonbc, we choose to index both
@@ -144,6 +145,7 @@ typedef uint32 JEntry;
 #define JENTRY_TYPEMASK			0x7
 
 /* values stored in the type bits */
+#define JENTRY_ISSTRINGID		0x0 /* string stored as a dictionary id */
 #define JENTRY_ISSTRING			0x1
 #define JENTRY_ISNUMERIC		0x2
 #define JENTRY_ISINTEGER		0x3
@@ -156,6 +158,7 @@ typedef uint32 JEntry;
 #define JBE_OFFLENFLD(je_)		((je_) >> JENTRY_SHIFT)
 #define JBE_HAS_OFF(je_)		(((je_) & JENTRY_HAS_OFF) != 0)
 #define JBE_ISSTRING(je_)		(((je_) & JENTRY_TYPEMASK) == JENTRY_ISSTRING)
+#define JBE_ISSTRINGID(je_)		(((je_) & JENTRY_TYPEMASK) == JENTRY_ISSTRINGID)
 #define JBE_ISNUMERIC(je_)		(((je_) & JENTRY_TYPEMASK) == JENTRY_ISNUMERIC)
 #define JBE_ISCONTAINER(je_)	(((je_) & JENTRY_TYPEMASK) == JENTRY_ISCONTAINER)
 #define JBE_ISNULL(je_)			(((je_) & JENTRY_TYPEMASK) == JENTRY_ISNULL)
@@ -209,6 +212,27 @@ typedef struct JsonbcContainer
 #define JB_FARRAY				2
 #define JB_MASK					3
 
+/*
+ * A root container of a value which belongs to a dictionary other than the
+ * default one is prefixed with an extra header of type JB_FEXT, which holds
+ * the dictionary id in place of the offsets length.  Values of the default
+ * dictionary don't have it, so they are stored just like before.  Nested
+ * containers never have the prefix: they belong to the dictionary of the
+ * datum.
+ */
+#define JB_FEXT					3
+
+/*
+ * A container whose offsets take more than one chunk is prefixed with the
+ * number of its elements or pairs, so that it can be had without decoding
+ * the offsets: a JB_FEXT header with zero in place of the dictionary id,
+ * which the default dictionary never needs, followed by the count.  It
+ * follows the dictionary prefix of a root container.  Containers without it,
+ * including everything written before it was introduced, have their
+ * children counted, which only takes decoding one chunk for small ones.
+ */
+#define JB_FCOUNT				JB_FEXT
+
 /* The top-level on-disk format for a jsonbc datum. */
 typedef struct
 {
@@ -217,9 +241,12 @@ typedef struct
 } Jsonbc;
 
 extern uint32 jsonbc_header(Jsonbc *value);
+extern int32 JsonbcGetDict(Jsonbc *value);
+
+extern int	JsonbcContainerCount(JsonbcContainer *container);
 
 /* convenience macros for accessing the root container in a Jsonbc datum */
-#define JB_ROOT_COUNT(jbp_)		( jsonbc_header(jbp_) >> JB_CSHIFT)
+#define JB_ROOT_COUNT(jbp_)		( JsonbcContainerCount(&(jbp_)->root) )
 #define JB_ROOT_IS_SCALAR(jbp_) ( (jsonbc_header(jbp_) & JB_MASK) == JB_FSCALAR)
 #define JB_ROOT_IS_OBJECT(jbp_) ( (jsonbc_header(jbp_) & JB_MASK) == JB_FOBJECT)
 #define JB_ROOT_IS_ARRAY(jbp_)	( (jsonbc_header(jbp_) & JB_MASK) == JB_FARRAY)
@@ -255,6 +282,9 @@ struct JsonbcValue
 		{
 			int			len;
 			char	   *val;	/* Not necessarily null-terminated */
+			int32		id;		/* Dictionary id, or InvalidKeyId if the
+								 * string is stored verbatim */
+			int32		dict;	/* Dictionary the id belongs to */
 		}			string;		/* String primitive type */
 
 		struct
@@ -274,6 +304,7 @@ struct JsonbcValue
 		{
 			int			len;
 			JsonbcContainer *data;
+			int32		dict;	/* Dictionary of the enclosing datum */
 		}			binary;		/* Array or object, in on-disk format */
 	}			val;
 };
@@ -293,8 +324,12 @@ struct JsonbcValue
  */
 struct JsonbcPair
 {
-	int32		key;
+	int32		key;			/* Key id, resolved by convertToJsonbc() */
+	char	   *keyName;		/* Key name, not necessarily null-terminated */
+	int			keyLen;
 	JsonbcValue	value;			/* May be of any type */
+	int32		valueId;		/* Dictionary id of a string value, resolved
+								 * by convertToJsonbc(), or InvalidKeyId */
 	uint32		order;			/* Pair's index in original sequence */
 };
 
@@ -306,6 +341,9 @@ typedef struct JsonbcParseState
 	struct JsonbcParseState *next;
 } JsonbcParseState;
 
+/* Conversion state used when serializing Jsonbc as it's parsed */
+typedef struct JsonbcEncoder JsonbcEncoder;
+
 /*
  * JsonbcIterator holds details of the type for each iteration. It also stores a
  * Jsonbc varlena buffer, which can be directly accessed in some contexts.
@@ -327,8 +365,13 @@ typedef struct JsonbcIterator
 	uint32		curKey;
 	bool		isScalar;		/* Pseudo-array scalar value? */
 	unsigned char	   *children;		/* JEntrys for child nodes */
-	unsigned char	   *childrenPtr;
 	unsigned char	   *chunkEnd;
+	/* Number of elements or pairs if stored, -1 otherwise */
+	int			count;
+	/* Decoded varbytes of the current offsets chunk */
+	uint32		chunk[JB_OFFSETS_CHUNK_SIZE];
+	int			chunkLen;
+	int			chunkPos;
 	/* Data proper.  This points to the beginning of the variable-length data */
 	char	   *dataProper;
 
@@ -346,6 +389,15 @@ typedef struct JsonbcIterator
 	/* Private state */
 	JsonbcIterState state;
 
+	/*
+	 * Return key and string ids instead of names, see
+	 * JsonbcIteratorInitKeyIds()
+	 */
+	bool		keyIds;
+
+	/* Dictionary the key ids belong to */
+	int32		dict;
+
 	struct JsonbcIterator *parent;
 } JsonbcIterator;
 
@@ -355,11 +407,18 @@ extern Datum jsonbc_out(PG_FUNCTION_ARGS);
 extern Datum jsonbc_recv(PG_FUNCTION_ARGS);
 extern Datum jsonbc_send(PG_FUNCTION_ARGS);
 extern Datum jsonbc_typeof(PG_FUNCTION_ARGS);
+extern Datum jsonbc_typmod_in(PG_FUNCTION_ARGS);
+extern Datum jsonbc_typmod_out(PG_FUNCTION_ARGS);
+extern Datum jsonbc_set_dict(PG_FUNCTION_ARGS);
+extern Datum jsonbc_dict_id(PG_FUNCTION_ARGS);
 
 /* Indexing-related ops */
 extern Datum jsonbc_exists(PG_FUNCTION_ARGS);
 extern Datum jsonbc_exists_any(PG_FUNCTION_ARGS);
 extern Datum jsonbc_exists_all(PG_FUNCTION_ARGS);
+extern Datum jsonbc_exists_path(PG_FUNCTION_ARGS);
+extern Datum jsonbc_exists_key_like(PG_FUNCTION_ARGS);
+extern Datum jsonbc_exists_key_regex(PG_FUNCTION_ARGS);
 extern Datum jsonbc_contains(PG_FUNCTION_ARGS);
 extern Datum jsonbc_contained(PG_FUNCTION_ARGS);
 extern Datum jsonbc_ne(PG_FUNCTION_ARGS);
@@ -382,12 +441,21 @@ extern Datum jsonbc_object_keys(PG_FUNCTION_ARGS);
 extern Datum jsonbc_array_length(PG_FUNCTION_ARGS);
 extern Datum jsonbc_each(PG_FUNCTION_ARGS);
 extern Datum jsonbc_each_text(PG_FUNCTION_ARGS);
+extern Datum jsonbc_each_key_like(PG_FUNCTION_ARGS);
+extern Datum jsonbc_each_key_regex(PG_FUNCTION_ARGS);
 extern Datum jsonbc_array_elements_text(PG_FUNCTION_ARGS);
 extern Datum jsonbc_array_elements(PG_FUNCTION_ARGS);
 extern Datum jsonbc_populate_record(PG_FUNCTION_ARGS);
 extern Datum jsonbc_populate_recordset(PG_FUNCTION_ARGS);
 extern Datum jsonbc_to_record(PG_FUNCTION_ARGS);
 extern Datum jsonbc_to_recordset(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_ids(PG_FUNCTION_ARGS);
+extern Datum jsonbc_remap_keys(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_stats_transfn(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_stats_combine(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_stats_serialize(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_stats_deserialize(PG_FUNCTION_ARGS);
+extern Datum jsonbc_key_stats_finalfn(PG_FUNCTION_ARGS);
 
 /* GIN support functions for jsonbc_ops */
 extern Datum gin_compare_jsonbc(PG_FUNCTION_ARGS);
@@ -402,27 +470,51 @@ extern Datum gin_extract_jsonbc_query_path(PG_FUNCTION_ARGS);
 extern Datum gin_consistent_jsonbc_path(PG_FUNCTION_ARGS);
 extern Datum gin_triconsistent_jsonbc_path(PG_FUNCTION_ARGS);
 
+/* GIN support functions for jsonbc_key_path_ops */
+extern Datum gin_extract_jsonbc_key_path(PG_FUNCTION_ARGS);
+extern Datum gin_extract_jsonbc_query_key_path(PG_FUNCTION_ARGS);
+extern Datum gin_consistent_jsonbc_key_path(PG_FUNCTION_ARGS);
+
 /* Support functions */
 extern uint32 getJsonbcOffset(const JsonbcContainer *jc, int index);
 extern int	compareJsonbcContainers(JsonbcContainer *a, JsonbcContainer *b);
 extern JsonbcValue *findJsonbcValueFromContainer(JsonbcContainer *sheader,
-							uint32 flags,
+							int32 dict, uint32 flags,
 							JsonbcValue *key);
 extern JsonbcValue *getIthJsonbcValueFromContainer(JsonbcContainer *sheader,
-							  uint32 i);
+							  int32 dict, uint32 i);
 extern JsonbcValue *pushJsonbcValue(JsonbcParseState **pstate,
 			   JsonbcIteratorToken seq, JsonbcValue *scalarVal);
+extern JsonbcEncoder *JsonbcEncoderInit(JsonbcEncoder *keys);
+extern void JsonbcEncoderAddKey(JsonbcEncoder *enc, char *name, int len);
+extern bool JsonbcEncoderResolveKeys(JsonbcEncoder *enc, int32 dict);
+extern void JsonbcEncoderAddValue(JsonbcEncoder *enc, char *value, int len);
+extern void JsonbcEncoderPush(JsonbcEncoder *enc, JsonbcIteratorToken seq,
+				  JsonbcValue *scalarVal);
+extern Jsonbc *JsonbcEncoderFinish(JsonbcEncoder *enc);
 extern JsonbcIterator *JsonbcIteratorInit(JsonbcContainer *container);
+extern JsonbcIterator *JsonbcIteratorInitDict(JsonbcContainer *container,
+					   int32 dict);
+extern JsonbcIterator *JsonbcIteratorInitKeyIds(JsonbcContainer *container);
+extern int32 JsonbcIteratorKeyId(JsonbcIterator *it);
 extern JsonbcIteratorToken JsonbcIteratorNext(JsonbcIterator **it, JsonbcValue *val,
 				  bool skipNested);
 extern Jsonbc *JsonbcValueToJsonbc(JsonbcValue *val);
+extern Jsonbc *JsonbcValueToJsonbcDict(JsonbcValue *val, int32 dict);
+extern Jsonbc *JsonbcSetDict(Jsonbc *jb, int32 dict);
+extern Jsonbc *JsonbcRemapKeys(Jsonbc *jb, const int32 *map, int32 mapLow,
+							   int mapSize);
 extern bool JsonbcDeepContains(JsonbcIterator **val,
 				  JsonbcIterator **mContained);
 extern void JsonbcHashScalarValue(const JsonbcValue *scalarVal, uint32 *hash);
 
+/* jsonbc_op.c support function */
+extern int32 *JsonbcKeyPatternIds(FmgrInfo *flinfo, int32 dict, text *pattern,
+					bool regex, int *count);
+
 /* jsonbc.c support function */
 extern char *JsonbcToCString(StringInfo out, JsonbcContainer *in,
-			   int estimated_len);
+			   int32 dict, int estimated_len);
 
 /* numeric_utils.c support function */
 extern bool numeric_get_small(Numeric value, uint32 *out);
@@ -19,6 +19,8 @@
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
 #include "jsonbc.h"
+#include "miscadmin.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 
 typedef struct PathHashStack
@@ -29,6 +31,8 @@ typedef struct PathHashStack
 
 static Datum make_text_key(char flag, const char *str, int len);
 static Datum make_scalar_key(const JsonbcValue *scalarVal, bool is_key);
+static void key_path_walk(JsonbcIterator *it, uint32 hash, Datum **entries,
+			  int *nentries, int *total);
 
 /*
  *
@@ -533,6 +537,175 @@ gin_triconsistent_jsonbc_path(PG_FUNCTION_ARGS)
 	PG_RETURN_GIN_TERNARY_VALUE(res);
 }
 
+/*
+ *
+ * jsonbc_key_path_ops GIN opclass support functions
+ *
+ * In a jsonbc_key_path_ops index, the GIN keys are uint32 hashes, one per
+ * object key, computed over the names of the keys leading to it from the
+ * root through nested objects.  Keys inside arrays are not indexed.  This
+ * supports only the ?# operator, which tells whether a path of keys exists
+ * whatever its value is.
+ *
+ * Key names are hashed rather than key ids: ids belong to the dictionary of
+ * each value, while the query only has the names.
+ *
+ */
+
+Datum
+gin_extract_jsonbc_key_path(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	int32	   *nentries = (int32 *) PG_GETARG_POINTER(1);
+	int			total = JB_ROOT_COUNT(jb);
+	int			i = 0;
+	Datum	   *entries;
+
+	/* Only objects have keys */
+	if (!JB_ROOT_IS_OBJECT(jb) || total == 0)
+	{
+		*nentries = 0;
+		PG_RETURN_POINTER(NULL);
+	}
+
+	entries = (Datum *) palloc(sizeof(Datum) * total);
+	key_path_walk(JsonbcIteratorInit(&jb->root), JB_FOBJECT, &entries, &i,
+				  &total);
+
+	*nentries = i;
+
+	PG_RETURN_POINTER(entries);
+}
+
+Datum
+gin_extract_jsonbc_query_key_path(PG_FUNCTION_ARGS)
+{
+	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(0);
+	int32	   *nentries = (int32 *) PG_GETARG_POINTER(1);
+	StrategyNumber strategy = PG_GETARG_UINT16(2);
+	int32	   *searchMode = (int32 *) PG_GETARG_POINTER(6);
+	Datum	   *entries;
+	Datum	   *pathtext;
+	bool	   *pathnulls;
+	int			npath;
+	int			i;
+	uint32		hash = JB_FOBJECT;
+
+	if (strategy != JsonbcExistsPathStrategyNumber)
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+
+	deconstruct_array(path, TEXTOID, -1, false, 'i',
+					  &pathtext, &pathnulls, &npath);
+
+	/* Every value has the empty path */
+	if (npath == 0)
+	{
+		*nentries = 0;
+		*searchMode = GIN_SEARCH_MODE_ALL;
+		PG_RETURN_POINTER(NULL);
+	}
+
+	for (i = 0; i < npath; i++)
+	{
+		JsonbcValue	v;
+
+		/* No value has a path with a null key, so nothing can match */
+		if (pathnulls[i])
+		{
+			*nentries = 0;
+			PG_RETURN_POINTER(NULL);
+		}
+
+		v.type = jbvString;
+		v.val.string.val = VARDATA_ANY(pathtext[i]);
+		v.val.string.len = VARSIZE_ANY_EXHDR(pathtext[i]);
+		v.val.string.id = InvalidKeyId;
+		JsonbcHashScalarValue(&v, &hash);
+	}
+
+	entries = (Datum *) palloc(sizeof(Datum));
+	entries[0] = UInt32GetDatum(hash);
+	*nentries = 1;
+
+	PG_RETURN_POINTER(entries);
+}
+
+Datum
+gin_consistent_jsonbc_key_path(PG_FUNCTION_ARGS)
+{
+	bool	   *check = (bool *) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = PG_GETARG_UINT16(1);
+
+	/* ArrayType  *query = PG_GETARG_ARRAYTYPE_P(2); */
+	int32		nkeys = PG_GETARG_INT32(3);
+
+	/* Pointer	   *extra_data = (Pointer *) PG_GETARG_POINTER(4); */
+	bool	   *recheck = (bool *) PG_GETARG_POINTER(5);
+	bool		res = true;
+	int32		i;
+
+	if (strategy != JsonbcExistsPathStrategyNumber)
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+
+	/* Hashes might collide, so a match must be rechecked */
+	*recheck = true;
+	for (i = 0; i < nkeys; i++)
+	{
+		if (!check[i])
+		{
+			res = false;
+			break;
+		}
+	}
+
+	PG_RETURN_BOOL(res);
+}
+
+/*
+ * Emit the path hashes of all the keys of the object the iterator is
+ * positioned before, and of the objects nested in its values.  "hash" is the
+ * hash of the path leading to the object.
+ */
+static void
+key_path_walk(JsonbcIterator *it, uint32 hash, Datum **entries,
+			  int *nentries, int *total)
+{
+	JsonbcValue	v;
+	int			r;
+
+	check_stack_depth();
+
+	if (JsonbcIteratorNext(&it, &v, true) != WJB_BEGIN_OBJECT)
+		return;
+
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		uint32		keyHash = hash;
+
+		if (r != WJB_KEY)
+			continue;
+
+		JsonbcHashScalarValue(&v, &keyHash);
+
+		if (*nentries >= *total)
+		{
+			*total *= 2;
+			*entries = (Datum *) repalloc(*entries, sizeof(Datum) * *total);
+		}
+		(*entries)[(*nentries)++] = UInt32GetDatum(keyHash);
+
+		/* Descend into the value if it's a nested container */
+		r = JsonbcIteratorNext(&it, &v, true);
+		if (v.type == jbvBinary)
+		{
+			JsonbcContainer *container = v.val.binary.data;
+
+			key_path_walk(JsonbcIteratorInitDict(container, v.val.binary.dict),
+						  keyHash, entries, nentries, total);
+		}
+	}
+}
+
 /*
  * Construct a jsonbc_ops GIN key from a flag byte and a textual representation
  * (which need not be null-terminated).  This function is responsible
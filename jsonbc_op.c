@@ -15,6 +15,7 @@
 
 #include "catalog/pg_type.h"
 #include "jsonbc.h"
+#include "dict.h"
 #include "miscadmin.h"
 
 Datum
@@ -34,8 +35,9 @@ jsonbc_exists(PG_FUNCTION_ARGS)
 	kval.type = jbvString;
 	kval.val.string.val = VARDATA_ANY(key);
 	kval.val.string.len = VARSIZE_ANY_EXHDR(key);
+	kval.val.string.id = InvalidKeyId;
 
-	v = findJsonbcValueFromContainer(&jb->root,
+	v = findJsonbcValueFromContainer(&jb->root, DefaultDictId,
 									JB_FOBJECT | JB_FARRAY,
 									&kval);
 
@@ -65,8 +67,9 @@ jsonbc_exists_any(PG_FUNCTION_ARGS)
 		strVal.type = jbvString;
 		strVal.val.string.val = VARDATA(key_datums[i]);
 		strVal.val.string.len = VARSIZE(key_datums[i]) - VARHDRSZ;
+		strVal.val.string.id = InvalidKeyId;
 
-		if (findJsonbcValueFromContainer(&jb->root,
+		if (findJsonbcValueFromContainer(&jb->root, DefaultDictId,
 										JB_FOBJECT | JB_FARRAY,
 										&strVal) != NULL)
 			PG_RETURN_BOOL(true);
@@ -98,8 +101,9 @@ jsonbc_exists_all(PG_FUNCTION_ARGS)
 		strVal.type = jbvString;
 		strVal.val.string.val = VARDATA(key_datums[i]);
 		strVal.val.string.len = VARSIZE(key_datums[i]) - VARHDRSZ;
+		strVal.val.string.id = InvalidKeyId;
 
-		if (findJsonbcValueFromContainer(&jb->root,
+		if (findJsonbcValueFromContainer(&jb->root, DefaultDictId,
 										JB_FOBJECT | JB_FARRAY,
 										&strVal) == NULL)
 			PG_RETURN_BOOL(false);
@@ -108,6 +112,191 @@ jsonbc_exists_all(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(true);
 }
 
+/*
+ * jsonbc ?# text[]: does the path of object keys lead to a value?  Arrays
+ * are not descended into, and an empty path always exists.
+ */
+Datum
+jsonbc_exists_path(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(1);
+	Datum	   *pathtext;
+	bool	   *pathnulls;
+	int			npath;
+	int			i;
+	JsonbcContainer *container = &jb->root;
+	int32		dict = DefaultDictId;
+
+	if (array_contains_nulls(path))
+		PG_RETURN_BOOL(false);
+
+	deconstruct_array(path, TEXTOID, -1, false, 'i',
+					  &pathtext, &pathnulls, &npath);
+
+	if (npath <= 0)
+		PG_RETURN_BOOL(true);
+
+	if (!JB_ROOT_IS_OBJECT(jb))
+		PG_RETURN_BOOL(false);
+
+	for (i = 0; i < npath; i++)
+	{
+		JsonbcValue	kval;
+		JsonbcValue *v;
+		JsonbcIterator *it;
+		JsonbcValue	tv;
+
+		kval.type = jbvString;
+		kval.val.string.val = VARDATA_ANY(pathtext[i]);
+		kval.val.string.len = VARSIZE_ANY_EXHDR(pathtext[i]);
+		kval.val.string.id = InvalidKeyId;
+
+		v = findJsonbcValueFromContainer(container, dict, JB_FOBJECT, &kval);
+		if (v == NULL)
+			PG_RETURN_BOOL(false);
+		else if (i == npath - 1)
+			break;
+
+		if (v->type != jbvBinary)
+			PG_RETURN_BOOL(false);
+
+		container = (JsonbcContainer *) v->val.binary.data;
+		dict = v->val.binary.dict;
+		it = JsonbcIteratorInitDict(container, dict);
+		if (JsonbcIteratorNext(&it, &tv, true) != WJB_BEGIN_OBJECT)
+			PG_RETURN_BOOL(false);
+	}
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Ids of the dictionary keys matching a key pattern, expanded once per
+ * query and kept in fn_extra.
+ */
+typedef struct KeyPatternCache
+{
+	int32		dict;
+	bool		regex;
+	text	   *pattern;
+	int			count;
+	int32	   *ids;
+} KeyPatternCache;
+
+/*
+ * Expand a LIKE pattern, or a regular expression if "regex" is set, into the
+ * sorted ids of the matching keys of the dictionary.  The result is cached
+ * in flinfo, so the dictionary is only searched again when the dictionary or
+ * the pattern changes.
+ */
+int32 *
+JsonbcKeyPatternIds(FmgrInfo *flinfo, int32 dict, text *pattern, bool regex,
+					int *count)
+{
+	KeyPatternCache *cache = (KeyPatternCache *) flinfo->fn_extra;
+	MemoryContext oldcxt;
+
+	if (!cache)
+	{
+		cache = (KeyPatternCache *) MemoryContextAllocZero(flinfo->fn_mcxt,
+													sizeof(KeyPatternCache));
+		flinfo->fn_extra = cache;
+	}
+	else if (cache->pattern && cache->dict == dict &&
+			 cache->regex == regex &&
+			 VARSIZE_ANY_EXHDR(cache->pattern) == VARSIZE_ANY_EXHDR(pattern) &&
+			 memcmp(VARDATA_ANY(cache->pattern), VARDATA_ANY(pattern),
+					VARSIZE_ANY_EXHDR(pattern)) == 0)
+	{
+		*count = cache->count;
+		return cache->ids;
+	}
+
+	if (cache->pattern)
+	{
+		pfree(cache->pattern);
+		pfree(cache->ids);
+		cache->pattern = NULL;
+	}
+
+	oldcxt = MemoryContextSwitchTo(flinfo->fn_mcxt);
+	cache->count = getIdsByPattern(dict, pattern, regex, &cache->ids);
+	cache->pattern = (text *) palloc(VARSIZE_ANY(pattern));
+	memcpy(cache->pattern, pattern, VARSIZE_ANY(pattern));
+	MemoryContextSwitchTo(oldcxt);
+	cache->dict = dict;
+	cache->regex = regex;
+
+	*count = cache->count;
+	return cache->ids;
+}
+
+/*
+ * Does the top-level object have a key matching the pattern?  Both the keys
+ * of the object and the expanded pattern are sorted by id, so they are
+ * merged without looking up any key name.
+ */
+static bool
+existsKeyPattern(FunctionCallInfo fcinfo, bool regex)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	text	   *pattern = PG_GETARG_TEXT_PP(1);
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	JsonbcIteratorToken r;
+	int32	   *ids;
+	int			count,
+				i = 0;
+
+	if (!JB_ROOT_IS_OBJECT(jb) || JB_ROOT_COUNT(jb) == 0)
+		return false;
+
+	ids = JsonbcKeyPatternIds(fcinfo->flinfo, JsonbcGetDict(jb), pattern,
+							  regex, &count);
+	if (count == 0)
+		return false;
+
+	it = JsonbcIteratorInitKeyIds(&jb->root);
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		int32		id;
+
+		if (r != WJB_KEY)
+			continue;
+
+		id = JsonbcIteratorKeyId(it);
+		while (ids[i] < id)
+		{
+			if (++i >= count)
+				return false;
+		}
+		if (ids[i] == id)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * jsonbc ?~~ text: does the object have a key matching the LIKE pattern?
+ */
+Datum
+jsonbc_exists_key_like(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(existsKeyPattern(fcinfo, false));
+}
+
+/*
+ * jsonbc ?~ text: does the object have a key matching the regular
+ * expression?
+ */
+Datum
+jsonbc_exists_key_regex(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(existsKeyPattern(fcinfo, true));
+}
+
 Datum
 jsonbc_contains(PG_FUNCTION_ARGS)
 {
@@ -247,45 +436,79 @@ jsonbc_cmp(PG_FUNCTION_ARGS)
 }
 
 /*
- * Hash operator class jsonbc hashing function
+ * jsonbc_hash() worker: hash a container into *hash.  Equal values must hash
+ * equally whatever their dictionaries, and objects of different
+ * dictionaries have their pairs in different orders, so the hashes of the
+ * pairs are combined in an order-independent way.
  */
-Datum
-jsonbc_hash(PG_FUNCTION_ARGS)
+static void
+hashJsonbcContainer(JsonbcIterator *it, uint32 *hash)
 {
-	Jsonbc	   *jb = PG_GETARG_JSONB(0);
-	JsonbcIterator *it;
-	int32		r;
+	JsonbcIteratorToken r;
 	JsonbcValue	v;
-	uint32		hash = 0;
+	uint32		pairs = 0,
+				pair = 0;
 
-	if (JB_ROOT_COUNT(jb) == 0)
-		PG_RETURN_INT32(0);
-
-	it = JsonbcIteratorInit(&jb->root);
+	check_stack_depth();
 
-	while ((r = JsonbcIteratorNext(&it, &v, false)) != WJB_DONE)
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_DONE)
 	{
 		switch (r)
 		{
 				/* Rotation is left to JsonbcHashScalarValue() */
 			case WJB_BEGIN_ARRAY:
-				hash ^= JB_FARRAY;
+				*hash ^= JB_FARRAY;
 				break;
 			case WJB_BEGIN_OBJECT:
-				hash ^= JB_FOBJECT;
+				*hash ^= JB_FOBJECT;
 				break;
 			case WJB_KEY:
+				pair = 0;
+				JsonbcHashScalarValue(&v, &pair);
+				break;
 			case WJB_VALUE:
+				if (v.type == jbvBinary)
+					hashJsonbcContainer(JsonbcIteratorInitDict(v.val.binary.data,
+															   v.val.binary.dict),
+										&pair);
+				else
+					JsonbcHashScalarValue(&v, &pair);
+				pairs += pair;
+				break;
 			case WJB_ELEM:
-				JsonbcHashScalarValue(&v, &hash);
+				if (v.type == jbvBinary)
+					hashJsonbcContainer(JsonbcIteratorInitDict(v.val.binary.data,
+															   v.val.binary.dict),
+										hash);
+				else
+					JsonbcHashScalarValue(&v, hash);
 				break;
-			case WJB_END_ARRAY:
 			case WJB_END_OBJECT:
-				break;
+				*hash = (*hash << 1) | (*hash >> 31);
+				*hash ^= pairs;
+				/* the iterator is freed at the end of its container */
+				return;
+			case WJB_END_ARRAY:
+				return;
 			default:
 				elog(ERROR, "invalid JsonbcIteratorNext rc: %d", r);
 		}
 	}
+}
+
+/*
+ * Hash operator class jsonbc hashing function
+ */
+Datum
+jsonbc_hash(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	uint32		hash = 0;
+
+	if (JB_ROOT_COUNT(jb) == 0)
+		PG_RETURN_INT32(0);
+
+	hashJsonbcContainer(JsonbcIteratorInit(&jb->root), &hash);
 
 	PG_FREE_IF_COPY(jb, 0);
 	PG_RETURN_INT32(hash);
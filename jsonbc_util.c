@@ -18,6 +18,7 @@
 #include "jsonbc.h"
 #include "miscadmin.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "dict.h"
 
@@ -34,15 +35,40 @@
 #define JSONB_MAX_PAIRS (MaxAllocSize / sizeof(JsonbcPair))
 
 static void fillJsonbcValue(JEntry entry,
-			   char *base_addr, uint32 offset,
+			   char *base_addr, uint32 offset, int32 dict, bool keyIds,
 			   JsonbcValue *result);
 static bool equalsJsonbcScalarValue(JsonbcValue *a, JsonbcValue *b);
 static int	compareJsonbcScalarValue(JsonbcValue *a, JsonbcValue *b);
-static Jsonbc *convertToJsonbc(JsonbcValue *val);
-static void convertJsonbcValue(StringInfo buffer, JEntry *header, JsonbcValue *val, int level);
-static void convertJsonbcArray(StringInfo buffer, JEntry *header, JsonbcValue *val, int level);
-static void convertJsonbcObject(StringInfo buffer, JEntry *header, JsonbcValue *val, int level);
+static int	compareContainersByName(JsonbcIterator *ita, JsonbcIterator *itb);
+
+/*
+ * Sizes of the containers of a JsonbcValue being converted, computed by
+ * sizeJsonbcValue() before the value is serialized.
+ */
+typedef struct ContainerSize
+{
+	uint32		offsetsLen;		/* size of the offsets */
+	uint32		totalLen;		/* size of header, offsets and children */
+} ContainerSize;
+
+typedef struct ContainerSizes
+{
+	ContainerSize *sizes;		/* in the order of convertJsonbcValue() */
+	int			nSizes;
+	int			maxSizes;
+	int			next;			/* next one to be serialized */
+} ContainerSizes;
+
+static Jsonbc *convertToJsonbc(JsonbcValue *val, int32 dict);
+static JEntry sizeJsonbcValue(ContainerSizes *sizes, JsonbcValue *val, int level);
+static JEntry sizeJsonbcArray(ContainerSizes *sizes, JsonbcValue *val, int level);
+static JEntry sizeJsonbcObject(ContainerSizes *sizes, JsonbcValue *val, int level);
+static JEntry sizeJsonbcScalar(JsonbcValue *scalarVal);
+static void convertJsonbcValue(StringInfo buffer, ContainerSizes *sizes, JEntry *header, JsonbcValue *val, int level);
+static void convertJsonbcArray(StringInfo buffer, ContainerSizes *sizes, JEntry *header, JsonbcValue *val, int level);
+static void convertJsonbcObject(StringInfo buffer, ContainerSizes *sizes, JEntry *header, JsonbcValue *val, int level);
 static void convertJsonbcScalar(StringInfo buffer, JEntry *header, JsonbcValue *scalarVal);
+static void convertJsonbcStringId(StringInfo buffer, JEntry *header, int32 id);
 
 static int	reserveFromBuffer(StringInfo buffer, int len);
 static void appendToBuffer(StringInfo buffer, const char *data, int len);
@@ -51,7 +77,8 @@ static void copyToBuffer(StringInfo buffer, int offset, const char *data, int le
 static short padBufferToInt(StringInfo buffer);
 #endif
 
-static JsonbcIterator *iteratorFromContainer(JsonbcContainer *container, JsonbcIterator *parent);
+static JsonbcIterator *iteratorFromContainer(JsonbcContainer *container,
+					  int32 dict, JsonbcIterator *parent);
 static JsonbcIterator *freeAndGetParent(JsonbcIterator *it);
 static JsonbcParseState *pushState(JsonbcParseState **pstate);
 static void appendKey(JsonbcParseState *pstate, JsonbcValue *scalarVal);
@@ -60,20 +87,31 @@ static void appendElement(JsonbcParseState *pstate, JsonbcValue *scalarVal);
 static int	lengthCompareJsonbcStringValue(const void *a, const void *b);
 static int	compareJsonbcPair(const void *a, const void *b, void *arg);
 static void uniqueifyJsonbcObject(JsonbcValue *object);
+static void resolveJsonbcKeys(JsonbcValue *val, int32 dict);
 
+/*
+ * Resolve key name to id, without ever adding the key to the dictionary.
+ * Returns InvalidKeyId for unknown keys.
+ */
 static int32
-convertKeyNameToId(JsonbcValue *string)
+lookupKeyNameId(int32 dict, JsonbcValue *string)
 {
 	KeyName	keyName;
 
 	keyName.s = string->val.string.val;
 	keyName.len = string->val.string.len;
 
-	return getIdByName(keyName);
+	return lookupIdByName(dict, keyName);
 }
 
 #define MAX_VARBYTE_SIZE 5
 
+/*
+ * Longer strings are always stored verbatim, even for keys which have their
+ * values in the dictionary.
+ */
+#define MAX_DICT_VALUE_LEN 64
+
 /*
  * Varbyte-encode 'val' into *ptr. *ptr is incremented to next integer.
  */
@@ -145,12 +183,230 @@ varbyte_size(uint32 value)
 		return 5;
 }
 
+/*
+ * Batch decoding of offsets chunks.
+ *
+ * decodeOffsetsChunk() decodes all the varbytes of at most
+ * JB_OFFSETS_CHUNK_SIZE bytes at ptr into out[], including the chunk header
+ * if the range starts with one and the zeros padding the chunk, and returns
+ * their number.  Chunks never split a varbyte, so callers can walk the
+ * decoded values instead of the bytes.
+ *
+ * A chunk is exactly as wide as an AVX2 register, so with AVX2 one
+ * comparison finds all the terminating bytes of the chunk, and every value
+ * is then extracted without branching on its bytes.  Whether the CPU
+ * supports it is checked on the first call, like PostgreSQL does for its
+ * CRC-32C instructions.
+ */
+static int	decodeOffsetsChunkChoose(const unsigned char *ptr, int len,
+						 uint32 *out);
+static int	(*decodeOffsetsChunk) (const unsigned char *ptr, int len,
+								   uint32 *out) = decodeOffsetsChunkChoose;
+
+static int
+decodeOffsetsChunkScalar(const unsigned char *ptr, int len, uint32 *out)
+{
+	unsigned char *p = (unsigned char *) ptr;
+	unsigned char *end = p + len;
+	int			n = 0;
+
+	while (p < end)
+		out[n++] = decode_varbyte(&p);
+
+	return n;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_AVX2_VARBYTE
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static int
+decodeOffsetsChunkAVX2(const unsigned char *ptr, int len, uint32 *out)
+{
+	/* Room for 8-byte loads at the last byte, which must read as zeros */
+	unsigned char buf[JB_OFFSETS_CHUNK_SIZE + 8];
+	uint32		ends;
+	int			start = 0,
+				n = 0;
+
+	Assert(len <= JB_OFFSETS_CHUNK_SIZE);
+
+	memcpy(buf, ptr, len);
+	memset(buf + len, 0, sizeof(buf) - len);
+
+	/* Bit i is set if byte i ends a varbyte, i.e. its high bit is clear */
+	ends = ~(uint32) _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) buf));
+	if (len < 32)
+		ends &= ((uint32) 1 << len) - 1;
+
+	while (ends)
+	{
+		int			last = __builtin_ctz(ends);
+		uint64		word;
+
+		memcpy(&word, buf + start, sizeof(word));
+		if (last - start < 7)
+			word &= ((uint64) 1 << (8 * (last - start + 1))) - 1;
+
+		/* Squeeze out the continuation bits, the 5th byte has none */
+		out[n++] = (uint32) ((word & 0x7F) |
+							 ((word >> 1) & 0x3F80) |
+							 ((word >> 2) & 0x1FC000) |
+							 ((word >> 3) & 0xFE00000) |
+							 ((word >> 4) & UINT64CONST(0xFF0000000)));
+
+		start = last + 1;
+		ends &= ends - 1;
+	}
+
+	return n;
+}
+#endif
+
+static int
+decodeOffsetsChunkChoose(const unsigned char *ptr, int len, uint32 *out)
+{
+#ifdef USE_AVX2_VARBYTE
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		decodeOffsetsChunk = decodeOffsetsChunkAVX2;
+	else
+#endif
+		decodeOffsetsChunk = decodeOffsetsChunkScalar;
+
+	return decodeOffsetsChunk(ptr, len, out);
+}
+
+/*
+ * Decode container header at *ptr, skipping the dictionary prefix of a root
+ * container and the count prefix.  *dict is set to the dictionary from the
+ * prefix if there is one, and left alone otherwise.  If count isn't NULL,
+ * *count is set to the stored number of children, or -1 if there is none.
+ */
+static uint32
+decodeContainerHeader(unsigned char **ptr, int32 *dict, int *count)
+{
+	uint32		header = decode_varbyte(ptr);
+
+	if ((header & JB_MASK) == JB_FEXT && header != JB_FCOUNT)
+	{
+		*dict = header >> JB_CSHIFT;
+		header = decode_varbyte(ptr);
+	}
+
+	if (header == JB_FCOUNT)
+	{
+		uint32		n = decode_varbyte(ptr);
+
+		if (count)
+			*count = n;
+		header = decode_varbyte(ptr);
+	}
+	else if (count)
+		*count = -1;
+
+	return header;
+}
+
+/*
+ * Size of the header of a container with offsets of "header >> JB_CSHIFT"
+ * bytes and "count" children, see encodeContainerHeader().
+ */
+static int
+containerHeaderSize(uint32 header, int count)
+{
+	int			size = varbyte_size(header);
+
+	if ((header >> JB_CSHIFT) > JB_OFFSETS_CHUNK_SIZE)
+		size += varbyte_size(JB_FCOUNT) + varbyte_size(count);
+
+	return size;
+}
+
+/*
+ * Encode container header at *ptr, prefixed with the number of children if
+ * the offsets take more than one chunk.
+ */
+static void
+encodeContainerHeader(uint32 header, int count, unsigned char **ptr)
+{
+	if ((header >> JB_CSHIFT) > JB_OFFSETS_CHUNK_SIZE)
+	{
+		encode_varbyte(JB_FCOUNT, ptr);
+		encode_varbyte(count, ptr);
+	}
+	encode_varbyte(header, ptr);
+}
+
+/*
+ * Count the elements or pairs of a container from its offsets, for
+ * containers without a stored count.
+ */
+static int
+countContainerChildren(unsigned char *ptr, uint32 size, bool isObject)
+{
+	unsigned char *end = ptr + size;
+	uint32		chunk[JB_OFFSETS_CHUNK_SIZE];
+	int			count = 0,
+				n,
+				k;
+
+	/* Chunks after the first one start with a header, skip it */
+	for (k = 0; ptr < end; ptr += JB_OFFSETS_CHUNK_SIZE, k = 2)
+	{
+		n = decodeOffsetsChunk(ptr, Min(ptr + JB_OFFSETS_CHUNK_SIZE, end) - ptr,
+							   chunk);
+		while (k < n && chunk[k] != 0)
+		{
+			count++;
+			k++;
+		}
+	}
+
+	return isObject ? count / 2 : count;
+}
+
 uint32
 jsonbc_header(Jsonbc *value)
 {
 	unsigned char *data = (unsigned char *)VARDATA(value);
+	int32		dict;
+
+	return decodeContainerHeader(&data, &dict, NULL);
+}
+
+/*
+ * Dictionary the keys of jsonbc belong to.
+ */
+int32
+JsonbcGetDict(Jsonbc *value)
+{
+	unsigned char *data = (unsigned char *)VARDATA(value);
+	int32		dict = DefaultDictId;
+
+	(void) decodeContainerHeader(&data, &dict, NULL);
+
+	return dict;
+}
+
+/*
+ * Number of elements of an array, or of pairs of an object.
+ */
+int
+JsonbcContainerCount(JsonbcContainer *container)
+{
+	unsigned char *ptr = (unsigned char *) container->data;
+	int32		dict;
+	int			count;
+	uint32		header;
 
-	return decode_varbyte(&data);
+	header = decodeContainerHeader(&ptr, &dict, &count);
+	if (count < 0)
+		count = countContainerChildren(ptr, header >> JB_CSHIFT,
+									   (header & JB_MASK) == JB_FOBJECT);
+
+	return count;
 }
 
 /*
@@ -168,6 +424,17 @@ jsonbc_header(Jsonbc *value)
  */
 Jsonbc *
 JsonbcValueToJsonbc(JsonbcValue *val)
+{
+	return JsonbcValueToJsonbcDict(val, DefaultDictId);
+}
+
+/*
+ * Like JsonbcValueToJsonbc(), but object keys are put into the given
+ * dictionary.  A jbvBinary value is copied as is, so it stays in the
+ * dictionary it comes from.
+ */
+Jsonbc *
+JsonbcValueToJsonbcDict(JsonbcValue *val, int32 dict)
 {
 	Jsonbc	   *out;
 
@@ -186,18 +453,32 @@ JsonbcValueToJsonbc(JsonbcValue *val)
 		pushJsonbcValue(&pstate, WJB_ELEM, val);
 		res = pushJsonbcValue(&pstate, WJB_END_ARRAY, NULL);
 
-		out = convertToJsonbc(res);
+		/* Scalars have no keys, keep them in the default dictionary */
+		out = convertToJsonbc(res, DefaultDictId);
 	}
 	else if (val->type == jbvObject || val->type == jbvArray)
 	{
-		out = convertToJsonbc(val);
+		out = convertToJsonbc(val, dict);
 	}
 	else
 	{
+		unsigned char prefix[MAX_VARBYTE_SIZE],
+				   *ptr = prefix;
+
 		Assert(val->type == jbvBinary);
-		out = palloc(VARHDRSZ + val->val.binary.len);
-		SET_VARSIZE(out, VARHDRSZ + val->val.binary.len);
-		memcpy(VARDATA(out), val->val.binary.data, val->val.binary.len);
+
+		/* Nested container becomes a root: give it the dictionary prefix */
+		if (val->val.binary.dict != DefaultDictId &&
+			(((unsigned char) val->val.binary.data->data[0] & JB_MASK) != JB_FEXT ||
+			 (unsigned char) val->val.binary.data->data[0] == JB_FCOUNT))
+			encode_varbyte(((uint32) val->val.binary.dict << JB_CSHIFT) | JB_FEXT,
+						   &ptr);
+
+		out = palloc(VARHDRSZ + (ptr - prefix) + val->val.binary.len);
+		SET_VARSIZE(out, VARHDRSZ + (ptr - prefix) + val->val.binary.len);
+		memcpy(VARDATA(out), prefix, ptr - prefix);
+		memcpy(VARDATA(out) + (ptr - prefix), val->val.binary.data,
+			   val->val.binary.len);
 	}
 
 	return out;
@@ -234,136 +515,225 @@ getJsonbcOffset(const JsonbcContainer *jc, int index)
 }
 
 /*
- * BT comparator worker function.  Returns an integer less than, equal to, or
- * greater than zero, indicating whether a is less than, equal to, or greater
- * than b.  Consistent with the requirements for a B-Tree operator class
- *
- * Strings are compared lexically, in contrast with other places where we use a
- * much simpler comparator logic for searching through Strings.  Since this is
- * called from B-Tree support function 1, we're careful about not leaking
- * memory here.
+ * Key/value pair of an object, see compareContainersByName().
  */
-int
-compareJsonbcContainers(JsonbcContainer *a, JsonbcContainer *b)
+typedef struct NamedPair
+{
+	JsonbcValue	key;
+	JsonbcValue	value;
+} NamedPair;
+
+static int
+compareNamedPairs(const void *a, const void *b)
+{
+	return lengthCompareJsonbcStringValue(&((NamedPair *) a)->key,
+										  &((NamedPair *) b)->key);
+}
+
+/*
+ * compareContainersByName() worker: compare two values returned by
+ * JsonbcIteratorNext() with skipNested.
+ */
+static int
+compareValuesByName(JsonbcValue *a, JsonbcValue *b)
 {
-	JsonbcIterator *ita,
-			   *itb;
-	int			res = 0;
+	if (a->type == jbvBinary && b->type == jbvBinary)
+		return compareContainersByName(
+			JsonbcIteratorInitDict(a->val.binary.data, a->val.binary.dict),
+			JsonbcIteratorInitDict(b->val.binary.data, b->val.binary.dict));
+
+	/* Containers come after scalars */
+	if (a->type == jbvBinary)
+		return 1;
+	if (b->type == jbvBinary)
+		return -1;
+	if (a->type != b->type)
+		return (a->type > b->type) ? 1 : -1;
+
+	return compareJsonbcScalarValue(a, b);
+}
 
-	ita = JsonbcIteratorInit(a);
-	itb = JsonbcIteratorInit(b);
+/*
+ * compareContainersByName() worker: read the rest of an object, and return
+ * its pairs sorted by key name.  The iterator is freed.
+ */
+static NamedPair *
+loadNamedPairs(JsonbcIterator *it, int nPairs)
+{
+	NamedPair  *pairs = palloc(sizeof(NamedPair) * Max(nPairs, 1));
+	JsonbcValue	v;
+	JsonbcIteratorToken r;
+	int			i = 0;
 
-	do
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_END_OBJECT)
 	{
-		JsonbcValue	va,
-					vb;
-		int			ra,
-					rb;
+		if (r == WJB_KEY)
+			pairs[i].key = v;
+		else
+		{
+			Assert(r == WJB_VALUE);
+			pairs[i++].value = v;
+		}
+	}
+	Assert(i == nPairs);
+
+	if (nPairs > 1)
+		qsort(pairs, nPairs, sizeof(NamedPair), compareNamedPairs);
+
+	return pairs;
+}
+
+/*
+ * compareJsonbcContainers() worker, given iterators just initialized for the
+ * containers.  The pairs of objects are compared in the order of their key
+ * names, rather than in the order of key ids they are stored in, so that the
+ * result doesn't depend on the dictionaries of the values.  The iterators
+ * are freed.
+ */
+static int
+compareContainersByName(JsonbcIterator *ita, JsonbcIterator *itb)
+{
+	JsonbcValue	va,
+				vb;
+	int			res = 0,
+				i;
+
+	check_stack_depth();
 
-		ra = JsonbcIteratorNext(&ita, &va, false);
-		rb = JsonbcIteratorNext(&itb, &vb, false);
+	(void) JsonbcIteratorNext(&ita, &va, true);
+	(void) JsonbcIteratorNext(&itb, &vb, true);
 
-		if (ra == rb)
+	if (va.type != vb.type)
+		res = (va.type > vb.type) ? 1 : -1;
+	else if (va.type == jbvArray)
+	{
+		/*
+		 * This could be a "raw scalar" pseudo array.  That's a special case
+		 * here though, since we still want the general type-based
+		 * comparisons to apply, and as far as we're concerned a pseudo array
+		 * is just a scalar.
+		 */
+		if (va.val.array.rawScalar != vb.val.array.rawScalar)
+			res = (va.val.array.rawScalar) ? -1 : 1;
+		if (va.val.array.nElems != vb.val.array.nElems)
+			res = (va.val.array.nElems > vb.val.array.nElems) ? 1 : -1;
+
+		for (i = 0; res == 0 && i < va.val.array.nElems; i++)
 		{
-			if (ra == WJB_DONE)
-			{
-				/* Decisively equal */
-				break;
-			}
+			JsonbcValue	ea,
+						eb;
 
-			if (ra == WJB_END_ARRAY || ra == WJB_END_OBJECT)
-			{
-				/*
-				 * There is no array or object to compare at this stage of
-				 * processing.  jbvArray/jbvObject values are compared
-				 * initially, at the WJB_BEGIN_ARRAY and WJB_BEGIN_OBJECT
-				 * tokens.
-				 */
-				continue;
-			}
+			(void) JsonbcIteratorNext(&ita, &ea, true);
+			(void) JsonbcIteratorNext(&itb, &eb, true);
+			res = compareValuesByName(&ea, &eb);
+		}
+	}
+	else
+	{
+		Assert(va.type == jbvObject);
 
-			if (va.type == vb.type)
-			{
-				switch (va.type)
-				{
-					case jbvString:
-					case jbvNull:
-					case jbvNumeric:
-					case jbvBool:
-						res = compareJsonbcScalarValue(&va, &vb);
-						break;
-					case jbvArray:
+		if (va.val.object.nPairs != vb.val.object.nPairs)
+			res = (va.val.object.nPairs > vb.val.object.nPairs) ? 1 : -1;
+		else
+		{
+			int			nPairs = va.val.object.nPairs;
+			NamedPair  *pa = loadNamedPairs(ita, nPairs),
+					   *pb = loadNamedPairs(itb, nPairs);
 
-						/*
-						 * This could be a "raw scalar" pseudo array.  That's
-						 * a special case here though, since we still want the
-						 * general type-based comparisons to apply, and as far
-						 * as we're concerned a pseudo array is just a scalar.
-						 */
-						if (va.val.array.rawScalar != vb.val.array.rawScalar)
-							res = (va.val.array.rawScalar) ? -1 : 1;
-						if (va.val.array.nElems != vb.val.array.nElems)
-							res = (va.val.array.nElems > vb.val.array.nElems) ? 1 : -1;
-						break;
-					case jbvObject:
-						if (va.val.object.nPairs != vb.val.object.nPairs)
-							res = (va.val.object.nPairs > vb.val.object.nPairs) ? 1 : -1;
-						break;
-					case jbvBinary:
-						elog(ERROR, "unexpected jbvBinary value");
-				}
-			}
-			else
+			ita = itb = NULL;
+			for (i = 0; res == 0 && i < nPairs; i++)
 			{
-				/* Type-defined order */
-				res = (va.type > vb.type) ? 1 : -1;
+				res = lengthCompareJsonbcStringValue(&pa[i].key, &pb[i].key);
+				if (res == 0)
+					res = compareValuesByName(&pa[i].value, &pb[i].value);
 			}
+
+			pfree(pa);
+			pfree(pb);
 		}
-		else
+	}
+
+	/* Nested containers have iterators of their own */
+	if (ita)
+		pfree(ita);
+	if (itb)
+		pfree(itb);
+
+	return res;
+}
+
+/*
+ * BT comparator worker function.  Returns an integer less than, equal to, or
+ * greater than zero, indicating whether a is less than, equal to, or greater
+ * than b.  Consistent with the requirements for a B-Tree operator class
+ *
+ * Strings are compared lexically, in contrast with other places where we use a
+ * much simpler comparator logic for searching through Strings.  Object keys
+ * are the exception: pairs are matched up by key name, and key names are
+ * ordered by length first, so that the order is the same whatever the
+ * dictionaries of the values.  Since this is called from B-Tree support
+ * function 1, we're careful about not leaking memory here.
+ */
+int
+compareJsonbcContainers(JsonbcContainer *a, JsonbcContainer *b)
+{
+	return compareContainersByName(JsonbcIteratorInit(a),
+								   JsonbcIteratorInit(b));
+}
+
+/*
+ * Find the offsets chunk of a container which holds the child searched for.
+ * Every chunk but the first one starts with a header holding the index of
+ * its first child, or for objects the key id preceding its first key, and
+ * the data offset of that child.  Chunks are of fixed size, so the headers
+ * are binary searched.  For objects the chunk sought is the last one whose
+ * header key is below "target", for arrays the last one whose first index
+ * is at most "target".
+ *
+ * "ptr" and "end" delimit the offsets of the container.  Returns the start
+ * of the entries of the chunk, and sets *chunkEnd, and *first and *offset to
+ * the header values (zeros for the first chunk).
+ */
+static unsigned char *
+seekOffsetsChunk(unsigned char *ptr, unsigned char *end, uint32 target,
+				 bool isObject, uint32 *first, uint32 *offset,
+				 unsigned char **chunkEnd)
+{
+	int			lo = 1,
+				hi = (int) ((end - ptr - 1) / JB_OFFSETS_CHUNK_SIZE),
+				found = 0;
+	unsigned char *p;
+
+	while (lo <= hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+		uint32		jj;
+
+		p = ptr + mid * JB_OFFSETS_CHUNK_SIZE;
+		jj = decode_varbyte(&p);
+		if (isObject ? jj < target : jj <= target)
 		{
-			/*
-			 * It's safe to assume that the types differed, and that the va
-			 * and vb values passed were set.
-			 *
-			 * If the two values were of the same container type, then there'd
-			 * have been a chance to observe the variation in the number of
-			 * elements/pairs (when processing WJB_BEGIN_OBJECT, say). They're
-			 * either two heterogeneously-typed containers, or a container and
-			 * some scalar type.
-			 *
-			 * We don't have to consider the WJB_END_ARRAY and WJB_END_OBJECT
-			 * cases here, because we would have seen the corresponding
-			 * WJB_BEGIN_ARRAY and WJB_BEGIN_OBJECT tokens first, and
-			 * concluded that they don't match.
-			 */
-			Assert(ra != WJB_END_ARRAY && ra != WJB_END_OBJECT);
-			Assert(rb != WJB_END_ARRAY && rb != WJB_END_OBJECT);
-
-			Assert(va.type != vb.type);
-			Assert(va.type != jbvBinary);
-			Assert(vb.type != jbvBinary);
-			/* Type-defined order */
-			res = (va.type > vb.type) ? 1 : -1;
+			found = mid;
+			lo = mid + 1;
 		}
+		else
+			hi = mid - 1;
 	}
-	while (res == 0);
 
-	while (ita != NULL)
+	p = ptr + found * JB_OFFSETS_CHUNK_SIZE;
+	*chunkEnd = p + JB_OFFSETS_CHUNK_SIZE;
+	if (found == 0)
 	{
-		JsonbcIterator *i = ita->parent;
-
-		pfree(ita);
-		ita = i;
+		*first = 0;
+		*offset = 0;
 	}
-	while (itb != NULL)
+	else
 	{
-		JsonbcIterator *i = itb->parent;
-
-		pfree(itb);
-		itb = i;
+		*first = decode_varbyte(&p);
+		*offset = decode_varbyte(&p);
 	}
 
-	return res;
+	return p;
 }
 
 /*
@@ -372,13 +742,14 @@ compareJsonbcContainers(JsonbcContainer *a, JsonbcContainer *b)
  * Returns palloc()'d copy of the value, or NULL if it does not exist.
  */
 static JsonbcValue *
-getKeyJsonbcValueFromObject(uint32 header, unsigned char *ptr, uint32 keyId)
+getKeyJsonbcValueFromObject(uint32 header, unsigned char *ptr, uint32 keyId,
+							int32 dict)
 {
 	JsonbcValue	   *result;
-	unsigned char  *end, *chunkHeader, *chunkPtr;
-	uint32			offset = 0;
-	int				j = 0, jj;
-	JEntry			entry;
+	unsigned char  *end, *chunkHeader;
+	uint32			offset, j;
+	uint32			chunk[JB_OFFSETS_CHUNK_SIZE];
+	int				n, k;
 
 	if ((header >> JB_CSHIFT) <= 0)
 		return NULL;
@@ -388,35 +759,21 @@ getKeyJsonbcValueFromObject(uint32 header, unsigned char *ptr, uint32 keyId)
 	if ((header & JB_MASK) != JB_FOBJECT)
 		return NULL;
 
-	chunkHeader = ptr + JB_OFFSETS_CHUNK_SIZE;
-
-	while (chunkHeader < end)
-	{
-		chunkPtr = chunkHeader;
-		jj = decode_varbyte(&chunkPtr);
-		if (jj >= keyId)
-			break;
-		j = jj;
-		offset = decode_varbyte(&chunkPtr);
-		ptr = chunkPtr;
-
-		chunkHeader += JB_OFFSETS_CHUNK_SIZE;
-	}
+	ptr = seekOffsetsChunk(ptr, end, keyId, true, &j, &offset, &chunkHeader);
 
-	while (j < keyId)
+	/* The key can only be in this chunk, walk its key/JEntry pairs */
+	n = decodeOffsetsChunk(ptr, Min(chunkHeader, end) - ptr, chunk);
+	for (k = 0; k + 1 < n && chunk[k] != 0 && j < keyId; k += 2)
 	{
-		entry = decode_varbyte(&ptr);
-		if (entry == 0 || ptr > chunkHeader || ptr > end)
-			return NULL;
-		j += entry;
-		entry = decode_varbyte(&ptr);
+		j += chunk[k];
 		if (j == keyId)
 		{
 			result = palloc(sizeof(JsonbcValue));
-			fillJsonbcValue(entry, (char *)end, offset, result);
+			fillJsonbcValue(chunk[k + 1], (char *)end, offset, dict, false,
+							result);
 			return result;
 		}
-		offset += (entry >> JENTRY_SHIFT);
+		offset += (chunk[k + 1] >> JENTRY_SHIFT);
 	}
 
 	return NULL;
@@ -428,41 +785,40 @@ getKeyJsonbcValueFromObject(uint32 header, unsigned char *ptr, uint32 keyId)
  * Returns palloc()'d copy of the value, or NULL if it does not exist.
  */
 static JsonbcValue *
-findJsonbcValueInArray(uint32 header, unsigned char *ptr, JsonbcValue *key)
+findJsonbcValueInArray(uint32 header, unsigned char *ptr, JsonbcValue *key,
+					   int32 dict)
 {
 	JsonbcValue	   *result;
-	unsigned char  *end, *chunkHeader;
+	unsigned char  *end;
 	uint32			offset = 0;
-	JEntry			entry;
+	uint32			chunk[JB_OFFSETS_CHUNK_SIZE];
+	int				n, k;
 
 	end = ptr + (header >> JB_CSHIFT);
 
 	if ((header & JB_MASK) != JB_FARRAY && (header & JB_MASK) != JB_FSCALAR)
 		return NULL;
 
-	chunkHeader = ptr + JB_OFFSETS_CHUNK_SIZE;
-
 	result = palloc(sizeof(JsonbcValue));
-	while (ptr < end)
+
+	/* Chunks after the first one start with a header, skip it */
+	for (k = 0; ptr < end; ptr += JB_OFFSETS_CHUNK_SIZE, k = 2)
 	{
-		entry = decode_varbyte(&ptr);
-		if (entry == 0 || ptr >= chunkHeader)
+		n = decodeOffsetsChunk(ptr, Min(ptr + JB_OFFSETS_CHUNK_SIZE, end) - ptr,
+							   chunk);
+
+		for (; k < n && chunk[k] != 0; k++)
 		{
-			ptr = chunkHeader;
-			decode_varbyte(&chunkHeader);
-			decode_varbyte(&chunkHeader);
-			chunkHeader += JB_OFFSETS_CHUNK_SIZE;
-		}
+			fillJsonbcValue(chunk[k], (char  *)end, offset, dict, false, result);
 
-		fillJsonbcValue(entry, (char  *)end, offset, result);
+			if (key->type == result->type)
+			{
+				if (equalsJsonbcScalarValue(key, result))
+					return result;
+			}
 
-		if (key->type == result->type)
-		{
-			if (equalsJsonbcScalarValue(key, result))
-				return result;
+			offset += (chunk[k] >> JENTRY_SHIFT);
 		}
-
-		offset += (entry >> JENTRY_SHIFT);
 	}
 	pfree(result);
 	return NULL;
@@ -494,31 +850,53 @@ findJsonbcValueInArray(uint32 header, unsigned char *ptr, JsonbcValue *key)
  * a container type that is not of the type pointed to by the container,
  * immediately fall through and return NULL.  If we cannot find the value,
  * return NULL.  Otherwise, return palloc()'d copy of value.
+ *
+ * "dict" is the dictionary of the datum the container belongs to.  A root
+ * container of a non-default dictionary says so itself, which overrides it.
  */
 JsonbcValue *
-findJsonbcValueFromContainer(JsonbcContainer *container, uint32 flags,
-							JsonbcValue *key)
+findJsonbcValueFromContainer(JsonbcContainer *container, int32 dict,
+							uint32 flags, JsonbcValue *key)
 {
 	unsigned char *ptr;
 	uint32 header;
 
 	ptr = (unsigned char *)container->data;
-	header = decode_varbyte(&ptr);
+	header = decodeContainerHeader(&ptr, &dict, NULL);
 
 	if ((flags & JB_FARRAY) && ((header & JB_MASK) == JB_FARRAY || (header & JB_MASK) == JB_FSCALAR))
 	{
-		return findJsonbcValueInArray(header, ptr, key);
+		return findJsonbcValueInArray(header, ptr, key, dict);
 	}
 	else if (flags & JB_FOBJECT && (header & JB_MASK) == JB_FOBJECT)
 	{
 		int32		keyId;
+		JsonbcValue *result;
+		KeyName		keyName;
 
 		/* Object key passed by caller must be a string */
 		Assert(key->type == jbvString);
 
-		keyId = convertKeyNameToId(key);
+		/*
+		 * Lookups must not insert into the dictionary: a key which is not
+		 * there can't be present in any stored object.
+		 */
+		keyId = lookupKeyNameId(dict, key);
+		if (keyId == InvalidKeyId)
+			return NULL;
+
+		result = getKeyJsonbcValueFromObject(header, ptr, keyId, dict);
+		if (result)
+			return result;
+
+		/* The object might not be rewritten by jsonbc_renumber_keys() yet */
+		keyName.s = key->val.string.val;
+		keyName.len = key->val.string.len;
+		keyId = lookupPrevIdByName(dict, keyName);
+		if (keyId == InvalidKeyId)
+			return NULL;
 
-		return getKeyJsonbcValueFromObject(header, ptr, keyId);
+		return getKeyJsonbcValueFromObject(header, ptr, keyId, dict);
 	}
 
 	return NULL;
@@ -530,53 +908,45 @@ findJsonbcValueFromContainer(JsonbcContainer *container, uint32 flags,
  * Returns palloc()'d copy of the value, or NULL if it does not exist.
  */
 JsonbcValue *
-getIthJsonbcValueFromContainer(JsonbcContainer *container, uint32 i)
+getIthJsonbcValueFromContainer(JsonbcContainer *container, int32 dict,
+							   uint32 i)
 {
 	uint32			header;
 	JsonbcValue	   *result;
-	unsigned char  *ptr, *end, *chunkHeader, *chunkPtr;
-	uint32			offset = 0;
-	int				j = 0, jj;
-	JEntry			entry;
+	unsigned char  *ptr, *end, *chunkHeader;
+	uint32			offset, j;
+	uint32			chunk[JB_OFFSETS_CHUNK_SIZE];
+	int				n, k;
 
 	ptr = (unsigned char *)container->data;
-	header = decode_varbyte(&ptr);
+	header = decodeContainerHeader(&ptr, &dict, NULL);
 	end = ptr + (header >> JB_CSHIFT);
 
 	if ((header & JB_MASK) != JB_FARRAY && (header & JB_MASK) != JB_FSCALAR)
 		elog(ERROR, "not a jsonbc array");
 
-	chunkHeader = ptr + JB_OFFSETS_CHUNK_SIZE;
-
-	while (chunkHeader < end)
-	{
-		chunkPtr = chunkHeader;
-		jj = decode_varbyte(&chunkPtr);
-		if (jj > i)
-			break;
-		j = jj;
-		offset = decode_varbyte(&chunkPtr);
-		ptr = chunkPtr;
+	if (ptr >= end)
+		return NULL;
 
-		chunkHeader += JB_OFFSETS_CHUNK_SIZE;
-	}
+	/* The element can only be in this chunk */
+	ptr = seekOffsetsChunk(ptr, end, i, false, &j, &offset, &chunkHeader);
+	n = decodeOffsetsChunk(ptr, Min(chunkHeader, end) - ptr, chunk);
+	if (i - j >= n)
+		return NULL;
 
-	while (j < i)
+	for (k = 0; k < i - j; k++)
 	{
-		entry = decode_varbyte(&ptr);
-		if (entry == 0 || ptr > chunkHeader || ptr > end)
+		if (chunk[k] == 0)
 			return NULL;
-		offset += (entry >> JENTRY_SHIFT);
-		j++;
+		offset += (chunk[k] >> JENTRY_SHIFT);
 	}
 
-	entry = decode_varbyte(&ptr);
-	if (entry == 0 || ptr > chunkHeader || ptr > end)
+	if (chunk[k] == 0)
 		return NULL;
 
 	result = palloc(sizeof(JsonbcValue));
 
-	fillJsonbcValue(entry, (char *)end, offset, result);
+	fillJsonbcValue(chunk[k], (char *)end, offset, dict, false, result);
 
 	return result;
 }
@@ -591,11 +961,14 @@ getIthJsonbcValueFromContainer(JsonbcContainer *container, uint32 i)
  * children.  When it can't, it can just call getJsonbcOffset().
  *
  * A nested array or object will be returned as jbvBinary, ie. it won't be
- * expanded.
+ * expanded.  It remembers the dictionary "dict" of the datum.
+ *
+ * A string stored as a dictionary id is looked up in the dictionary, unless
+ * keyIds is set, in which case only the id is returned, with an empty name.
  */
 static void
-fillJsonbcValue(JEntry entry, char *base_addr, uint32 offset,
-			   JsonbcValue *result)
+fillJsonbcValue(JEntry entry, char *base_addr, uint32 offset, int32 dict,
+				bool keyIds, JsonbcValue *result)
 {
 	if (JBE_ISNULL(entry))
 	{
@@ -606,8 +979,30 @@ fillJsonbcValue(JEntry entry, char *base_addr, uint32 offset,
 		result->type = jbvString;
 		result->val.string.val = base_addr + offset;
 		result->val.string.len = (entry >> JENTRY_SHIFT);
+		result->val.string.id = InvalidKeyId;
+		result->val.string.dict = dict;
 		Assert(result->val.string.len >= 0);
 	}
+	else if (JBE_ISSTRINGID(entry))
+	{
+		unsigned char *ptr = (unsigned char *)base_addr + offset;
+
+		result->type = jbvString;
+		result->val.string.id = decode_varbyte(&ptr);
+		result->val.string.dict = dict;
+		if (keyIds)
+		{
+			result->val.string.val = NULL;
+			result->val.string.len = 0;
+		}
+		else
+		{
+			KeyName name = getNameById(dict, result->val.string.id);
+
+			result->val.string.val = name.s;
+			result->val.string.len = name.len;
+		}
+	}
 	else if (JBE_ISNUMERIC(entry))
 	{
 		result->type = jbvNumeric;
@@ -636,6 +1031,7 @@ fillJsonbcValue(JEntry entry, char *base_addr, uint32 offset,
 		/* Remove alignment padding from data pointer and length */
 		result->val.binary.data = (JsonbcContainer *) (base_addr + offset);
 		result->val.binary.len = (entry >> JENTRY_SHIFT);
+		result->val.binary.dict = dict;
 	}
 }
 
@@ -706,7 +1102,10 @@ pushJsonbcValue(JsonbcParseState **pstate, JsonbcIteratorToken seq,
 			appendElement(*pstate, scalarVal);
 			break;
 		case WJB_END_OBJECT:
-			uniqueifyJsonbcObject(&(*pstate)->contVal);
+			/*
+			 * Object can't be uniqueified yet, since key ids aren't known
+			 * until convertToJsonbc() resolves them.
+			 */
 			/* fall through! */
 		case WJB_END_ARRAY:
 			/* Steps here common to WJB_END_OBJECT case */
@@ -776,8 +1175,12 @@ appendKey(JsonbcParseState *pstate, JsonbcValue *string)
 											sizeof(JsonbcPair) * pstate->size);
 	}
 
-	object->val.object.pairs[object->val.object.nPairs].key = convertKeyNameToId(string);
+	/* Key id is resolved later, together with all other keys of the value */
+	object->val.object.pairs[object->val.object.nPairs].key = InvalidKeyId;
+	object->val.object.pairs[object->val.object.nPairs].keyName = string->val.string.val;
+	object->val.object.pairs[object->val.object.nPairs].keyLen = string->val.string.len;
 	object->val.object.pairs[object->val.object.nPairs].order = object->val.object.nPairs;
+	object->val.object.pairs[object->val.object.nPairs].valueId = InvalidKeyId;
 }
 
 /*
@@ -829,11 +1232,106 @@ appendElement(JsonbcParseState *pstate, JsonbcValue *scalarVal)
 JsonbcIterator *
 JsonbcIteratorInit(JsonbcContainer *container)
 {
-	return iteratorFromContainer(container, NULL);
+	return iteratorFromContainer(container, DefaultDictId, NULL);
 }
 
 /*
- * Get next JsonbcValue while iterating
+ * Like JsonbcIteratorInit(), but for a nested container, which doesn't know
+ * its dictionary by itself: "dict" is the dictionary of the datum, as in
+ * val.binary.dict of a jbvBinary value.
+ */
+JsonbcIterator *
+JsonbcIteratorInitDict(JsonbcContainer *container, int32 dict)
+{
+	return iteratorFromContainer(container, dict, NULL);
+}
+
+/*
+ * Like JsonbcIteratorInit(), but object keys are not looked up in the
+ * dictionary: WJB_KEY is returned with an empty string value, and the key
+ * id can be fetched with JsonbcIteratorKeyId().  Strings stored as
+ * dictionary ids are returned empty as well, with val.string.id set.
+ */
+JsonbcIterator *
+JsonbcIteratorInitKeyIds(JsonbcContainer *container)
+{
+	JsonbcIterator *it = iteratorFromContainer(container, DefaultDictId, NULL);
+
+	it->keyIds = true;
+	return it;
+}
+
+/*
+ * Id of the key just returned by JsonbcIteratorNext().
+ */
+int32
+JsonbcIteratorKeyId(JsonbcIterator *it)
+{
+	Assert(it->state == JBI_OBJECT_VALUE);
+	return it->curKey;
+}
+
+/*
+ * Decode the offsets chunk of the iterator's container starting at "start".
+ */
+static void
+iteratorLoadChunk(JsonbcIterator *it, unsigned char *start)
+{
+	unsigned char *end = it->children + it->childrenSize;
+
+	it->chunkEnd = start + JB_OFFSETS_CHUNK_SIZE;
+	it->chunkLen = decodeOffsetsChunk(start, Min(it->chunkEnd, end) - start,
+									  it->chunk);
+	it->chunkPos = 0;
+}
+
+/*
+ * Fetch the next key delta or array JEntry, moving to the next chunk at the
+ * end of the current one or at its zero padding.  Returns false at the end
+ * of the container.
+ */
+static bool
+iteratorNextEntry(JsonbcIterator *it, uint32 *entry)
+{
+	if (it->chunkPos >= it->chunkLen || it->chunk[it->chunkPos] == 0)
+	{
+		if (it->chunkEnd >= it->children + it->childrenSize)
+			return false;
+
+		iteratorLoadChunk(it, it->chunkEnd);
+
+		/* Skip the chunk header */
+		it->chunkPos = 2;
+		if (it->chunkPos >= it->chunkLen)
+			return false;
+	}
+
+	*entry = it->chunk[it->chunkPos++];
+	return true;
+}
+
+/*
+ * Number of elements or pairs of the iterator's container.  Unless it's
+ * stored, small containers have it from their only chunk, which must have
+ * been loaded.
+ */
+static int
+iteratorCount(JsonbcIterator *it, bool isObject)
+{
+	if (it->count < 0)
+	{
+		if (it->childrenSize <= JB_OFFSETS_CHUNK_SIZE)
+			it->count = isObject ? it->chunkLen / 2 : it->chunkLen;
+		else
+			it->count = countContainerChildren(it->children,
+											   it->childrenSize, isObject);
+	}
+
+	return it->count;
+}
+
+/*
+ * Get next JsonbcValue while iterating
  *
  * Caller should initially pass their own, original iterator.  They may get
  * back a child iterator palloc()'d here instead.  The function can be relied
@@ -883,14 +1381,14 @@ recurse:
 		case JBI_ARRAY_START:
 			/* Set v to array on first array call */
 			val->type = jbvArray;
-			val->val.array.nElems = (*it)->childrenSize; /* FIXME */
+			iteratorLoadChunk(*it, (*it)->children);
+			val->val.array.nElems = iteratorCount(*it, false);
 
 			/*
 			 * v->val.array.elems is not actually set, because we aren't doing
 			 * a full conversion
 			 */
 			val->val.array.rawScalar = (*it)->isScalar;
-			(*it)->childrenPtr = (*it)->children;
 			(*it)->curDataOffset = 0;
 			(*it)->curValueOffset = 0;	/* not actually used */
 			/* Set state for next call */
@@ -898,7 +1396,7 @@ recurse:
 			return WJB_BEGIN_ARRAY;
 
 		case JBI_ARRAY_ELEM:
-			if ((*it)->childrenPtr >= (*it)->children + (*it)->childrenSize)
+			if (!iteratorNextEntry(*it, &entry))
 			{
 				/*
 				 * All elements within array already processed.  Report this
@@ -910,34 +1408,16 @@ recurse:
 				return WJB_END_ARRAY;
 			}
 
-			if ((*it)->childrenPtr >= (*it)->chunkEnd)
-			{
-				(*it)->childrenPtr = (*it)->chunkEnd;
-				decode_varbyte(&(*it)->childrenPtr);
-				decode_varbyte(&(*it)->childrenPtr);
-				(*it)->chunkEnd += JB_OFFSETS_CHUNK_SIZE;
-			}
-
-			entry = decode_varbyte(&(*it)->childrenPtr);
-			if (entry == 0)
-			{
-				(*it)->childrenPtr = (*it)->chunkEnd;
-				decode_varbyte(&(*it)->childrenPtr);
-				decode_varbyte(&(*it)->childrenPtr);
-				entry = decode_varbyte(&(*it)->childrenPtr);
-				(*it)->chunkEnd += JB_OFFSETS_CHUNK_SIZE;
-			}
-
 			fillJsonbcValue(entry,
 						   (*it)->dataProper, (*it)->curDataOffset,
-						   val);
+						   (*it)->dict, (*it)->keyIds, val);
 
 			(*it)->curDataOffset += (entry >> JENTRY_SHIFT);
 
 			if (!IsAJsonbcScalar(val) && !skipNested)
 			{
 				/* Recurse into container. */
-				*it = iteratorFromContainer(val->val.binary.data, *it);
+				*it = iteratorFromContainer(val->val.binary.data, (*it)->dict, *it);
 				goto recurse;
 			}
 			else
@@ -952,13 +1432,13 @@ recurse:
 		case JBI_OBJECT_START:
 			/* Set v to object on first object call */
 			val->type = jbvObject;
-			val->val.object.nPairs = (*it)->childrenSize; /* FIXME */
+			iteratorLoadChunk(*it, (*it)->children);
+			val->val.object.nPairs = iteratorCount(*it, true);
 
 			/*
 			 * v->val.object.pairs is not actually set, because we aren't
 			 * doing a full conversion
 			 */
-			(*it)->childrenPtr = (*it)->children;
 			(*it)->curKey = 0;
 			(*it)->curDataOffset = 0;
 			(*it)->curValueOffset = 0;	/* not actually used */
@@ -967,7 +1447,7 @@ recurse:
 			return WJB_BEGIN_OBJECT;
 
 		case JBI_OBJECT_KEY:
-			if ((*it)->childrenPtr >= (*it)->children + (*it)->childrenSize)
+			if (!iteratorNextEntry(*it, &keyIncr))
 			{
 				/*
 				 * All pairs within object already processed.  Report this to
@@ -980,31 +1460,23 @@ recurse:
 			}
 			else
 			{
-				if ((*it)->childrenPtr >= (*it)->chunkEnd)
-				{
-					(*it)->childrenPtr = (*it)->chunkEnd;
-					decode_varbyte(&(*it)->childrenPtr);
-					decode_varbyte(&(*it)->childrenPtr);
-					(*it)->chunkEnd += JB_OFFSETS_CHUNK_SIZE;
-				}
+				(*it)->curKey += keyIncr;
 
-				keyIncr = decode_varbyte(&(*it)->childrenPtr);
-				if (entry == 0)
+				val->type = jbvString;
+				val->val.string.id = (*it)->curKey;
+				val->val.string.dict = (*it)->dict;
+				if ((*it)->keyIds)
 				{
-					(*it)->childrenPtr = (*it)->chunkEnd;
-					decode_varbyte(&(*it)->childrenPtr);
-					decode_varbyte(&(*it)->childrenPtr);
-					keyIncr = decode_varbyte(&(*it)->childrenPtr);
-					(*it)->chunkEnd += JB_OFFSETS_CHUNK_SIZE;
+					val->val.string.val = NULL;
+					val->val.string.len = 0;
 				}
+				else
+				{
+					KeyName keyName = getNameById((*it)->dict, (*it)->curKey);
 
-				(*it)->curKey += keyIncr;
-
-				KeyName keyName = getNameById((*it)->curKey);
-
-				val->type = jbvString;
-				val->val.string.val = keyName.s;
-				val->val.string.len = keyName.len;
+					val->val.string.val = keyName.s;
+					val->val.string.len = keyName.len;
+				}
 
 				/* Set state for next call */
 				(*it)->state = JBI_OBJECT_VALUE;
@@ -1015,11 +1487,12 @@ recurse:
 			/* Set state for next call */
 			(*it)->state = JBI_OBJECT_KEY;
 
-			entry = decode_varbyte(&(*it)->childrenPtr);
+			/* A value is always in the chunk of its key */
+			entry = (*it)->chunk[(*it)->chunkPos++];
 
 			fillJsonbcValue(entry,
 						   (*it)->dataProper, (*it)->curDataOffset,
-						   val);
+						   (*it)->dict, (*it)->keyIds, val);
 
 			(*it)->curDataOffset += (entry >> JENTRY_SHIFT);
 
@@ -1030,7 +1503,7 @@ recurse:
 			 */
 			if (!IsAJsonbcScalar(val) && !skipNested)
 			{
-				*it = iteratorFromContainer(val->val.binary.data, *it);
+				*it = iteratorFromContainer(val->val.binary.data, (*it)->dict, *it);
 				goto recurse;
 			}
 			else
@@ -1042,26 +1515,30 @@ recurse:
 }
 
 /*
- * Initialize an iterator for iterating all elements in a container.
+ * Initialize an iterator for iterating all elements in a container, which
+ * belongs to dictionary "dict" unless it's a root container saying otherwise.
  */
 static JsonbcIterator *
-iteratorFromContainer(JsonbcContainer *container, JsonbcIterator *parent)
+iteratorFromContainer(JsonbcContainer *container, int32 dict,
+					  JsonbcIterator *parent)
 {
 	JsonbcIterator *it;
 	uint32			header;
 	unsigned char  *ptr;
 
+	it = palloc(sizeof(JsonbcIterator));
+
 	ptr = (unsigned char *)container->data;
-	header = decode_varbyte(&ptr);
+	header = decodeContainerHeader(&ptr, &dict, &it->count);
 
-	it = palloc(sizeof(JsonbcIterator));
 	it->container = container;
 	it->parent = parent;
+	it->keyIds = parent ? parent->keyIds : false;
+	it->dict = dict;
 	it->childrenSize = (header >> JB_CSHIFT);
 
 	/* Array starts just after header */
 	it->children = ptr;
-	it->chunkEnd = ptr + JB_OFFSETS_CHUNK_SIZE;
 	it->dataProper = (char *)(ptr + it->childrenSize);
 
 	switch (header & JB_MASK)
@@ -1177,6 +1654,7 @@ JsonbcDeepContains(JsonbcIterator **val, JsonbcIterator **mContained)
 
 			/* First, find value by key... */
 			lhsVal = findJsonbcValueFromContainer((*val)->container,
+												 (*val)->dict,
 												 JB_FOBJECT,
 												 &vcontained);
 
@@ -1213,8 +1691,10 @@ JsonbcDeepContains(JsonbcIterator **val, JsonbcIterator **mContained)
 				Assert(lhsVal->type == jbvBinary);
 				Assert(vcontained.type == jbvBinary);
 
-				nestval = JsonbcIteratorInit(lhsVal->val.binary.data);
-				nestContained = JsonbcIteratorInit(vcontained.val.binary.data);
+				nestval = JsonbcIteratorInitDict(lhsVal->val.binary.data,
+												 lhsVal->val.binary.dict);
+				nestContained = JsonbcIteratorInitDict(vcontained.val.binary.data,
+													   vcontained.val.binary.dict);
 
 				/*
 				 * Match "value" side of rhs datum object's pair recursively.
@@ -1280,6 +1760,7 @@ JsonbcDeepContains(JsonbcIterator **val, JsonbcIterator **mContained)
 			if (IsAJsonbcScalar(&vcontained))
 			{
 				if (!findJsonbcValueFromContainer((*val)->container,
+												 (*val)->dict,
 												 JB_FARRAY,
 												 &vcontained))
 					return false;
@@ -1325,8 +1806,10 @@ JsonbcDeepContains(JsonbcIterator **val, JsonbcIterator **mContained)
 							   *nestContained;
 					bool		contains;
 
-					nestval = JsonbcIteratorInit(lhsConts[i].val.binary.data);
-					nestContained = JsonbcIteratorInit(vcontained.val.binary.data);
+					nestval = JsonbcIteratorInitDict(lhsConts[i].val.binary.data,
+													 lhsConts[i].val.binary.dict);
+					nestContained = JsonbcIteratorInitDict(vcontained.val.binary.data,
+													   vcontained.val.binary.dict);
 
 					contains = JsonbcDeepContains(&nestval, &nestContained);
 
@@ -1401,6 +1884,20 @@ JsonbcHashScalarValue(const JsonbcValue *scalarVal, uint32 *hash)
 	*hash ^= tmp;
 }
 
+/*
+ * Can two jbvString values be compared by their dictionary ids?  Names are
+ * unique within a dictionary, so equal ids mean equal strings.  Not the
+ * other way around: while the dictionary is renumbered, values not
+ * rewritten yet have the previous ids.
+ */
+static bool
+stringIdsComparable(JsonbcValue *a, JsonbcValue *b)
+{
+	return a->val.string.id != InvalidKeyId &&
+		b->val.string.id != InvalidKeyId &&
+		a->val.string.dict == b->val.string.dict;
+}
+
 /*
  * Are two scalar JsonbcValues of the same type a and b equal?
  */
@@ -1414,6 +1911,9 @@ equalsJsonbcScalarValue(JsonbcValue *aScalar, JsonbcValue *bScalar)
 			case jbvNull:
 				return true;
 			case jbvString:
+				if (stringIdsComparable(aScalar, bScalar) &&
+					aScalar->val.string.id == bScalar->val.string.id)
+					return true;
 				return lengthCompareJsonbcStringValue(aScalar, bScalar) == 0;
 			case jbvNumeric:
 				return DatumGetBool(DirectFunctionCall2(numeric_eq,
@@ -1446,6 +1946,9 @@ compareJsonbcScalarValue(JsonbcValue *aScalar, JsonbcValue *bScalar)
 			case jbvNull:
 				return 0;
 			case jbvString:
+				if (stringIdsComparable(aScalar, bScalar) &&
+					aScalar->val.string.id == bScalar->val.string.id)
+					return 0;
 				return varstr_cmp(aScalar->val.string.val,
 								  aScalar->val.string.len,
 								  bScalar->val.string.val,
@@ -1550,25 +2053,51 @@ padBufferToInt(StringInfo buffer)
 #endif
 
 /*
- * Given a JsonbcValue, convert to Jsonbc. The result is palloc'd.
+ * Given a JsonbcValue, convert to Jsonbc with keys from dictionary "dict".
+ * The result is palloc'd.
+ *
+ * The conversion takes two passes over the value.  The first one computes
+ * the size of every container, so that the second one can allocate the
+ * result at once, and write each container's header and offsets in front
+ * of its children without having to move them afterwards.
  */
 static Jsonbc *
-convertToJsonbc(JsonbcValue *val)
+convertToJsonbc(JsonbcValue *val, int32 dict)
 {
 	StringInfoData buffer;
+	ContainerSizes sizes;
 	JEntry		jentry;
 	Jsonbc	   *res;
+	unsigned char prefix[MAX_VARBYTE_SIZE],
+			   *ptr = prefix;
+	Size		totallen;
 
 	/* Should not already have binary representation */
 	Assert(val->type != jbvBinary);
 
-	/* Allocate an output buffer. It will be enlarged as needed */
+	resolveJsonbcKeys(val, dict);
+
+	if (dict != DefaultDictId)
+		encode_varbyte(((uint32) dict << JB_CSHIFT) | JB_FEXT, &ptr);
+
+	sizes.nSizes = 0;
+	sizes.maxSizes = 16;
+	sizes.sizes = (ContainerSize *) palloc(sizeof(ContainerSize) * sizes.maxSizes);
+	sizes.next = 0;
+
+	jentry = sizeJsonbcValue(&sizes, val, 0);
+	totallen = VARHDRSZ + (ptr - prefix) + JBE_OFFLENFLD(jentry);
+
+	/* Allocate the output buffer, it's not going to be enlarged */
 	initStringInfo(&buffer);
+	enlargeStringInfo(&buffer, totallen);
 
 	/* Make room for the varlena header */
 	reserveFromBuffer(&buffer, VARHDRSZ);
 
-	convertJsonbcValue(&buffer, &jentry, val, 0);
+	appendToBuffer(&buffer, (char *) prefix, ptr - prefix);
+
+	convertJsonbcValue(&buffer, &sizes, &jentry, val, 0);
 
 	/*
 	 * Note: the JEntry of the root is discarded. Therefore the root
@@ -1576,6 +2105,10 @@ convertToJsonbc(JsonbcValue *val)
 	 * of value it is.
 	 */
 
+	Assert(buffer.len == totallen);
+	Assert(sizes.next == sizes.nSizes);
+	pfree(sizes.sizes);
+
 	res = (Jsonbc *) buffer.data;
 
 	SET_VARSIZE(res, buffer.len);
@@ -1584,88 +2117,79 @@ convertToJsonbc(JsonbcValue *val)
 }
 
 /*
- * Subroutine of convertJsonbc: serialize a single JsonbcValue into buffer.
- *
- * The JEntry header for this node is returned in *header.  It is filled in
- * with the length of this value and appropriate type bits.  If we wish to
- * store an end offset rather than a length, it is the caller's responsibility
- * to adjust for that.
- *
- * If the value is an array or an object, this recurses. 'level' is only used
- * for debugging purposes.
+ * Subroutine of convertToJsonbc: compute the JEntry of a single JsonbcValue
+ * without serializing it, recording the sizes of the containers in it.
+ * Containers are recorded in the order convertJsonbcValue() visits them.
  */
-static void
-convertJsonbcValue(StringInfo buffer, JEntry *header, JsonbcValue *val, int level)
+static JEntry
+sizeJsonbcValue(ContainerSizes *sizes, JsonbcValue *val, int level)
 {
 	check_stack_depth();
 
-	if (!val)
-		return;
-
-	/*
-	 * A JsonbcValue passed as val should never have a type of jbvBinary, and
-	 * neither should any of its sub-components. Those values will be produced
-	 * by convertJsonbcArray and convertJsonbcObject, the results of which will
-	 * not be passed back to this function as an argument.
-	 */
-
 	if (IsAJsonbcScalar(val))
-		convertJsonbcScalar(buffer, header, val);
+		return sizeJsonbcScalar(val);
 	else if (val->type == jbvArray)
-		convertJsonbcArray(buffer, header, val, level);
+		return sizeJsonbcArray(sizes, val, level);
 	else if (val->type == jbvObject)
-		convertJsonbcObject(buffer, header, val, level);
+		return sizeJsonbcObject(sizes, val, level);
 	else
 		elog(ERROR, "unknown type of jsonbc container");
+
+	return 0;					/* keep compiler quiet */
 }
 
-static void
-convertJsonbcArray(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int level)
+/*
+ * Reserve the next entry of "sizes", to be filled in once the container is
+ * sized.
+ */
+static int
+newContainerSize(ContainerSizes *sizes)
 {
-	int			base_offset;
-	int			i;
-	int			totallen, offsets_len;
-	unsigned char *offsets, *ptr, *chunk_end;
-	JEntry		header;
-
-	int			nElems = val->val.array.nElems;
+	if (sizes->nSizes >= sizes->maxSizes)
+	{
+		sizes->maxSizes *= 2;
+		sizes->sizes = (ContainerSize *) repalloc(sizes->sizes,
+									sizeof(ContainerSize) * sizes->maxSizes);
+	}
 
-	offsets_len = MAX_VARBYTE_SIZE * nElems;
-	offsets_len += offsets_len / (JB_OFFSETS_CHUNK_SIZE - MAX_VARBYTE_SIZE + 1) * (2 * MAX_VARBYTE_SIZE);
+	return sizes->nSizes++;
+}
 
-	offsets = (unsigned char *)palloc(offsets_len);
+/*
+ * Record the size of a container, and return its JEntry.
+ */
+static JEntry
+setContainerSize(ContainerSizes *sizes, int index, int offsetsLen, int totallen)
+{
+	sizes->sizes[index].offsetsLen = offsetsLen;
+	sizes->sizes[index].totalLen = totallen;
 
-	/* Remember where in the buffer this array starts. */
-	base_offset = buffer->len;
+	return JENTRY_ISCONTAINER | (totallen << JENTRY_SHIFT);
+}
 
-	/* Reserve space for the JEntries of the elements. */
-	ptr = offsets;
-	chunk_end = offsets + JB_OFFSETS_CHUNK_SIZE;
+static JEntry
+sizeJsonbcArray(ContainerSizes *sizes, JsonbcValue *val, int level)
+{
+	int			index = newContainerSize(sizes);
+	int			nElems = val->val.array.nElems;
+	int			totallen = 0,
+				pos = 0,
+				chunk_end = JB_OFFSETS_CHUNK_SIZE;
+	int			i;
 
-	totallen = 0;
 	for (i = 0; i < nElems; i++)
 	{
-		JsonbcValue *elem = &val->val.array.elems[i];
-		int			len;
-		JEntry		meta;
-
-		/*
-		 * Convert element, producing a JEntry and appending its
-		 * variable-length data to buffer
-		 */
-		convertJsonbcValue(buffer, &meta, elem, level + 1);
+		JEntry		meta = sizeJsonbcValue(sizes, &val->val.array.elems[i],
+										   level + 1);
 
-		if (ptr + varbyte_size(meta) > chunk_end)
+		/* Must match the layout convertJsonbcArray() writes */
+		if (pos + varbyte_size(meta) > chunk_end)
 		{
-			memset(ptr, 0, chunk_end - ptr);
-			ptr = chunk_end;
-			encode_varbyte(i, &ptr);
-			encode_varbyte(totallen, &ptr);
+			pos = chunk_end + varbyte_size(i) + varbyte_size(totallen);
 			chunk_end += JB_OFFSETS_CHUNK_SIZE;
 		}
 
-		len = JBE_OFFLENFLD(meta);
-		totallen += len;
+		totallen += JBE_OFFLENFLD(meta);
 
 		/*
 		 * Bail out if total variable-length data exceeds what will fit in a
@@ -1678,34 +2202,10 @@ convertJsonbcArray(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int lev
 					 errmsg("total size of jsonbc array elements exceeds the maximum of %u bytes",
 							JENTRY_OFFLENMASK)));
 
-		encode_varbyte(meta, &ptr);
-	}
-
-	offsets_len = ptr - offsets;
-	header = (offsets_len << JB_CSHIFT);
-
-	if (val->val.array.rawScalar)
-	{
-		Assert(nElems == 1);
-		Assert(level == 0);
-		header |= JB_FSCALAR;
-	}
-	else
-	{
-		header |= JB_FARRAY;
+		pos += varbyte_size(meta);
 	}
 
-	offsets_len += varbyte_size(header);
-
-	reserveFromBuffer(buffer, offsets_len);
-	memmove(buffer->data + base_offset + offsets_len, buffer->data + base_offset, buffer->len - base_offset - offsets_len);
-
-	ptr = (unsigned char *)buffer->data + base_offset;
-	encode_varbyte(header, &ptr);
-	memcpy(ptr, offsets, offsets_len - varbyte_size(header));
-
-	/* Total data size is everything we've appended to buffer */
-	totallen = buffer->len - base_offset;
+	totallen += containerHeaderSize(((uint32) pos << JB_CSHIFT) | JB_FARRAY, nElems) + pos;
 
 	/* Check length again, since we didn't include the metadata above */
 	if (totallen > JENTRY_OFFLENMASK)
@@ -1714,62 +2214,42 @@ convertJsonbcArray(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int lev
 				 errmsg("total size of jsonbc array elements exceeds the maximum of %u bytes",
 						JENTRY_OFFLENMASK)));
 
-	/* Initialize the header of this node in the container's JEntry array */
-	*pheader = JENTRY_ISCONTAINER | (totallen << JENTRY_SHIFT);
+	return setContainerSize(sizes, index, pos, totallen);
 }
 
-static void
-convertJsonbcObject(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int level)
+static JEntry
+sizeJsonbcObject(ContainerSizes *sizes, JsonbcValue *val, int level)
 {
-	int			base_offset;
-	int			i;
-	int			totallen, offsets_len;
-	unsigned char *offsets, *ptr, *chunk_end;
-	JEntry		header;
+	int			index = newContainerSize(sizes);
 	int			nPairs = val->val.object.nPairs;
-	uint32		prev_key;
-
-	/* Remember where in the buffer this object starts. */
-	base_offset = buffer->len;
-
-	offsets_len = MAX_VARBYTE_SIZE * nPairs * 2;
-	offsets_len += offsets_len / (JB_OFFSETS_CHUNK_SIZE - 2 * MAX_VARBYTE_SIZE + 1) * (2 * MAX_VARBYTE_SIZE);
-
-	offsets = (unsigned char *) palloc(offsets_len);
-	ptr = offsets;
-	chunk_end = offsets + JB_OFFSETS_CHUNK_SIZE;
+	int			totallen = 0,
+				pos = 0,
+				chunk_end = JB_OFFSETS_CHUNK_SIZE;
+	uint32		prev_key = 0;
+	int			i;
 
-	/*
-	 * Iterate over the keys, then over the values, since that is the ordering
-	 * we want in the on-disk representation.
-	 */
-	totallen = 0;
-	prev_key = 0;
 	for (i = 0; i < nPairs; i++)
 	{
 		JsonbcPair  *pair = &val->val.object.pairs[i];
-		int			len;
 		JEntry		meta;
+		int			len;
 
-		/*
-		 * Convert value, producing a JEntry and appending its variable-length
-		 * data to buffer
-		 */
-		convertJsonbcValue(buffer, &meta, &pair->value, level + 1);
+		if (pair->valueId != InvalidKeyId)
+			meta = JENTRY_ISSTRINGID | (varbyte_size(pair->valueId) << JENTRY_SHIFT);
+		else
+			meta = sizeJsonbcValue(sizes, &pair->value, level + 1);
 
 		Assert(pair->key > prev_key);
 
-		if (ptr + varbyte_size(pair->key - prev_key) + varbyte_size(meta) > chunk_end)
+		/* Must match the layout convertJsonbcObject() writes */
+		len = varbyte_size(pair->key - prev_key) + varbyte_size(meta);
+		if (pos + len > chunk_end)
 		{
-			memset(ptr, 0, chunk_end - ptr);
-			ptr = chunk_end;
-			encode_varbyte(prev_key, &ptr);
-			encode_varbyte(totallen, &ptr);
+			pos = chunk_end + varbyte_size(prev_key) + varbyte_size(totallen);
 			chunk_end += JB_OFFSETS_CHUNK_SIZE;
 		}
 
-		len = JBE_OFFLENFLD(meta);
-		totallen += len;
+		totallen += JBE_OFFLENFLD(meta);
 
 		/*
 		 * Bail out if total variable-length data exceeds what will fit in a
@@ -1782,26 +2262,11 @@ convertJsonbcObject(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int le
 					 errmsg("total size of jsonbc object elements exceeds the maximum of %u bytes",
 							JENTRY_OFFLENMASK)));
 
-		encode_varbyte(pair->key - prev_key, &ptr);
-		encode_varbyte(meta, &ptr);
-
+		pos += len;
 		prev_key = pair->key;
 	}
 
-	offsets_len = ptr - offsets;
-	header = (offsets_len << JB_CSHIFT) | JB_FOBJECT;
-	offsets_len += varbyte_size(header);
-
-	reserveFromBuffer(buffer, offsets_len);
-	memmove(buffer->data + base_offset + offsets_len, buffer->data + base_offset,
-			buffer->len - base_offset - offsets_len);
-
-	ptr = (unsigned char *)buffer->data + base_offset;
-	encode_varbyte(header, &ptr);
-	memcpy(ptr, offsets, offsets_len - varbyte_size(header));
-
-	/* Total data size is everything we've appended to buffer */
-	totallen = buffer->len - base_offset;
+	totallen += containerHeaderSize(((uint32) pos << JB_CSHIFT) | JB_FOBJECT, nPairs) + pos;
 
 	/* Check length again, since we didn't include the metadata above */
 	if (totallen > JENTRY_OFFLENMASK)
@@ -1810,94 +2275,327 @@ convertJsonbcObject(StringInfo buffer, JEntry *pheader, JsonbcValue *val, int le
 				 errmsg("total size of jsonbc object elements exceeds the maximum of %u bytes",
 						JENTRY_OFFLENMASK)));
 
-	/* Initialize the header of this node in the container's JEntry array */
-	*pheader = JENTRY_ISCONTAINER | (totallen << JENTRY_SHIFT);
+	return setContainerSize(sizes, index, pos, totallen);
 }
 
-static void
-convertJsonbcScalar(StringInfo buffer, JEntry *jentry, JsonbcValue *scalarVal)
+static JEntry
+sizeJsonbcScalar(JsonbcValue *scalarVal)
 {
-	int			numlen;
-	short		padlen = 0;
 	uint32		small;
 
 	switch (scalarVal->type)
 	{
 		case jbvNull:
-			*jentry = JENTRY_ISNULL;
-			break;
+			return JENTRY_ISNULL;
 
 		case jbvString:
-			appendToBuffer(buffer, scalarVal->val.string.val, scalarVal->val.string.len);
-
-			*jentry = JENTRY_ISSTRING | (scalarVal->val.string.len << JENTRY_SHIFT);
-			break;
+			return JENTRY_ISSTRING | (scalarVal->val.string.len << JENTRY_SHIFT);
 
 		case jbvNumeric:
 			if (numeric_get_small(scalarVal->val.numeric, &small))
-			{
-				int size = varbyte_size(small);
-				unsigned char *ptr;
-
-				reserveFromBuffer(buffer, size);
-				ptr = (unsigned char *)buffer->data + buffer->len - size;
-				encode_varbyte(small, &ptr);
-
-				*jentry = JENTRY_ISINTEGER | (size << JENTRY_SHIFT);
-			}
-			else
-			{
-				numlen = VARSIZE_ANY(scalarVal->val.numeric);
-				/*padlen = padBufferToInt(buffer);*/
-
-				appendToBuffer(buffer, (char *) scalarVal->val.numeric, numlen);
-
-				*jentry = JENTRY_ISNUMERIC | ((padlen + numlen) << JENTRY_SHIFT);
-			}
-			break;
+				return JENTRY_ISINTEGER | (varbyte_size(small) << JENTRY_SHIFT);
+			return JENTRY_ISNUMERIC |
+				(VARSIZE_ANY(scalarVal->val.numeric) << JENTRY_SHIFT);
 
 		case jbvBool:
-			*jentry = (scalarVal->val.boolean) ?
+			return (scalarVal->val.boolean) ?
 				JENTRY_ISBOOL_TRUE : JENTRY_ISBOOL_FALSE;
-			break;
 
 		default:
 			elog(ERROR, "invalid jsonbc scalar type");
 	}
+
+	return 0;					/* keep compiler quiet */
 }
 
 /*
- * Compare two jbvString JsonbcValue values, a and b.
+ * Subroutine of convertToJsonbc: serialize a single JsonbcValue into buffer.
  *
- * This is a special qsort() comparator used to sort strings in certain
- * internal contexts where it is sufficient to have a well-defined sort order.
- * In particular, object pair keys are sorted according to this criteria to
- * facilitate cheap binary searches where we don't care about lexical sort
- * order.
+ * The JEntry header for this node is returned in *header.  It is filled in
+ * with the length of this value and appropriate type bits.  If we wish to
+ * store an end offset rather than a length, it is the caller's responsibility
+ * to adjust for that.
  *
- * a and b are first sorted based on their length.  If a tie-breaker is
- * required, only then do we consider string binary equality.
+ * If the value is an array or an object, this recurses, taking the sizes of
+ * the containers from "sizes", as computed by sizeJsonbcValue(). 'level' is
+ * only used for debugging purposes.
  */
-static int
-lengthCompareJsonbcStringValue(const void *a, const void *b)
+static void
+convertJsonbcValue(StringInfo buffer, ContainerSizes *sizes, JEntry *header,
+				   JsonbcValue *val, int level)
 {
-	const JsonbcValue *va = (const JsonbcValue *) a;
-	const JsonbcValue *vb = (const JsonbcValue *) b;
-	int			res;
+	check_stack_depth();
 
-	Assert(va->type == jbvString);
-	Assert(vb->type == jbvString);
+	if (!val)
+		return;
 
-	if (va->val.string.len == vb->val.string.len)
-	{
-		res = memcmp(va->val.string.val, vb->val.string.val, va->val.string.len);
-	}
-	else
-	{
-		res = (va->val.string.len > vb->val.string.len) ? 1 : -1;
-	}
+	/*
+	 * A JsonbcValue passed as val should never have a type of jbvBinary, and
+	 * neither should any of its sub-components. Those values will be produced
+	 * by convertJsonbcArray and convertJsonbcObject, the results of which will
+	 * not be passed back to this function as an argument.
+	 */
 
-	return res;
+	if (IsAJsonbcScalar(val))
+		convertJsonbcScalar(buffer, header, val);
+	else if (val->type == jbvArray)
+		convertJsonbcArray(buffer, sizes, header, val, level);
+	else if (val->type == jbvObject)
+		convertJsonbcObject(buffer, sizes, header, val, level);
+	else
+		elog(ERROR, "unknown type of jsonbc container");
+}
+
+static void
+convertJsonbcArray(StringInfo buffer, ContainerSizes *sizes, JEntry *pheader,
+				   JsonbcValue *val, int level)
+{
+	ContainerSize *size = &sizes->sizes[sizes->next++];
+	int			base_offset;
+	int			i;
+	int			totallen;
+	int			offsets,
+				pos,
+				chunk_end;
+	unsigned char *ptr;
+	JEntry		header;
+
+	int			nElems = val->val.array.nElems;
+
+	header = (size->offsetsLen << JB_CSHIFT);
+
+	if (val->val.array.rawScalar)
+	{
+		Assert(nElems == 1);
+		Assert(level == 0);
+		header |= JB_FSCALAR;
+	}
+	else
+	{
+		header |= JB_FARRAY;
+	}
+
+	/* Remember where in the buffer this array starts. */
+	base_offset = buffer->len;
+
+	/* Write the header, and reserve space for the JEntries of the elements. */
+	offsets = reserveFromBuffer(buffer, containerHeaderSize(header, nElems) +
+								size->offsetsLen);
+	ptr = (unsigned char *) buffer->data + offsets;
+	encodeContainerHeader(header, nElems, &ptr);
+	offsets = ptr - (unsigned char *) buffer->data;
+
+	pos = offsets;
+	chunk_end = offsets + JB_OFFSETS_CHUNK_SIZE;
+
+	totallen = 0;
+	for (i = 0; i < nElems; i++)
+	{
+		JsonbcValue *elem = &val->val.array.elems[i];
+		JEntry		meta;
+
+		/*
+		 * Convert element, producing a JEntry and appending its
+		 * variable-length data to buffer
+		 */
+		convertJsonbcValue(buffer, sizes, &meta, elem, level + 1);
+
+		ptr = (unsigned char *) buffer->data + pos;
+		if (pos + varbyte_size(meta) > chunk_end)
+		{
+			memset(ptr, 0, chunk_end - pos);
+			ptr = (unsigned char *) buffer->data + chunk_end;
+			encode_varbyte(i, &ptr);
+			encode_varbyte(totallen, &ptr);
+			chunk_end += JB_OFFSETS_CHUNK_SIZE;
+		}
+
+		totallen += JBE_OFFLENFLD(meta);
+
+		encode_varbyte(meta, &ptr);
+		pos = ptr - (unsigned char *) buffer->data;
+	}
+
+	Assert(pos - offsets == size->offsetsLen);
+	Assert(buffer->len - base_offset == size->totalLen);
+
+	/* Initialize the header of this node in the container's JEntry array */
+	*pheader = JENTRY_ISCONTAINER | (size->totalLen << JENTRY_SHIFT);
+}
+
+static void
+convertJsonbcObject(StringInfo buffer, ContainerSizes *sizes, JEntry *pheader,
+					JsonbcValue *val, int level)
+{
+	ContainerSize *size = &sizes->sizes[sizes->next++];
+	int			base_offset;
+	int			i;
+	int			totallen;
+	int			offsets,
+				pos,
+				chunk_end;
+	unsigned char *ptr;
+	JEntry		header;
+	int			nPairs = val->val.object.nPairs;
+	uint32		prev_key;
+
+	header = (size->offsetsLen << JB_CSHIFT) | JB_FOBJECT;
+
+	/* Remember where in the buffer this object starts. */
+	base_offset = buffer->len;
+
+	/* Write the header, and reserve space for the JEntries of the pairs. */
+	offsets = reserveFromBuffer(buffer, containerHeaderSize(header, nPairs) +
+								size->offsetsLen);
+	ptr = (unsigned char *) buffer->data + offsets;
+	encodeContainerHeader(header, nPairs, &ptr);
+	offsets = ptr - (unsigned char *) buffer->data;
+
+	pos = offsets;
+	chunk_end = offsets + JB_OFFSETS_CHUNK_SIZE;
+
+	totallen = 0;
+	prev_key = 0;
+	for (i = 0; i < nPairs; i++)
+	{
+		JsonbcPair  *pair = &val->val.object.pairs[i];
+		JEntry		meta;
+
+		/*
+		 * Convert value, producing a JEntry and appending its variable-length
+		 * data to buffer
+		 */
+		if (pair->valueId != InvalidKeyId)
+			convertJsonbcStringId(buffer, &meta, pair->valueId);
+		else
+			convertJsonbcValue(buffer, sizes, &meta, &pair->value, level + 1);
+
+		ptr = (unsigned char *) buffer->data + pos;
+		if (pos + varbyte_size(pair->key - prev_key) + varbyte_size(meta) > chunk_end)
+		{
+			memset(ptr, 0, chunk_end - pos);
+			ptr = (unsigned char *) buffer->data + chunk_end;
+			encode_varbyte(prev_key, &ptr);
+			encode_varbyte(totallen, &ptr);
+			chunk_end += JB_OFFSETS_CHUNK_SIZE;
+		}
+
+		totallen += JBE_OFFLENFLD(meta);
+
+		encode_varbyte(pair->key - prev_key, &ptr);
+		encode_varbyte(meta, &ptr);
+		pos = ptr - (unsigned char *) buffer->data;
+
+		prev_key = pair->key;
+	}
+
+	Assert(pos - offsets == size->offsetsLen);
+	Assert(buffer->len - base_offset == size->totalLen);
+
+	/* Initialize the header of this node in the container's JEntry array */
+	*pheader = JENTRY_ISCONTAINER | (size->totalLen << JENTRY_SHIFT);
+}
+
+static void
+convertJsonbcScalar(StringInfo buffer, JEntry *jentry, JsonbcValue *scalarVal)
+{
+	int			numlen;
+	short		padlen = 0;
+	uint32		small;
+
+	switch (scalarVal->type)
+	{
+		case jbvNull:
+			*jentry = JENTRY_ISNULL;
+			break;
+
+		case jbvString:
+			appendToBuffer(buffer, scalarVal->val.string.val, scalarVal->val.string.len);
+
+			*jentry = JENTRY_ISSTRING | (scalarVal->val.string.len << JENTRY_SHIFT);
+			break;
+
+		case jbvNumeric:
+			if (numeric_get_small(scalarVal->val.numeric, &small))
+			{
+				int size = varbyte_size(small);
+				unsigned char *ptr;
+
+				reserveFromBuffer(buffer, size);
+				ptr = (unsigned char *)buffer->data + buffer->len - size;
+				encode_varbyte(small, &ptr);
+
+				*jentry = JENTRY_ISINTEGER | (size << JENTRY_SHIFT);
+			}
+			else
+			{
+				numlen = VARSIZE_ANY(scalarVal->val.numeric);
+				/*padlen = padBufferToInt(buffer);*/
+
+				appendToBuffer(buffer, (char *) scalarVal->val.numeric, numlen);
+
+				*jentry = JENTRY_ISNUMERIC | ((padlen + numlen) << JENTRY_SHIFT);
+			}
+			break;
+
+		case jbvBool:
+			*jentry = (scalarVal->val.boolean) ?
+				JENTRY_ISBOOL_TRUE : JENTRY_ISBOOL_FALSE;
+			break;
+
+		default:
+			elog(ERROR, "invalid jsonbc scalar type");
+	}
+}
+
+/*
+ * Serialize a string value as its dictionary id.
+ */
+static void
+convertJsonbcStringId(StringInfo buffer, JEntry *jentry, int32 id)
+{
+	int			size = varbyte_size(id);
+	unsigned char *ptr;
+
+	reserveFromBuffer(buffer, size);
+	ptr = (unsigned char *)buffer->data + buffer->len - size;
+	encode_varbyte(id, &ptr);
+
+	*jentry = JENTRY_ISSTRINGID | (size << JENTRY_SHIFT);
+}
+
+/*
+ * Compare two jbvString JsonbcValue values, a and b.
+ *
+ * This is a special qsort() comparator used to sort strings in certain
+ * internal contexts where it is sufficient to have a well-defined sort order.
+ * In particular, object pair keys are sorted according to this criteria to
+ * facilitate cheap binary searches where we don't care about lexical sort
+ * order.
+ *
+ * a and b are first sorted based on their length.  If a tie-breaker is
+ * required, only then do we consider string binary equality.
+ */
+static int
+lengthCompareJsonbcStringValue(const void *a, const void *b)
+{
+	const JsonbcValue *va = (const JsonbcValue *) a;
+	const JsonbcValue *vb = (const JsonbcValue *) b;
+	int			res;
+
+	Assert(va->type == jbvString);
+	Assert(vb->type == jbvString);
+
+	if (va->val.string.len == vb->val.string.len)
+	{
+		res = memcmp(va->val.string.val, vb->val.string.val, va->val.string.len);
+	}
+	else
+	{
+		res = (va->val.string.len > vb->val.string.len) ? 1 : -1;
+	}
+
+	return res;
 }
 
 /*
@@ -1960,3 +2658,953 @@ uniqueifyJsonbcObject(JsonbcValue *object)
 		object->val.object.nPairs = res + 1 - object->val.object.pairs;
 	}
 }
+
+/*
+ * resolveJsonbcKeys() worker: collect object keys in document order.
+ */
+static void
+collectJsonbcKeys(JsonbcValue *val, KeyName **names, JsonbcPair ***pairs,
+				  int *count, int *size)
+{
+	int			i;
+
+	check_stack_depth();
+
+	if (val->type == jbvArray)
+	{
+		for (i = 0; i < val->val.array.nElems; i++)
+			collectJsonbcKeys(&val->val.array.elems[i], names, pairs,
+							  count, size);
+	}
+	else if (val->type == jbvObject)
+	{
+		for (i = 0; i < val->val.object.nPairs; i++)
+		{
+			JsonbcPair *pair = &val->val.object.pairs[i];
+
+			if (pair->key != InvalidKeyId)
+			{
+				/* Already resolved, see JsonbcRemapKeys() */
+				collectJsonbcKeys(&pair->value, names, pairs, count, size);
+				continue;
+			}
+
+			if (*count >= *size)
+			{
+				*size *= 2;
+				*names = repalloc(*names, sizeof(KeyName) * *size);
+				*pairs = repalloc(*pairs, sizeof(JsonbcPair *) * *size);
+			}
+			(*names)[*count].s = pair->keyName;
+			(*names)[*count].len = pair->keyLen;
+			(*pairs)[*count] = pair;
+			(*count)++;
+
+			collectJsonbcKeys(&pair->value, names, pairs, count, size);
+		}
+	}
+}
+
+/*
+ * resolveJsonbcKeys() worker: sort and unique-ify all the objects.
+ */
+static void
+uniqueifyJsonbcObjects(JsonbcValue *val)
+{
+	int			i;
+
+	check_stack_depth();
+
+	if (val->type == jbvArray)
+	{
+		for (i = 0; i < val->val.array.nElems; i++)
+			uniqueifyJsonbcObjects(&val->val.array.elems[i]);
+	}
+	else if (val->type == jbvObject)
+	{
+		for (i = 0; i < val->val.object.nPairs; i++)
+			uniqueifyJsonbcObjects(&val->val.object.pairs[i].value);
+		uniqueifyJsonbcObject(val);
+	}
+}
+
+/*
+ * resolveJsonbcKeys() worker: collect string values of the keys whose values
+ * are stored as dictionary ids, see dictEncodesValues().
+ */
+static void
+collectJsonbcValues(JsonbcValue *val, int32 dict, KeyName **names,
+					JsonbcPair ***pairs, int *count, int *size)
+{
+	int			i;
+
+	check_stack_depth();
+
+	if (val->type == jbvArray)
+	{
+		for (i = 0; i < val->val.array.nElems; i++)
+			collectJsonbcValues(&val->val.array.elems[i], dict, names, pairs,
+								count, size);
+	}
+	else if (val->type == jbvObject)
+	{
+		for (i = 0; i < val->val.object.nPairs; i++)
+		{
+			JsonbcPair *pair = &val->val.object.pairs[i];
+
+			if (pair->value.type != jbvString)
+			{
+				collectJsonbcValues(&pair->value, dict, names, pairs,
+									count, size);
+				continue;
+			}
+
+			/*
+			 * Values resolved already come from JsonbcRemapKeys().  Long
+			 * strings are not worth a dictionary entry.
+			 */
+			if (pair->valueId != InvalidKeyId ||
+				pair->value.val.string.len > MAX_DICT_VALUE_LEN ||
+				!dictEncodesValues(dict, pair->key))
+				continue;
+
+			if (*count >= *size)
+			{
+				*size *= 2;
+				*names = repalloc(*names, sizeof(KeyName) * *size);
+				*pairs = repalloc(*pairs, sizeof(JsonbcPair *) * *size);
+			}
+			(*names)[*count].s = pair->value.val.string.val;
+			(*names)[*count].len = pair->value.val.string.len;
+			(*pairs)[*count] = pair;
+			(*count)++;
+		}
+	}
+}
+
+/*
+ * Convert key names of all the objects in the value to ids.
+ *
+ * All the keys are resolved at once, so that a document with many new keys
+ * costs a single dictionary query rather than one query per key.  Then the
+ * objects are sorted by key id, as required by the on-disk format.  Finally
+ * string values of the keys which have their values in the dictionary are
+ * resolved the same way.
+ */
+static void
+resolveJsonbcKeys(JsonbcValue *val, int32 dict)
+{
+	KeyName	   *names;
+	JsonbcPair **pairs;
+	int32	   *ids;
+	int			count = 0,
+				size = 16,
+				i;
+
+	names = palloc(sizeof(KeyName) * size);
+	pairs = palloc(sizeof(JsonbcPair *) * size);
+
+	collectJsonbcKeys(val, &names, &pairs, &count, &size);
+
+	if (count > 0)
+	{
+		ids = palloc(sizeof(int32) * count);
+		getIdsByNames(dict, names, ids, count);
+		for (i = 0; i < count; i++)
+			pairs[i]->key = ids[i];
+		pfree(ids);
+	}
+
+	uniqueifyJsonbcObjects(val);
+
+	count = 0;
+	collectJsonbcValues(val, dict, &names, &pairs, &count, &size);
+
+	if (count > 0)
+	{
+		ids = palloc(sizeof(int32) * count);
+		getIdsByNames(dict, names, ids, count);
+		for (i = 0; i < count; i++)
+			pairs[i]->valueId = ids[i];
+		pfree(ids);
+	}
+
+	pfree(names);
+	pfree(pairs);
+}
+
+/*
+ * Rewrite jsonbc, replacing each key id from mapLow to mapLow + mapSize - 1
+ * with map[id - mapLow].  Other ids are kept.  Objects are re-sorted
+ * according to the new ids.  Strings stored as dictionary ids are remapped
+ * the same way.  Used for renumbering the dictionary, so names are never
+ * looked up: the dictionary might be half-way renumbered.
+ */
+Jsonbc *
+JsonbcRemapKeys(Jsonbc *jb, const int32 *map, int32 mapLow, int mapSize)
+{
+	JsonbcParseState *state = NULL;
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	JsonbcValue *res = NULL;
+	JsonbcIteratorToken r;
+	int32		dict;
+
+	it = JsonbcIteratorInitKeyIds(&jb->root);
+	dict = it->dict;
+
+	while ((r = JsonbcIteratorNext(&it, &v, false)) != WJB_DONE)
+	{
+		if (r == WJB_KEY)
+		{
+			int32		id = JsonbcIteratorKeyId(it);
+			JsonbcValue *object;
+
+			if (id >= mapLow && id - mapLow < mapSize)
+			{
+				if (map[id - mapLow] <= 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("no new id is given for key id %d", id)));
+				id = map[id - mapLow];
+			}
+
+			res = pushJsonbcValue(&state, r, &v);
+			object = &state->contVal;
+			object->val.object.pairs[object->val.object.nPairs].key = id;
+		}
+		else if (r == WJB_VALUE && v.type == jbvString &&
+				 v.val.string.id != InvalidKeyId)
+		{
+			int32		id = v.val.string.id;
+			JsonbcValue *object;
+
+			if (id >= mapLow && id - mapLow < mapSize)
+			{
+				if (map[id - mapLow] <= 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("no new id is given for string id %d", id)));
+				id = map[id - mapLow];
+			}
+
+			res = pushJsonbcValue(&state, r, &v);
+			object = &state->contVal;
+			object->val.object.pairs[object->val.object.nPairs - 1].valueId = id;
+		}
+		else if (r == WJB_BEGIN_ARRAY)
+		{
+			/* Pass raw scalar flag and element count along */
+			res = pushJsonbcValue(&state, r, v.val.array.rawScalar ? &v : NULL);
+		}
+		else
+		{
+			res = pushJsonbcValue(&state, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
+		}
+	}
+
+	return JsonbcValueToJsonbcDict(res, dict);
+}
+
+/*
+ * Re-encode jsonbc with keys from dictionary "dict".  Returns the value
+ * itself if it's already there.
+ */
+Jsonbc *
+JsonbcSetDict(Jsonbc *jb, int32 dict)
+{
+	JsonbcParseState *state = NULL;
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	JsonbcValue *res = NULL;
+	JsonbcIteratorToken r;
+
+	if (JsonbcGetDict(jb) == dict)
+		return jb;
+
+	it = JsonbcIteratorInit(&jb->root);
+
+	while ((r = JsonbcIteratorNext(&it, &v, false)) != WJB_DONE)
+	{
+		if (r == WJB_BEGIN_ARRAY)
+			res = pushJsonbcValue(&state, r, v.val.array.rawScalar ? &v : NULL);
+		else
+			res = pushJsonbcValue(&state, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
+	}
+
+	return JsonbcValueToJsonbcDict(res, dict);
+}
+
+/*
+ * Streaming conversion into Jsonbc.
+ *
+ * pushJsonbcValue() builds the whole JsonbcValue tree before it's converted,
+ * which takes several times the size of the result for large documents.
+ * The encoder is given the document twice instead.
+ *
+ * The first time, only the key names are collected, with
+ * JsonbcEncoderAddKey().  They don't depend on the dictionary, which is
+ * picked by JsonbcEncoderResolveKeys() later on.  Then the string values of
+ * the keys which have their values in the dictionary are collected, with
+ * JsonbcEncoderAddValue().  Each kind is resolved with one dictionary lookup
+ * per document, in document order, so a new key gets the same id as with
+ * convertToJsonbc().
+ *
+ * The second time, JsonbcEncoderPush() takes the same tokens as
+ * pushJsonbcValue() and appends every scalar to the result right away.  Only
+ * the containers still open are tracked: an array lays out its offsets as
+ * its elements arrive, and an object keeps the key id, JEntry and data
+ * offset of its pairs.  When a container ends, the pairs of an object are
+ * sorted by key id, the header and offsets are put in front of the
+ * children, and the state of the container is dropped.  Peak memory is the
+ * size of the result plus that of the containers still open.
+ */
+
+typedef struct EncoderName
+{
+	KeyName		name;			/* hash key, copied into the encoder */
+	int32		id;				/* or InvalidKeyId until it's resolved */
+} EncoderName;
+
+typedef struct EncoderPair
+{
+	int32		key;
+	JEntry		meta;
+	uint32		offset;			/* of the data, from the container start */
+} EncoderPair;
+
+typedef struct EncoderLevel
+{
+	uint32		header;			/* type of the container */
+	int			start;			/* buffer offset of the container */
+	int			nChildren;
+	uint64		datalen;		/* total size of the children */
+	EncoderPair *pairs;			/* pairs of an object, in document order */
+	int			maxPairs;
+	StringInfoData offsets;		/* offsets laid out so far */
+	int			nOffsets;
+	int			chunkEnd;		/* end of the current offsets chunk */
+	uint32		offsetsTotal;	/* size of the children in the offsets */
+	int32		prevKey;
+} EncoderLevel;
+
+struct JsonbcEncoder
+{
+	int32		dict;
+	MemoryContext context;		/* everything but the result */
+	HTAB	   *names;			/* EncoderName of every name collected */
+	EncoderName **pending;		/* names not resolved yet, in document order */
+	int			nPending;
+	int			maxPending;
+	EncoderName *lastKey;		/* key of the pair whose value comes next */
+	bool		resolved;		/* dictionary is picked */
+	StringInfoData buffer;		/* the result */
+	EncoderLevel *levels;		/* containers still open, outermost first */
+	int			nLevels;
+	int			size;
+	bool		done;
+};
+
+#define EncoderIsObject(level_) (((level_)->header & JB_MASK) == JB_FOBJECT)
+
+/*
+ * State of a closed container bigger than this is freed rather than kept for
+ * the next container at the same depth.
+ */
+#define ENCODER_KEEP_PAIRS 64
+#define ENCODER_KEEP_OFFSETS 1024
+
+static uint32
+encoderNameHash(const void *key, Size keysize)
+{
+	const KeyName *name = (const KeyName *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) name->s, name->len));
+}
+
+static int
+encoderNameMatch(const void *key1, const void *key2, Size keysize)
+{
+	const KeyName *name1 = (const KeyName *) key1;
+	const KeyName *name2 = (const KeyName *) key2;
+
+	if (name1->len != name2->len)
+		return 1;
+
+	return memcmp(name1->s, name2->s, name1->len);
+}
+
+/*
+ * Entry of a name, added to the names to resolve if it's new.
+ */
+static EncoderName *
+encoderAddName(JsonbcEncoder *enc, char *s, int len)
+{
+	EncoderName *entry;
+	KeyName		name;
+	bool		found;
+
+	name.s = s;
+	name.len = len;
+	entry = (EncoderName *) hash_search(enc->names, &name, HASH_ENTER, &found);
+	if (found)
+		return entry;
+
+	entry->name.s = MemoryContextAlloc(enc->context, len);
+	memcpy(entry->name.s, s, len);
+	entry->id = InvalidKeyId;
+
+	if (enc->nPending >= enc->maxPending)
+	{
+		enc->maxPending *= 2;
+		enc->pending = repalloc(enc->pending,
+								sizeof(EncoderName *) * enc->maxPending);
+	}
+	enc->pending[enc->nPending++] = entry;
+
+	return entry;
+}
+
+/*
+ * Begin serializing a value into a Jsonbc.  If "keys" is given, the key names
+ * it collected are collected again, so that a document can be serialized
+ * into several dictionaries with one collecting pass.  "keys" must not be
+ * resolved.
+ */
+JsonbcEncoder *
+JsonbcEncoderInit(JsonbcEncoder *keys)
+{
+	MemoryContext context;
+	MemoryContext oldcontext;
+	JsonbcEncoder *enc;
+	HASHCTL		ctl;
+	int			i;
+
+	context = AllocSetContextCreate(CurrentMemoryContext,
+									"jsonbc encoder",
+									ALLOCSET_DEFAULT_MINSIZE,
+									ALLOCSET_DEFAULT_INITSIZE,
+									ALLOCSET_DEFAULT_MAXSIZE);
+
+	enc = MemoryContextAllocZero(context, sizeof(JsonbcEncoder));
+	enc->context = context;
+
+	oldcontext = MemoryContextSwitchTo(context);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(KeyName);
+	ctl.entrysize = sizeof(EncoderName);
+	ctl.hash = encoderNameHash;
+	ctl.match = encoderNameMatch;
+	ctl.hcxt = context;
+	enc->names = hash_create("jsonbc encoder names", 64, &ctl,
+							 HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	enc->maxPending = 16;
+	enc->pending = palloc(sizeof(EncoderName *) * enc->maxPending);
+	enc->size = 4;
+	enc->levels = palloc0(sizeof(EncoderLevel) * enc->size);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (keys)
+	{
+		Assert(!keys->resolved);
+		for (i = 0; i < keys->nPending; i++)
+			(void) encoderAddName(enc, keys->pending[i]->name.s,
+								  keys->pending[i]->name.len);
+	}
+
+	return enc;
+}
+
+/*
+ * Resolve all the names collected and not resolved yet, in one go.
+ */
+static void
+encoderResolveNames(JsonbcEncoder *enc)
+{
+	KeyName    *names;
+	int32	   *ids;
+	int			i;
+
+	if (enc->nPending == 0)
+		return;
+
+	names = palloc(sizeof(KeyName) * enc->nPending);
+	ids = palloc(sizeof(int32) * enc->nPending);
+
+	for (i = 0; i < enc->nPending; i++)
+		names[i] = enc->pending[i]->name;
+
+	getIdsByNames(enc->dict, names, ids, enc->nPending);
+
+	for (i = 0; i < enc->nPending; i++)
+		enc->pending[i]->id = ids[i];
+	enc->nPending = 0;
+
+	pfree(names);
+	pfree(ids);
+}
+
+/*
+ * Collect the name of a key of the value, before it's pushed.  The name is
+ * copied.
+ */
+void
+JsonbcEncoderAddKey(JsonbcEncoder *enc, char *name, int len)
+{
+	enc->lastKey = encoderAddName(enc, name, len);
+}
+
+/*
+ * Resolve the key names collected in dictionary "dict", which the value is
+ * serialized into.  The result is allocated in the current memory context.
+ * Returns true if string values of some of the keys are stored in the
+ * dictionary, so they should be collected as well, with
+ * JsonbcEncoderAddValue().
+ */
+bool
+JsonbcEncoderResolveKeys(JsonbcEncoder *enc, int32 dict)
+{
+	bool		result = false;
+	int			count = enc->nPending,
+				i;
+
+	Assert(!enc->resolved);
+	enc->dict = dict;
+	enc->resolved = true;
+
+	initStringInfo(&enc->buffer);
+
+	/* Make room for the varlena header */
+	reserveFromBuffer(&enc->buffer, VARHDRSZ);
+
+	encoderResolveNames(enc);
+
+	for (i = 0; i < count && !result; i++)
+		result = dictEncodesValues(enc->dict, enc->pending[i]->id);
+
+	enc->lastKey = NULL;
+
+	return result;
+}
+
+/*
+ * Collect a string value, once the keys are resolved.  It's the value of the
+ * key collected last, which has to be collected again for the purpose.
+ */
+void
+JsonbcEncoderAddValue(JsonbcEncoder *enc, char *value, int len)
+{
+	EncoderName *key = enc->lastKey;
+
+	enc->lastKey = NULL;
+
+	/* Long strings are not worth a dictionary entry */
+	if (!key || len > MAX_DICT_VALUE_LEN || key->id == InvalidKeyId ||
+		!dictEncodesValues(enc->dict, key->id))
+		return;
+
+	(void) encoderAddName(enc, value, len);
+}
+
+/*
+ * Id of a name, which is looked up on its own if it was not collected.
+ * Names collected and not resolved yet are looked up along with it.
+ */
+static int32
+encoderNameId(JsonbcEncoder *enc, char *s, int len)
+{
+	EncoderName *entry = encoderAddName(enc, s, len);
+
+	if (entry->id == InvalidKeyId)
+		encoderResolveNames(enc);
+
+	return entry->id;
+}
+
+/*
+ * JsonbcEncoderPush() worker: add the JEntry of the next child to the
+ * offsets of a container, the same way convertJsonbcArray() and
+ * convertJsonbcObject() lay them out.  Pairs are added in key order.
+ */
+static void
+encoderAddOffset(EncoderLevel *level, int32 key, JEntry meta)
+{
+	StringInfo	offsets = &level->offsets;
+	unsigned char buf[2 * MAX_VARBYTE_SIZE],
+			   *ptr = buf;
+	int			len = varbyte_size(meta);
+
+	if (EncoderIsObject(level))
+	{
+		Assert(key > level->prevKey);
+		len += varbyte_size(key - level->prevKey);
+	}
+
+	if (offsets->len + len > level->chunkEnd)
+	{
+		uint32		first = EncoderIsObject(level) ? level->prevKey : level->nOffsets;
+		int			pad = level->chunkEnd - offsets->len;
+
+		reserveFromBuffer(offsets, pad);
+		memset(offsets->data + offsets->len - pad, 0, pad);
+		encode_varbyte(first, &ptr);
+		encode_varbyte(level->offsetsTotal, &ptr);
+		appendToBuffer(offsets, (char *) buf, ptr - buf);
+		ptr = buf;
+		level->chunkEnd += JB_OFFSETS_CHUNK_SIZE;
+	}
+
+	if (EncoderIsObject(level))
+		encode_varbyte(key - level->prevKey, &ptr);
+	encode_varbyte(meta, &ptr);
+	appendToBuffer(offsets, (char *) buf, ptr - buf);
+
+	level->nOffsets++;
+	level->offsetsTotal += JBE_OFFLENFLD(meta);
+	level->prevKey = key;
+}
+
+/*
+ * JsonbcEncoderPush() worker: error out on a container too big.
+ */
+static void
+encoderCheckSize(EncoderLevel *level, uint64 totallen)
+{
+	if (totallen <= JENTRY_OFFLENMASK)
+		return;
+
+	if (EncoderIsObject(level))
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("total size of jsonbc object elements exceeds the maximum of %u bytes",
+						JENTRY_OFFLENMASK)));
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("total size of jsonbc array elements exceeds the maximum of %u bytes",
+						JENTRY_OFFLENMASK)));
+}
+
+/*
+ * JsonbcEncoderPush() worker: add a child written at the end of the buffer
+ * to the innermost container.  The pair of a value has its key already.
+ */
+static void
+encoderAddChild(JsonbcEncoder *enc, JEntry meta)
+{
+	EncoderLevel *level = &enc->levels[enc->nLevels - 1];
+
+	level->datalen += JBE_OFFLENFLD(meta);
+	encoderCheckSize(level, level->datalen);
+
+	if (EncoderIsObject(level))
+		level->pairs[level->nChildren].meta = meta;
+	else
+		encoderAddOffset(level, InvalidKeyId, meta);
+
+	level->nChildren++;
+}
+
+/*
+ * qsort comparator of EncoderPairs: by key id, the last observed of equal
+ * keys first.
+ */
+static int
+compareEncoderPair(const void *a, const void *b)
+{
+	const EncoderPair *pa = (const EncoderPair *) a;
+	const EncoderPair *pb = (const EncoderPair *) b;
+
+	if (pa->key != pb->key)
+		return (pa->key < pb->key) ? -1 : 1;
+
+	return (pa->offset > pb->offset) ? -1 : 1;
+}
+
+/*
+ * JsonbcEncoderPush() worker: sort and unique-ify the pairs of the innermost
+ * object, and lay out its offsets.  Returns true if the data of the pairs is
+ * still in order.
+ */
+static bool
+encoderSortPairs(EncoderLevel *level)
+{
+	EncoderPair *pairs = level->pairs;
+	bool		inPlace = true;
+	int			i,
+				j;
+
+	if (level->nChildren == 0)
+		return true;
+
+	qsort(pairs, level->nChildren, sizeof(EncoderPair), compareEncoderPair);
+
+	for (i = 1, j = 0; i < level->nChildren; i++)
+	{
+		if (pairs[i].key != pairs[j].key)
+			pairs[++j] = pairs[i];
+		else
+			level->datalen -= JBE_OFFLENFLD(pairs[i].meta);
+	}
+
+	/* The last pair is always kept, so dropping any means reordering */
+	if (j + 1 < level->nChildren)
+		inPlace = false;
+	level->nChildren = j + 1;
+
+	for (i = 0; i < level->nChildren; i++)
+	{
+		if (i > 0 && pairs[i].offset < pairs[i - 1].offset)
+			inPlace = false;
+		encoderAddOffset(level, pairs[i].key, pairs[i].meta);
+	}
+
+	return inPlace;
+}
+
+/*
+ * JsonbcEncoderPush() worker: finish the innermost container, and return
+ * its JEntry.  The state of the container is dropped.
+ */
+static JEntry
+encoderEndContainer(JsonbcEncoder *enc)
+{
+	EncoderLevel *level = &enc->levels[enc->nLevels - 1];
+	StringInfo	buffer = &enc->buffer;
+	bool		inPlace = true;
+	uint32		header;
+	int			headerLen,
+				i;
+	uint64		totallen;
+	unsigned char *ptr;
+
+	if (EncoderIsObject(level))
+		inPlace = encoderSortPairs(level);
+
+	header = ((uint32) level->offsets.len << JB_CSHIFT) | level->header;
+	headerLen = containerHeaderSize(header, level->nChildren) + level->offsets.len;
+	totallen = headerLen + level->datalen;
+	encoderCheckSize(level, totallen);
+
+	if (inPlace)
+	{
+		/* Move the children to make room for the header and offsets */
+		Assert(buffer->len - level->start == level->datalen);
+		reserveFromBuffer(buffer, headerLen);
+		memmove(buffer->data + level->start + headerLen,
+				buffer->data + level->start, level->datalen);
+	}
+	else
+	{
+		char	   *data = palloc(level->datalen),
+				   *p = data;
+
+		/* Collect the pairs in key order, then put them after the offsets */
+		for (i = 0; i < level->nChildren; i++)
+		{
+			EncoderPair *pair = &level->pairs[i];
+
+			memcpy(p, buffer->data + level->start + pair->offset,
+				   JBE_OFFLENFLD(pair->meta));
+			p += JBE_OFFLENFLD(pair->meta);
+		}
+		Assert(p - data == level->datalen);
+
+		buffer->len = level->start;
+		reserveFromBuffer(buffer, headerLen);
+		appendToBuffer(buffer, data, level->datalen);
+		pfree(data);
+	}
+
+	ptr = (unsigned char *) buffer->data + level->start;
+	encodeContainerHeader(header, level->nChildren, &ptr);
+	memcpy(ptr, level->offsets.data, level->offsets.len);
+	Assert(buffer->len - level->start == totallen);
+
+	/* Keep small slots for the next container at this depth */
+	if (level->maxPairs > ENCODER_KEEP_PAIRS)
+	{
+		pfree(level->pairs);
+		level->pairs = NULL;
+		level->maxPairs = 0;
+	}
+	if (level->offsets.maxlen > ENCODER_KEEP_OFFSETS)
+	{
+		pfree(level->offsets.data);
+		level->offsets.data = NULL;
+	}
+
+	enc->nLevels--;
+
+	return JENTRY_ISCONTAINER | ((uint32) totallen << JENTRY_SHIFT);
+}
+
+/*
+ * Add a token to the value being serialized.  The tokens are the same that
+ * pushJsonbcValue() accepts, but values must be scalars.  Strings are copied,
+ * so the caller may free them as soon as this returns.
+ */
+void
+JsonbcEncoderPush(JsonbcEncoder *enc, JsonbcIteratorToken seq,
+				  JsonbcValue *scalarVal)
+{
+	EncoderLevel *level = enc->nLevels > 0 ? &enc->levels[enc->nLevels - 1] : NULL;
+	MemoryContext oldcontext;
+	EncoderPair *pair;
+	JEntry		meta;
+
+	if (!enc->resolved)
+		elog(ERROR, "jsonbc keys are not resolved");
+	if (enc->done)
+		elog(ERROR, "jsonbc value is already complete");
+
+	switch (seq)
+	{
+		case WJB_BEGIN_ARRAY:
+		case WJB_BEGIN_OBJECT:
+			if (level && !EncoderIsObject(level) &&
+				level->nChildren >= JSONB_MAX_ELEMS)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("number of jsonbc array elements exceeds the maximum allowed (%zu)",
+								JSONB_MAX_ELEMS)));
+
+			if (!level && enc->dict != DefaultDictId &&
+				!(seq == WJB_BEGIN_ARRAY && scalarVal &&
+				  scalarVal->val.array.rawScalar))
+			{
+				/* Scalars have no keys, keep them in the default dictionary */
+				unsigned char prefix[MAX_VARBYTE_SIZE],
+						   *ptr = prefix;
+
+				encode_varbyte(((uint32) enc->dict << JB_CSHIFT) | JB_FEXT, &ptr);
+				appendToBuffer(&enc->buffer, (char *) prefix, ptr - prefix);
+			}
+
+			if (enc->nLevels >= enc->size)
+			{
+				enc->levels = repalloc(enc->levels,
+									   sizeof(EncoderLevel) * enc->size * 2);
+				memset(&enc->levels[enc->size], 0,
+					   sizeof(EncoderLevel) * enc->size);
+				enc->size *= 2;
+			}
+			level = &enc->levels[enc->nLevels++];
+			if (seq == WJB_BEGIN_OBJECT)
+				level->header = JB_FOBJECT;
+			else if (enc->nLevels == 1 && scalarVal &&
+					 scalarVal->val.array.rawScalar)
+				level->header = JB_FSCALAR;
+			else
+				level->header = JB_FARRAY;
+			level->start = enc->buffer.len;
+			level->nChildren = 0;
+			level->datalen = 0;
+
+			if (level->offsets.data)
+				resetStringInfo(&level->offsets);
+			else
+			{
+				oldcontext = MemoryContextSwitchTo(enc->context);
+				initStringInfo(&level->offsets);
+				MemoryContextSwitchTo(oldcontext);
+			}
+			level->nOffsets = 0;
+			level->chunkEnd = JB_OFFSETS_CHUNK_SIZE;
+			level->offsetsTotal = 0;
+			level->prevKey = 0;
+			break;
+
+		case WJB_KEY:
+			Assert(level && EncoderIsObject(level));
+			Assert(scalarVal->type == jbvString);
+
+			if (level->nChildren >= JSONB_MAX_PAIRS)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("number of jsonbc object pairs exceeds the maximum allowed (%zu)",
+								JSONB_MAX_PAIRS)));
+
+			if (level->nChildren >= level->maxPairs)
+			{
+				level->maxPairs = Max(level->maxPairs * 2, 16);
+				if (level->pairs)
+					level->pairs = repalloc(level->pairs,
+											sizeof(EncoderPair) * level->maxPairs);
+				else
+					level->pairs = MemoryContextAlloc(enc->context,
+													  sizeof(EncoderPair) * level->maxPairs);
+			}
+
+			/* The value is written next */
+			pair = &level->pairs[level->nChildren];
+			pair->key = encoderNameId(enc, scalarVal->val.string.val,
+									  scalarVal->val.string.len);
+			pair->offset = enc->buffer.len - level->start;
+			break;
+
+		case WJB_VALUE:
+		case WJB_ELEM:
+			Assert(level && EncoderIsObject(level) == (seq == WJB_VALUE));
+
+			if (!IsAJsonbcScalar(scalarVal))
+				elog(ERROR, "jsonbc encoder accepts only scalar values");
+
+			if (seq == WJB_ELEM && level->nChildren >= JSONB_MAX_ELEMS)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("number of jsonbc array elements exceeds the maximum allowed (%zu)",
+								JSONB_MAX_ELEMS)));
+
+			/* Long strings are not worth a dictionary entry */
+			if (seq == WJB_VALUE && scalarVal->type == jbvString &&
+				scalarVal->val.string.len <= MAX_DICT_VALUE_LEN &&
+				dictEncodesValues(enc->dict, level->pairs[level->nChildren].key))
+				convertJsonbcStringId(&enc->buffer, &meta,
+									  encoderNameId(enc, scalarVal->val.string.val,
+													scalarVal->val.string.len));
+			else
+				convertJsonbcScalar(&enc->buffer, &meta, scalarVal);
+
+			encoderAddChild(enc, meta);
+			break;
+
+		case WJB_END_ARRAY:
+		case WJB_END_OBJECT:
+			Assert(level && EncoderIsObject(level) == (seq == WJB_END_OBJECT));
+
+			meta = encoderEndContainer(enc);
+
+			/* The JEntry of the root is discarded */
+			if (enc->nLevels == 0)
+				enc->done = true;
+			else
+				encoderAddChild(enc, meta);
+			break;
+
+		default:
+			elog(ERROR, "unrecognized jsonbc sequential processing token");
+	}
+}
+
+/*
+ * Return the Jsonbc serialized.  The encoder is freed.
+ */
+Jsonbc *
+JsonbcEncoderFinish(JsonbcEncoder *enc)
+{
+	Jsonbc	   *res;
+
+	if (!enc->done)
+		elog(ERROR, "jsonbc value is not complete");
+
+	res = (Jsonbc *) enc->buffer.data;
+	SET_VARSIZE(res, enc->buffer.len);
+
+	MemoryContextDelete(enc->context);
+
+	return res;
+}
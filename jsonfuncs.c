@@ -15,7 +15,9 @@
 #include "postgres.h"
 
 #include <limits.h>
+#include <math.h>
 
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "catalog/pg_type.h"
 #include "fmgr.h"
@@ -29,6 +31,7 @@
 #include "utils/json.h"
 #include "utils/jsonapi.h"
 #include "jsonbc.h"
+#include "dict.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/typcache.h"
@@ -64,6 +67,7 @@ static void alen_array_element_start(void *state, bool isnull);
 static Datum each_worker(FunctionCallInfo fcinfo, bool as_text);
 static Datum each_worker_jsonb(FunctionCallInfo fcinfo, const char *funcname,
 				  bool as_text);
+static Datum each_key_pattern_worker(FunctionCallInfo fcinfo, bool regex);
 
 /* semantic action functions for json_each */
 static void each_object_field_start(void *state, char *fname, bool isnull);
@@ -111,6 +115,7 @@ static Datum populate_recordset_worker(FunctionCallInfo fcinfo, const char *func
 
 /* Worker that takes care of common setup for us */
 static JsonbcValue *findJsonbcValueFromContainerLen(JsonbcContainer *container,
+							   int32 dict,
 							   uint32 flags,
 							   char *key,
 							   uint32 keylen);
@@ -462,7 +467,7 @@ jsonbc_object_field(PG_FUNCTION_ARGS)
 	if (!JB_ROOT_IS_OBJECT(jb))
 		PG_RETURN_NULL();
 
-	v = findJsonbcValueFromContainerLen(&jb->root, JB_FOBJECT,
+	v = findJsonbcValueFromContainerLen(&jb->root, DefaultDictId, JB_FOBJECT,
 									   VARDATA_ANY(key),
 									   VARSIZE_ANY_EXHDR(key));
 
@@ -498,7 +503,7 @@ jsonbc_object_field_text(PG_FUNCTION_ARGS)
 	if (!JB_ROOT_IS_OBJECT(jb))
 		PG_RETURN_NULL();
 
-	v = findJsonbcValueFromContainerLen(&jb->root, JB_FOBJECT,
+	v = findJsonbcValueFromContainerLen(&jb->root, DefaultDictId, JB_FOBJECT,
 									   VARDATA_ANY(key),
 									   VARSIZE_ANY_EXHDR(key));
 
@@ -524,7 +529,8 @@ jsonbc_object_field_text(PG_FUNCTION_ARGS)
 				{
 					StringInfo	jtext = makeStringInfo();
 
-					(void) JsonbcToCString(jtext, v->val.binary.data, -1);
+					(void) JsonbcToCString(jtext, v->val.binary.data,
+										   v->val.binary.dict, -1);
 					result = cstring_to_text_with_len(jtext->data, jtext->len);
 				}
 				break;
@@ -564,7 +570,7 @@ jsonbc_array_element(PG_FUNCTION_ARGS)
 	if (!JB_ROOT_IS_ARRAY(jb))
 		PG_RETURN_NULL();
 
-	v = getIthJsonbcValueFromContainer(&jb->root, element);
+	v = getIthJsonbcValueFromContainer(&jb->root, DefaultDictId, element);
 	if (v != NULL)
 		PG_RETURN_JSONB(JsonbcValueToJsonbc(v));
 
@@ -596,7 +602,7 @@ jsonbc_array_element_text(PG_FUNCTION_ARGS)
 	if (!JB_ROOT_IS_ARRAY(jb))
 		PG_RETURN_NULL();
 
-	v = getIthJsonbcValueFromContainer(&jb->root, element);
+	v = getIthJsonbcValueFromContainer(&jb->root, DefaultDictId, element);
 	if (v != NULL)
 	{
 		text	   *result = NULL;
@@ -619,7 +625,8 @@ jsonbc_array_element_text(PG_FUNCTION_ARGS)
 				{
 					StringInfo	jtext = makeStringInfo();
 
-					(void) JsonbcToCString(jtext, v->val.binary.data, -1);
+					(void) JsonbcToCString(jtext, v->val.binary.data,
+										   v->val.binary.dict, -1);
 					result = cstring_to_text_with_len(jtext->data, jtext->len);
 				}
 				break;
@@ -1105,6 +1112,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 	JsonbcValue *jbvp = NULL;
 	JsonbcValue	tv;
 	JsonbcContainer *container;
+	int32		dict = DefaultDictId;
 
 	/*
 	 * If the array contains any null elements, return NULL, on the grounds
@@ -1131,7 +1139,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 		Assert(JB_ROOT_IS_ARRAY(jb) && JB_ROOT_IS_SCALAR(jb));
 		/* Extract the scalar value, if it is what we'll return */
 		if (npath <= 0)
-			jbvp = getIthJsonbcValueFromContainer(container, 0);
+			jbvp = getIthJsonbcValueFromContainer(container, dict, 0);
 	}
 
 	/*
@@ -1148,6 +1156,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 		{
 			PG_RETURN_TEXT_P(cstring_to_text(JsonbcToCString(NULL,
 															container,
+															dict,
 															VARSIZE(jb))));
 		}
 		else
@@ -1162,6 +1171,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 		if (have_object)
 		{
 			jbvp = findJsonbcValueFromContainerLen(container,
+												  dict,
 												  JB_FOBJECT,
 												  VARDATA_ANY(pathtext[i]),
 											 VARSIZE_ANY_EXHDR(pathtext[i]));
@@ -1179,7 +1189,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 				lindex > INT_MAX || lindex < 0)
 				PG_RETURN_NULL();
 			index = (uint32) lindex;
-			jbvp = getIthJsonbcValueFromContainer(container, index);
+			jbvp = getIthJsonbcValueFromContainer(container, dict, index);
 		}
 		else
 		{
@@ -1194,11 +1204,13 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 
 		if (jbvp->type == jbvBinary)
 		{
-			JsonbcIterator *it = JsonbcIteratorInit((JsonbcContainer *) jbvp->val.binary.data);
+			JsonbcIterator *it = JsonbcIteratorInitDict((JsonbcContainer *) jbvp->val.binary.data,
+														jbvp->val.binary.dict);
 			int			r;
 
 			r = JsonbcIteratorNext(&it, &tv, true);
 			container = (JsonbcContainer *) jbvp->val.binary.data;
+			dict = jbvp->val.binary.dict;
 			have_object = r == WJB_BEGIN_OBJECT;
 			have_array = r == WJB_BEGIN_ARRAY;
 		}
@@ -1225,6 +1237,7 @@ get_jsonbc_path_all(FunctionCallInfo fcinfo, bool as_text)
 	{
 		PG_RETURN_TEXT_P(cstring_to_text(JsonbcToCString(NULL,
 														&res->root,
+														DefaultDictId,
 														VARSIZE(res))));
 	}
 	else
@@ -1459,7 +1472,7 @@ each_worker_jsonb(FunctionCallInfo fcinfo, const char *funcname, bool as_text)
 						StringInfo	jtext = makeStringInfo();
 						Jsonbc	   *jb = JsonbcValueToJsonbc(&v);
 
-						(void) JsonbcToCString(jtext, &jb->root, 0);
+						(void) JsonbcToCString(jtext, &jb->root, DefaultDictId, 0);
 						sv = cstring_to_text_with_len(jtext->data, jtext->len);
 					}
 
@@ -1492,6 +1505,142 @@ each_worker_jsonb(FunctionCallInfo fcinfo, const char *funcname, bool as_text)
 	PG_RETURN_NULL();
 }
 
+/*
+ * SQL functions jsonbc_each_key_like(jsonbc, text) and
+ * jsonbc_each_key_regex(jsonbc, text)
+ *
+ * Like jsonbc_each(), but only the top-level keys matching a LIKE pattern or
+ * a regular expression are returned.  The pattern is expanded against the
+ * dictionary once per query, and only the names of the matching keys are
+ * looked up.  Anything but an object gives an empty set.
+ */
+Datum
+jsonbc_each_key_like(PG_FUNCTION_ARGS)
+{
+	return each_key_pattern_worker(fcinfo, false);
+}
+
+Datum
+jsonbc_each_key_regex(PG_FUNCTION_ARGS)
+{
+	return each_key_pattern_worker(fcinfo, true);
+}
+
+static Datum
+each_key_pattern_worker(FunctionCallInfo fcinfo, bool regex)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	text	   *pattern = PG_GETARG_TEXT_PP(1);
+	ReturnSetInfo *rsi;
+	Tuplestorestate *tuple_store;
+	TupleDesc	tupdesc;
+	TupleDesc	ret_tdesc;
+	MemoryContext old_cxt,
+				tmp_cxt;
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	int			r;
+	int32		dict = JsonbcGetDict(jb);
+	int32	   *ids;
+	int			count,
+				i = 0;
+
+	rsi = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	if (!rsi || !IsA(rsi, ReturnSetInfo) ||
+		(rsi->allowedModes & SFRM_Materialize) == 0 ||
+		rsi->expectedDesc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that "
+						"cannot accept a set")));
+
+	rsi->returnMode = SFRM_Materialize;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	old_cxt = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+
+	ret_tdesc = CreateTupleDescCopy(tupdesc);
+	BlessTupleDesc(ret_tdesc);
+	tuple_store =
+		tuplestore_begin_heap(rsi->allowedModes & SFRM_Materialize_Random,
+							  false, work_mem);
+
+	MemoryContextSwitchTo(old_cxt);
+
+	rsi->setResult = tuple_store;
+	rsi->setDesc = ret_tdesc;
+
+	if (!JB_ROOT_IS_OBJECT(jb) || JB_ROOT_COUNT(jb) == 0)
+		PG_RETURN_NULL();
+
+	ids = JsonbcKeyPatternIds(fcinfo->flinfo, dict, pattern, regex, &count);
+	if (count == 0)
+		PG_RETURN_NULL();
+
+	tmp_cxt = AllocSetContextCreate(CurrentMemoryContext,
+									"jsonbc_each_key temporary cxt",
+									ALLOCSET_DEFAULT_MINSIZE,
+									ALLOCSET_DEFAULT_INITSIZE,
+									ALLOCSET_DEFAULT_MAXSIZE);
+
+	it = JsonbcIteratorInitKeyIds(&jb->root);
+
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		int32		id;
+		KeyName		name;
+		HeapTuple	tuple;
+		Datum		values[2];
+		bool		nulls[2] = {false, false};
+
+		if (r != WJB_KEY)
+			continue;
+
+		/* Keys come in ascending id order, just like the pattern ids */
+		id = JsonbcIteratorKeyId(it);
+		while (i < count && ids[i] < id)
+			i++;
+		if (i >= count)
+			break;
+
+		r = JsonbcIteratorNext(&it, &v, true);
+		if (ids[i] != id)
+			continue;
+
+		old_cxt = MemoryContextSwitchTo(tmp_cxt);
+
+		name = getNameById(dict, id);
+		values[0] = PointerGetDatum(cstring_to_text_with_len(name.s,
+															  name.len));
+
+		/* Strings stored as ids came back without the name */
+		if (v.type == jbvString && v.val.string.id != InvalidKeyId)
+		{
+			name = getNameById(dict, v.val.string.id);
+			v.val.string.val = name.s;
+			v.val.string.len = name.len;
+			v.val.string.id = InvalidKeyId;
+		}
+		values[1] = PointerGetDatum(JsonbcValueToJsonbc(&v));
+
+		tuple = heap_form_tuple(ret_tdesc, values, nulls);
+		tuplestore_puttuple(tuple_store, tuple);
+
+		MemoryContextSwitchTo(old_cxt);
+		MemoryContextReset(tmp_cxt);
+	}
+
+	MemoryContextDelete(tmp_cxt);
+
+	PG_RETURN_NULL();
+}
+
 
 static Datum
 each_worker(FunctionCallInfo fcinfo, bool as_text)
@@ -1773,7 +1922,7 @@ elements_worker_jsonb(FunctionCallInfo fcinfo, const char *funcname,
 						StringInfo	jtext = makeStringInfo();
 						Jsonbc	   *jb = JsonbcValueToJsonbc(&v);
 
-						(void) JsonbcToCString(jtext, &jb->root, 0);
+						(void) JsonbcToCString(jtext, &jb->root, DefaultDictId, 0);
 						sv = cstring_to_text_with_len(jtext->data, jtext->len);
 					}
 
@@ -2191,7 +2340,7 @@ populate_record_worker(FunctionCallInfo fcinfo, const char *funcname,
 		{
 			char	   *key = NameStr(tupdesc->attrs[i]->attname);
 
-			v = findJsonbcValueFromContainerLen(&jb->root, JB_FOBJECT, key,
+			v = findJsonbcValueFromContainerLen(&jb->root, DefaultDictId, JB_FOBJECT, key,
 											   strlen(key));
 		}
 
@@ -2250,7 +2399,8 @@ populate_record_worker(FunctionCallInfo fcinfo, const char *funcname,
 					s = DatumGetCString(DirectFunctionCall1(numeric_out,
 										   PointerGetDatum(v->val.numeric)));
 				else if (v->type == jbvBinary)
-					s = JsonbcToCString(NULL, (JsonbcContainer *) v->val.binary.data, v->val.binary.len);
+					s = JsonbcToCString(NULL, (JsonbcContainer *) v->val.binary.data,
+										v->val.binary.dict, v->val.binary.len);
 				else
 					elog(ERROR, "unrecognized jsonb type: %d", (int) v->type);
 			}
@@ -2494,7 +2644,7 @@ make_row_from_rec_and_jsonb(Jsonbc *element, PopulateRecordsetState *state)
 
 		key = NameStr(tupdesc->attrs[i]->attname);
 
-		v = findJsonbcValueFromContainerLen(&element->root, JB_FOBJECT,
+		v = findJsonbcValueFromContainerLen(&element->root, DefaultDictId, JB_FOBJECT,
 										   key, strlen(key));
 
 		/*
@@ -2543,7 +2693,8 @@ make_row_from_rec_and_jsonb(Jsonbc *element, PopulateRecordsetState *state)
 				s = DatumGetCString(DirectFunctionCall1(numeric_out,
 										   PointerGetDatum(v->val.numeric)));
 			else if (v->type == jbvBinary)
-				s = JsonbcToCString(NULL, (JsonbcContainer *) v->val.binary.data, v->val.binary.len);
+				s = JsonbcToCString(NULL, (JsonbcContainer *) v->val.binary.data,
+										v->val.binary.dict, v->val.binary.len);
 			else
 				elog(ERROR, "unrecognized jsonb type: %d", (int) v->type);
 
@@ -2981,14 +3132,601 @@ populate_recordset_object_field_end(void *state, char *fname, bool isnull)
  * findJsonbcValueFromContainer() wrapper that sets up JsonbcValue key string.
  */
 static JsonbcValue *
-findJsonbcValueFromContainerLen(JsonbcContainer *container, uint32 flags,
-							   char *key, uint32 keylen)
+findJsonbcValueFromContainerLen(JsonbcContainer *container, int32 dict,
+							   uint32 flags, char *key, uint32 keylen)
 {
 	JsonbcValue	k;
 
 	k.type = jbvString;
 	k.val.string.val = key;
 	k.val.string.len = keylen;
+	k.val.string.id = InvalidKeyId;
+
+	return findJsonbcValueFromContainer(container, dict, flags, &k);
+}
+
+/*
+ * SQL function jsonbc_key_ids(jsonbc)
+ *
+ * Ids of all the object keys in the value, at any nesting level, in the
+ * order they are stored, along with the ids of string values stored in the
+ * dictionary.  Doesn't look anything up in the dictionary, so it's cheap
+ * enough for collecting key frequencies over whole tables.
+ */
+Datum
+jsonbc_key_ids(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	JsonbcIteratorToken r;
+	Datum	   *ids;
+	int			nids = 0,
+				size = 16;
+
+	ids = (Datum *) palloc(sizeof(Datum) * size);
+
+	it = JsonbcIteratorInitKeyIds(&jb->root);
+	while ((r = JsonbcIteratorNext(&it, &v, false)) != WJB_DONE)
+	{
+		if (r != WJB_KEY &&
+			!(r == WJB_VALUE && v.type == jbvString &&
+			  v.val.string.id != InvalidKeyId))
+			continue;
+
+		if (nids >= size)
+		{
+			size *= 2;
+			ids = (Datum *) repalloc(ids, sizeof(Datum) * size);
+		}
+		ids[nids++] = Int32GetDatum(r == WJB_KEY ? JsonbcIteratorKeyId(it) :
+									v.val.string.id);
+	}
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(ids, nids, INT4OID,
+										  sizeof(int32), true, 'i'));
+}
+
+/*
+ * SQL function jsonbc_remap_keys(jsonbc, int4[])
+ *
+ * Replace each key id with the map element whose subscript is the old id.
+ * Ids out of the subscript range are kept.
+ */
+Datum
+jsonbc_remap_keys(PG_FUNCTION_ARGS)
+{
+	Jsonbc	   *jb = PG_GETARG_JSONB(0);
+	ArrayType  *map = PG_GETARG_ARRAYTYPE_P(1);
+	int32	   *mapData;
+	int			mapSize;
+
+	if (ARR_NDIM(map) != 1 || ARR_HASNULL(map) ||
+		ARR_ELEMTYPE(map) != INT4OID || ARR_LBOUND(map)[0] < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("key map must be a one-dimensional integer array without nulls, with positive subscripts")));
+
+	/* No nulls and fixed-size elements, so we can use the data directly */
+	mapData = (int32 *) ARR_DATA_PTR(map);
+	mapSize = ArrayGetNItems(ARR_NDIM(map), ARR_DIMS(map));
+
+	PG_RETURN_POINTER(JsonbcRemapKeys(jb, mapData, ARR_LBOUND(map)[0], mapSize));
+}
+
+/*
+ * Aggregate jsonbc_key_stats(jsonbc)
+ *
+ * Per-key statistics of a set of values: number of occurrences, number of
+ * values of each type, estimate of the number of distinct values and the
+ * average value size.  Keys are counted by id, at any nesting level, and
+ * never looked up in the dictionary.  String values stored as dictionary ids
+ * are resolved, so that they hash the same as strings stored verbatim.  The
+ * state can be combined and serialized, so the aggregate runs in parallel.
+ *
+ * Distinct values are counted exactly by their hashes as long as a key has
+ * a few of them, which keeps the state of schemaless data with many rare
+ * keys small.  Beyond that, they are estimated with a HyperLogLog sketch,
+ * which is easy to merge: the merged register is the maximum of the two.
+ */
+#define KEY_STATS_HLL_BITS		10
+#define KEY_STATS_HLL_REGISTERS	(1 << KEY_STATS_HLL_BITS)
+#define KEY_STATS_HASHES		16
+
+typedef enum
+{
+	KEY_STATS_NULL,
+	KEY_STATS_STRING,
+	KEY_STATS_NUMBER,
+	KEY_STATS_BOOL,
+	KEY_STATS_ARRAY,
+	KEY_STATS_OBJECT,
+	KEY_STATS_NTYPES
+} KeyStatsType;
+
+typedef struct
+{
+	int32		dict;			/* hash key: dict, id */
+	int32		id;
+	int64		count;
+	int64		types[KEY_STATS_NTYPES];
+	int64		bytes;
+	int32		nhashes;		/* number of hashes, -1 in the serialized
+								 * form when the registers follow */
+	uint32		hashes[KEY_STATS_HASHES];	/* distinct value hashes */
+	uint8	   *hll;			/* HLL registers once hashes overflowed */
+} KeyStats;
+
+/*
+ * The serialized state is a sequence of KeyStats headers, each followed by
+ * the hashes or the registers of the key.
+ */
+#define KEY_STATS_HEADER_SIZE	offsetof(KeyStats, hashes)
+
+typedef struct
+{
+	HTAB	   *hash;
+	MemoryContext context;		/* of the registers */
+} KeyStatsState;
+
+static KeyStatsState *
+keyStatsCreate(MemoryContext aggcontext)
+{
+	KeyStatsState *state;
+	HASHCTL		ctl;
+
+	state = (KeyStatsState *) MemoryContextAlloc(aggcontext, sizeof(KeyStatsState));
 
-	return findJsonbcValueFromContainer(container, flags, &k);
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = 2 * sizeof(int32);
+	ctl.entrysize = sizeof(KeyStats);
+	ctl.hash = tag_hash;
+	ctl.hcxt = aggcontext;
+	state->hash = hash_create("jsonbc key stats", 256, &ctl,
+							  HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	state->context = aggcontext;
+	return state;
+}
+
+static KeyStats *
+keyStatsGet(KeyStatsState *state, int32 dict, int32 id)
+{
+	KeyStats   *stats;
+	int32		key[2];
+	bool		found;
+
+	key[0] = dict;
+	key[1] = id;
+	stats = (KeyStats *) hash_search(state->hash, (const void *) key,
+									 HASH_ENTER, &found);
+	if (!found)
+	{
+		stats->count = 0;
+		memset(stats->types, 0, sizeof(stats->types));
+		stats->bytes = 0;
+		stats->nhashes = 0;
+		stats->hll = NULL;
+	}
+	return stats;
+}
+
+static void
+hllAdd(uint8 *registers, uint32 hash)
+{
+	uint32		index = hash >> (32 - KEY_STATS_HLL_BITS);
+	uint32		rest = hash << KEY_STATS_HLL_BITS;
+	uint8		rank = 1;
+
+	/* Position of the leftmost one bit of the rest of the hash */
+	while (rank <= 32 - KEY_STATS_HLL_BITS && !(rest & 0x80000000))
+	{
+		rank++;
+		rest <<= 1;
+	}
+
+	if (registers[index] < rank)
+		registers[index] = rank;
+}
+
+/*
+ * Switch the key over from the exact hashes to the registers.
+ */
+static void
+keyStatsSketch(KeyStatsState *state, KeyStats *stats)
+{
+	int			i;
+
+	stats->hll = (uint8 *) MemoryContextAllocZero(state->context,
+												  KEY_STATS_HLL_REGISTERS);
+	for (i = 0; i < stats->nhashes; i++)
+		hllAdd(stats->hll, stats->hashes[i]);
+	stats->nhashes = 0;
+}
+
+static void
+keyStatsAddHash(KeyStatsState *state, KeyStats *stats, uint32 hash)
+{
+	int			i;
+
+	if (!stats->hll)
+	{
+		for (i = 0; i < stats->nhashes; i++)
+		{
+			if (stats->hashes[i] == hash)
+				return;
+		}
+		if (stats->nhashes < KEY_STATS_HASHES)
+		{
+			stats->hashes[stats->nhashes++] = hash;
+			return;
+		}
+		keyStatsSketch(state, stats);
+	}
+	hllAdd(stats->hll, hash);
+}
+
+static double
+hllEstimate(const uint8 *registers)
+{
+	double		m = KEY_STATS_HLL_REGISTERS;
+	double		sum = 0.0;
+	double		estimate;
+	int			zeros = 0;
+	int			i;
+
+	for (i = 0; i < KEY_STATS_HLL_REGISTERS; i++)
+	{
+		sum += ldexp(1.0, -registers[i]);
+		if (registers[i] == 0)
+			zeros++;
+	}
+
+	estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+
+	/* Small and large range corrections */
+	if (estimate <= 2.5 * m && zeros > 0)
+		estimate = m * log(m / zeros);
+	else if (estimate > 4294967296.0 / 30.0)
+		estimate = -4294967296.0 * log(1.0 - estimate / 4294967296.0);
+
+	return estimate;
+}
+
+/*
+ * Account a value of the key.  Containers are only counted here, their type
+ * is accounted by keyStatsWalk() which learns it from the iterator.
+ */
+static void
+keyStatsAddValue(KeyStatsState *state, KeyStats *stats, JsonbcValue *v)
+{
+	uint32		hash;
+
+	stats->count++;
+
+	switch (v->type)
+	{
+		case jbvNull:
+			stats->types[KEY_STATS_NULL]++;
+			hash = DatumGetUInt32(hash_uint32(0));
+			break;
+		case jbvBool:
+			stats->types[KEY_STATS_BOOL]++;
+			hash = DatumGetUInt32(hash_uint32(v->val.boolean ? 2 : 1));
+			stats->bytes += 1;
+			break;
+		case jbvString:
+			stats->types[KEY_STATS_STRING]++;
+			if (v->val.string.id != InvalidKeyId)
+			{
+				/* Stored as a dictionary id, hashed as the string itself */
+				uint32		id = v->val.string.id;
+				KeyName		name = getNameById(v->val.string.dict, id);
+
+				if (name.s)
+					hash = DatumGetUInt32(hash_any((unsigned char *) name.s,
+												   name.len));
+				else
+					hash = DatumGetUInt32(hash_uint32(id));
+				for (; id > 0x7F; id >>= 7)
+					stats->bytes++;
+				stats->bytes++;
+				break;
+			}
+			hash = DatumGetUInt32(hash_any((unsigned char *) v->val.string.val,
+										   v->val.string.len));
+			stats->bytes += v->val.string.len;
+			break;
+		case jbvNumeric:
+			stats->types[KEY_STATS_NUMBER]++;
+			hash = DatumGetUInt32(DirectFunctionCall1(hash_numeric,
+										NumericGetDatum(v->val.numeric)));
+			stats->bytes += VARSIZE_ANY(v->val.numeric);
+			break;
+		case jbvBinary:
+			hash = DatumGetUInt32(hash_any((unsigned char *) v->val.binary.data,
+										   v->val.binary.len));
+			stats->bytes += v->val.binary.len;
+			break;
+		default:
+			elog(ERROR, "unknown type of jsonbc container");
+	}
+
+	keyStatsAddHash(state, stats, hash);
+}
+
+/*
+ * Account all the keys of a container and its nested containers.  "parent"
+ * is the statistics of the key the container is the value of, if any.
+ */
+static void
+keyStatsWalk(KeyStatsState *state, JsonbcContainer *container, int32 dict,
+			 KeyStats *parent)
+{
+	JsonbcIterator *it;
+	JsonbcValue	v;
+	JsonbcIteratorToken r;
+	int32		id = InvalidKeyId;
+
+	check_stack_depth();
+
+	it = JsonbcIteratorInitKeyIds(container);
+	while ((r = JsonbcIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		if (r == WJB_BEGIN_OBJECT || r == WJB_BEGIN_ARRAY)
+		{
+			if (parent)
+				parent->types[r == WJB_BEGIN_OBJECT ? KEY_STATS_OBJECT :
+							  KEY_STATS_ARRAY]++;
+		}
+		else if (r == WJB_KEY)
+		{
+			id = JsonbcIteratorKeyId(it);
+		}
+		else if (r == WJB_VALUE)
+		{
+			KeyStats   *stats = keyStatsGet(state, dict, id);
+
+			keyStatsAddValue(state, stats, &v);
+			if (v.type == jbvBinary)
+				keyStatsWalk(state, v.val.binary.data, dict, stats);
+		}
+		else if (r == WJB_ELEM && v.type == jbvBinary)
+		{
+			keyStatsWalk(state, v.val.binary.data, dict, NULL);
+		}
+	}
+}
+
+Datum
+jsonbc_key_stats_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	KeyStatsState *state;
+	Jsonbc	   *jb;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "jsonbc_key_stats_transfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? keyStatsCreate(aggcontext) :
+		(KeyStatsState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	/* Statistics live in aggcontext, iterators in the per-call context */
+	jb = PG_GETARG_JSONB(1);
+	keyStatsWalk(state, &jb->root, JsonbcGetDict(jb), NULL);
+
+	PG_RETURN_POINTER(state);
+}
+
+Datum
+jsonbc_key_stats_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	KeyStatsState *state1,
+			   *state2;
+	HASH_SEQ_STATUS scan;
+	KeyStats   *stats2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "jsonbc_key_stats_combine called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(PG_ARGISNULL(0) ? NULL : PG_GETARG_POINTER(0));
+
+	state1 = PG_ARGISNULL(0) ? keyStatsCreate(aggcontext) :
+		(KeyStatsState *) PG_GETARG_POINTER(0);
+	state2 = (KeyStatsState *) PG_GETARG_POINTER(1);
+
+	hash_seq_init(&scan, state2->hash);
+	while ((stats2 = (KeyStats *) hash_seq_search(&scan)) != NULL)
+	{
+		KeyStats   *stats1 = keyStatsGet(state1, stats2->dict, stats2->id);
+		int			i;
+
+		stats1->count += stats2->count;
+		for (i = 0; i < KEY_STATS_NTYPES; i++)
+			stats1->types[i] += stats2->types[i];
+		stats1->bytes += stats2->bytes;
+		if (stats2->hll)
+		{
+			if (!stats1->hll)
+				keyStatsSketch(state1, stats1);
+			for (i = 0; i < KEY_STATS_HLL_REGISTERS; i++)
+				stats1->hll[i] = Max(stats1->hll[i], stats2->hll[i]);
+		}
+		else
+		{
+			for (i = 0; i < stats2->nhashes; i++)
+				keyStatsAddHash(state1, stats1, stats2->hashes[i]);
+		}
+	}
+
+	PG_RETURN_POINTER(state1);
+}
+
+Datum
+jsonbc_key_stats_serialize(PG_FUNCTION_ARGS)
+{
+	KeyStatsState *state = (KeyStatsState *) PG_GETARG_POINTER(0);
+	Size		size = 0;
+	bytea	   *result;
+	char	   *ptr;
+	KeyStats   *stats;
+	HASH_SEQ_STATUS scan;
+
+	hash_seq_init(&scan, state->hash);
+	while ((stats = (KeyStats *) hash_seq_search(&scan)) != NULL)
+		size += KEY_STATS_HEADER_SIZE + (stats->hll ? KEY_STATS_HLL_REGISTERS :
+										 stats->nhashes * sizeof(uint32));
+
+	result = (bytea *) palloc(VARHDRSZ + size);
+	SET_VARSIZE(result, VARHDRSZ + size);
+	ptr = VARDATA(result);
+
+	hash_seq_init(&scan, state->hash);
+	while ((stats = (KeyStats *) hash_seq_search(&scan)) != NULL)
+	{
+		KeyStats	header = *stats;
+
+		if (stats->hll)
+		{
+			header.nhashes = -1;
+			memcpy(ptr, &header, KEY_STATS_HEADER_SIZE);
+			ptr += KEY_STATS_HEADER_SIZE;
+			memcpy(ptr, stats->hll, KEY_STATS_HLL_REGISTERS);
+			ptr += KEY_STATS_HLL_REGISTERS;
+		}
+		else
+		{
+			memcpy(ptr, &header, KEY_STATS_HEADER_SIZE);
+			ptr += KEY_STATS_HEADER_SIZE;
+			memcpy(ptr, stats->hashes, stats->nhashes * sizeof(uint32));
+			ptr += stats->nhashes * sizeof(uint32);
+		}
+	}
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+Datum
+jsonbc_key_stats_deserialize(PG_FUNCTION_ARGS)
+{
+	bytea	   *data = PG_GETARG_BYTEA_PP(0);
+	MemoryContext aggcontext;
+	KeyStatsState *state;
+	KeyStats	src;
+	char	   *ptr,
+			   *end;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "jsonbc_key_stats_deserialize called in non-aggregate context");
+
+	state = keyStatsCreate(aggcontext);
+	ptr = VARDATA_ANY(data);
+	end = ptr + VARSIZE_ANY_EXHDR(data);
+	while (ptr < end)
+	{
+		KeyStats   *stats;
+
+		/* The data is not necessarily aligned */
+		memcpy(&src, ptr, KEY_STATS_HEADER_SIZE);
+		ptr += KEY_STATS_HEADER_SIZE;
+		stats = keyStatsGet(state, src.dict, src.id);
+		stats->count = src.count;
+		memcpy(stats->types, src.types, sizeof(stats->types));
+		stats->bytes = src.bytes;
+		if (src.nhashes < 0)
+		{
+			stats->hll = (uint8 *) MemoryContextAlloc(aggcontext,
+													  KEY_STATS_HLL_REGISTERS);
+			memcpy(stats->hll, ptr, KEY_STATS_HLL_REGISTERS);
+			ptr += KEY_STATS_HLL_REGISTERS;
+		}
+		else
+		{
+			stats->nhashes = src.nhashes;
+			memcpy(stats->hashes, ptr, src.nhashes * sizeof(uint32));
+			ptr += src.nhashes * sizeof(uint32);
+		}
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+static int
+keyStatsCmp(const void *a, const void *b)
+{
+	const KeyStats *s1 = *(KeyStats *const *) a;
+	const KeyStats *s2 = *(KeyStats *const *) b;
+
+	if (s1->dict != s2->dict)
+		return (s1->dict > s2->dict) ? 1 : -1;
+	if (s1->id != s2->id)
+		return (s1->id > s2->id) ? 1 : -1;
+	return 0;
+}
+
+/*
+ * Final function: an array of jsonbc_key_stat records ordered by key.
+ */
+Datum
+jsonbc_key_stats_finalfn(PG_FUNCTION_ARGS)
+{
+	KeyStatsState *state;
+	Oid			elemType;
+	TupleDesc	tupdesc;
+	KeyStats  **sorted;
+	Datum	   *elems;
+	long		nkeys,
+				i;
+	HASH_SEQ_STATUS scan;
+	KeyStats   *stats;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	state = (KeyStatsState *) PG_GETARG_POINTER(0);
+
+	elemType = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+	if (!OidIsValid(elemType))
+		elog(ERROR, "could not determine jsonbc_key_stats result type");
+	tupdesc = lookup_rowtype_tupdesc_copy(elemType, -1);
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	nkeys = hash_get_num_entries(state->hash);
+	sorted = (KeyStats **) palloc(sizeof(KeyStats *) * Max(nkeys, 1));
+	i = 0;
+	hash_seq_init(&scan, state->hash);
+	while ((stats = (KeyStats *) hash_seq_search(&scan)) != NULL)
+		sorted[i++] = stats;
+	qsort(sorted, nkeys, sizeof(KeyStats *), keyStatsCmp);
+
+	elems = (Datum *) palloc(sizeof(Datum) * Max(nkeys, 1));
+	for (i = 0; i < nkeys; i++)
+	{
+		Datum		values[11];
+		bool		nulls[11];
+
+		stats = sorted[i];
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int32GetDatum(stats->dict);
+		values[1] = Int32GetDatum(stats->id);
+		values[2] = Int64GetDatum(stats->count);
+		values[3] = Int64GetDatum(stats->types[KEY_STATS_NULL]);
+		values[4] = Int64GetDatum(stats->types[KEY_STATS_STRING]);
+		values[5] = Int64GetDatum(stats->types[KEY_STATS_NUMBER]);
+		values[6] = Int64GetDatum(stats->types[KEY_STATS_BOOL]);
+		values[7] = Int64GetDatum(stats->types[KEY_STATS_ARRAY]);
+		values[8] = Int64GetDatum(stats->types[KEY_STATS_OBJECT]);
+		values[9] = Int64GetDatum(stats->hll ?
+								  (int64) (hllEstimate(stats->hll) + 0.5) :
+								  (int64) stats->nhashes);
+		values[10] = Float8GetDatum((double) stats->bytes / stats->count);
+
+		elems[i] = HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+	}
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, nkeys, elemType,
+										  -1, false, 'd'));
 }
@@ -192,6 +192,7 @@ SELECT '{ "name": "Bob", "tags": [ "enim", "qui"]}'::jsonbc @> '{"tags":["qu"]}'
 -- array length
 SELECT jsonbc_array_length('[1,2,3,{"f1":1,"f2":[5,6]},4]');
 SELECT jsonbc_array_length('[]');
+SELECT jsonbc_array_length((SELECT jsonb_agg(i)::text FROM generate_series(1, 1000) i)::jsonbc);
 SELECT jsonbc_array_length('{"f1":1,"f2":[5,6]}');
 SELECT jsonbc_array_length('4');
 
@@ -480,6 +481,20 @@ SELECT count(*) FROM testjsonbc WHERE j @> '{}';
 RESET enable_seqscan;
 DROP INDEX jidx;
 
+--gin key path opclass
+CREATE INDEX jidx ON testjsonbc USING gin (j jsonbc_key_path_ops);
+SET enable_seqscan = off;
+
+SELECT count(*) FROM testjsonbc WHERE j ?# '{public}';
+SELECT count(*) FROM testjsonbc WHERE j ?# '{foo}';
+SELECT count(*) FROM testjsonbc WHERE j ?# '{foo,bar}';
+SELECT count(*) FROM testjsonbc WHERE j ?# '{bar}';
+-- excercise GIN_SEARCH_MODE_ALL
+SELECT count(*) FROM testjsonbc WHERE j ?# '{}';
+
+RESET enable_seqscan;
+DROP INDEX jidx;
+
 -- nested tests
 SELECT '{"ff":{"a":12,"b":16}}'::jsonbc;
 SELECT '{"ff":{"a":12,"b":16},"qq":123}'::jsonbc;
@@ -557,3 +572,210 @@ SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonbc ? 'b';
 SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonbc ? 'c';
 SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonbc ? 'd';
 SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonbc ? 'e';
+
+-- lookups of unknown keys must not add them to the dictionary
+SELECT '{"a":1}'::jsonbc ? 'no such key';
+SELECT '{"a":1}'::jsonbc -> 'no such key';
+SELECT '{"a":1}'::jsonbc #> '{no such key}';
+SELECT count(*) FROM jsonbc_dict WHERE name = 'no such key';
+
+-- repeated lookups of an unknown key are answered from the negative cache
+SELECT hits AS hits_before FROM jsonbc_negative_cache_stats() \gset
+SELECT '{"a":1}'::jsonbc ? k FROM (VALUES ('absent key'), ('absent key'), ('absent key')) v(k);
+SELECT hits - :hits_before AS hits, entries FROM jsonbc_negative_cache_stats();
+
+-- prewarm loads every key not cached yet
+\c
+SET jsonbc.dict_prewarm = on;
+SELECT jsonbc_dict_prewarm() = (SELECT count(*) FROM jsonbc_dict WHERE NOT retired);
+RESET jsonbc.dict_prewarm;
+SELECT jsonbc_dict_prewarm();
+
+-- key ids and remapping
+SELECT cardinality(jsonbc_key_ids('{"a":1,"b":{"a":2,"c":[{"d":3}]}}'));
+SELECT jsonbc_key_ids('[1,2,"a"]');
+SELECT jsonbc_remap_keys(v, (SELECT array_agg(g ORDER BY g) FROM generate_series(1, (SELECT max(id) FROM jsonbc_dict)) g)) = v
+FROM (VALUES ('{"a":1,"b":{"a":2,"c":[{"d":3}]}}'::jsonbc)) t(v);
+
+-- named dictionaries
+SELECT jsonbc_create_dict('tenant') > 0;
+CREATE TABLE test_dict (v jsonbc(tenant));
+COPY test_dict FROM stdin;
+{"tenant_key": {"b": [1, 2]}}
+\.
+SELECT format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'test_dict'::regclass AND attname = 'v';
+SELECT v FROM test_dict;
+SELECT v->'tenant_key' FROM test_dict;
+SELECT v->'tenant_key' @> '{"b": [2]}' FROM test_dict;
+SELECT dict = 0 AS in_default, count(*) FROM jsonbc_dict WHERE name = 'tenant_key' GROUP BY 1;
+SELECT jsonbc_dict_id('{"x": 1}'::jsonbc::jsonbc(tenant)) > 0;
+SELECT count(*) FROM test_dict WHERE v = '{"tenant_key": {"b": [1, 2]}}';
+SELECT v->'tenant_key' = '{"b": [1, 2]}' FROM test_dict;
+SELECT '[1, 2]'::jsonbc(tenant) = '[1, 2]'::jsonbc;
+SELECT '{"y_key": 1, "x_key": 2}'::jsonbc(tenant) = '{"x_key": 2, "y_key": 1}'::jsonbc;
+SELECT jsonbc_hash('{"y_key": 1, "x_key": 2}'::jsonbc(tenant)) = jsonbc_hash('{"x_key": 2, "y_key": 1}');
+SELECT '{"x_key": 1, "y_key": 9}'::jsonbc < '{"x_key": 2, "y_key": 0}'::jsonbc,
+       '{"x_key": 1, "y_key": 9}'::jsonbc(tenant) < '{"x_key": 2, "y_key": 0}'::jsonbc;
+-- untyped input goes into the dictionary of the column
+INSERT INTO test_dict VALUES ('{"lazy_literal": 1}');
+PREPARE lazy_insert(jsonbc) AS INSERT INTO test_dict VALUES ($1);
+EXECUTE lazy_insert('{"lazy_param": 1}');
+DEALLOCATE lazy_insert;
+SELECT name, dict = 0 AS in_default FROM jsonbc_dict WHERE name LIKE 'lazy_%' ORDER BY name;
+DROP TABLE test_dict;
+
+-- changes of existing entries invalidate the cache
+SELECT jsonbc_dict_generation() AS gen_before \gset
+DELETE FROM jsonbc_dict WHERE name = 'no such key';
+SELECT jsonbc_dict_generation() > :gen_before;
+SELECT '{"a": {"b": 1}}'::jsonbc;
+
+-- VACUUM and ANALYZE of jsonbc_dict keep the cache
+SELECT jsonbc_dict_generation() AS gen_before \gset
+VACUUM ANALYZE jsonbc_dict;
+SELECT '{"a": {"b": 1}}'::jsonbc;
+SELECT jsonbc_dict_generation() = :gen_before;
+
+-- keys evicted from a small cache are looked up again
+SET jsonbc.dict_cache_size = 1;
+SELECT (('{' || string_agg(format('"evict%s": %s', g, g), ', ') || '}')::jsonbc)->>'evict77' FROM generate_series(1, 200) g;
+SELECT ('{"evict5": 5, "evict150": 150}'::jsonbc)->>'evict150';
+RESET jsonbc.dict_cache_size;
+
+-- the limit holds within a transaction, for the keys it adds as well
+BEGIN;
+SET LOCAL jsonbc.dict_cache_size = 1;
+SELECT count(*) FROM generate_series(1, 20) i,
+	LATERAL (SELECT ('{' || string_agg(format('"txcap%s_%s": %s', i, g, g), ', ') || '}')::jsonbc AS j
+			 FROM generate_series(1, 50) g) s
+	WHERE s.j->>format('txcap%s_7', i) = '7';
+SELECT bytes < 16384 FROM pg_stat_jsonbc_dict WHERE scope = 'backend';
+SELECT ('{"txcap3_7": 7, "txcap19_50": 50}'::jsonbc)->>'txcap19_50';
+COMMIT;
+
+-- dictionary statistics
+SELECT '{"a": 1}'::jsonbc->'a';
+SELECT jsonbc_dict_stats_reset();
+SELECT '{"a": 1}'::jsonbc->'a';
+SELECT scope, name_hits > 0 AS hit, name_misses, spi_calls FROM pg_stat_jsonbc_dict WHERE scope = 'backend';
+
+-- key statistics
+SELECT s.count, s.nulls, s.strings, s.numbers, s.objects, s.distinct_values, s.avg_size > 0 AS has_size
+FROM unnest((SELECT jsonbc_key_stats(v) FROM (VALUES
+	('{"stat_k": "a"}'::jsonbc), ('{"stat_k": 1}'), ('{"stat_k": "a"}'),
+	('[{"stat_k": {"stat_k": null}}]')) t(v))) s
+WHERE s.id = get_id_by_name('stat_k');
+
+-- garbage collection of unused keys
+SELECT jsonbc_create_dict('gc') > 0;
+CREATE TABLE test_gc (v jsonbc(gc));
+INSERT INTO test_gc VALUES ('{"alive": 1}');
+SELECT '{"dead": 1}'::jsonbc::jsonbc(gc);
+SELECT * FROM jsonbc_dict_gc('gc');
+SELECT * FROM jsonbc_dict_gc('gc');
+SELECT * FROM jsonbc_dict_gc('gc');
+DELETE FROM test_gc;
+SELECT * FROM jsonbc_dict_gc('gc');
+SELECT version AS gc_version FROM jsonbc_dict_version \gset
+INSERT INTO test_gc VALUES ('{"alive": 2}');
+SELECT d.name, d.retired FROM jsonbc_dict d JOIN jsonbc_dicts s ON s.id = d.dict WHERE s.name = 'gc';
+-- reviving a key doesn't invalidate the caches
+SELECT version = :gc_version FROM jsonbc_dict_version;
+SELECT * FROM jsonbc_dict_gc('gc');
+DROP TABLE test_gc;
+
+-- online renumbering
+SELECT jsonbc_create_dict('renum') > 0;
+CREATE TABLE test_renum (i int, v jsonbc(renum));
+COPY test_renum FROM stdin;
+1	{"rare": 1}
+2	{"common": 2}
+3	{"common": {"common": 3}}
+\.
+SELECT * FROM jsonbc_renumber_keys('renum');
+SELECT i, v, v->'common' FROM test_renum ORDER BY i;
+COPY test_renum FROM stdin;
+4	{"late": 4}
+\.
+SELECT d.id > r.base + r.nkeys AS above FROM jsonbc_dict d JOIN jsonbc_renumber r ON r.dict = d.dict WHERE d.name = 'late';
+SELECT * FROM jsonbc_renumber_keys('renum');
+SELECT * FROM jsonbc_renumber_keys('renum');
+SELECT * FROM jsonbc_renumber_keys('renum');
+SELECT * FROM jsonbc_renumber_keys('renum');
+SELECT i, v, v->'common' FROM test_renum ORDER BY i;
+SELECT d.name FROM jsonbc_dict d JOIN jsonbc_dicts s ON s.id = d.dict WHERE s.name = 'renum' ORDER BY d.id;
+DROP TABLE test_renum;
+
+-- string values stored in the dictionary
+SELECT jsonbc_dict_encode_values('default', 'enc_node') > 0;
+SELECT '{"enc_node": "CBC"}'::jsonbc;
+SELECT '{"enc_node": "CBC"}'::jsonbc->>'enc_node';
+SELECT '{"enc_node": "CBC"}'::jsonbc = '{"enc_node": "CBC"}'::jsonbc,
+	'{"enc_node": "CBC"}'::jsonbc = '{"enc_node": "AA"}'::jsonbc,
+	'{"a": [{"enc_node": "CBC"}]}'::jsonbc @> '{"a": [{"enc_node": "CBC"}]}';
+SELECT pg_column_size('{"enc_node": "some repeated value"}'::jsonbc) <
+	pg_column_size('{"enc_plain": "some repeated value"}'::jsonbc);
+SELECT get_name_by_id(i) FROM unnest(jsonbc_key_ids('{"enc_node": "CBC"}')) i ORDER BY 1;
+
+-- dictionary file
+SELECT jsonbc_dict_export() = (SELECT count(*) FROM jsonbc_dict WHERE NOT retired);
+SELECT version > 0 FROM jsonbc_dict_version;
+
+-- only the functions which might add keys are parallel unsafe
+SELECT proname, proparallel FROM pg_proc WHERE proname IN ('jsonbc_in', 'jsonbc_out', 'jsonbc_exists', 'get_id_by_name') ORDER BY 1;
+
+-- key name patterns
+SELECT '{"kp_alpha": 1, "kp_beta": "x", "other": 2}'::jsonbc ?~~ 'kp_%',
+	'{"kp_alpha": 1}'::jsonbc ?~~ 'kp_b%',
+	'{"kp_alpha": 1}'::jsonbc ?~ '^kp_(a|b)',
+	'["kp_alpha"]'::jsonbc ?~~ 'kp%';
+SELECT * FROM jsonbc_each_key_like('{"kp_alpha": 1, "kp_beta": "x", "other": {"kp_gamma": 2}}', 'kp%') ORDER BY key;
+SELECT * FROM jsonbc_each_key_regex('{"kp_alpha": 1, "kp_beta": "x", "other": {"kp_gamma": 2}}', 'a$|^oth') ORDER BY key;
+SELECT * FROM jsonbc_each_key_like('{"enc_node": "CBC", "kp_alpha": 1}', 'enc%');
+
+-- key name patterns in a parallel query
+SELECT proname, proparallel FROM pg_proc WHERE proname IN ('jsonbc_exists_key_like', 'jsonbc_each_key_regex') ORDER BY 1;
+CREATE TABLE test_kp_parallel (j jsonbc);
+INSERT INTO test_kp_parallel VALUES ('{"kp_alpha": 1}'), ('{"kp_beta": 2}'), ('{"other": 3}');
+DO $$ BEGIN PERFORM set_config(name, 'on', false) FROM pg_settings WHERE name IN ('debug_parallel_query', 'force_parallel_mode'); END $$;
+SELECT j FROM test_kp_parallel WHERE j ?~~ 'kp_%' ORDER BY j::text;
+SELECT count(*) FROM test_kp_parallel WHERE j ?~ '^kp_b';
+SELECT e.key FROM test_kp_parallel t, jsonbc_each_key_regex(t.j, '^kp_') e ORDER BY 1;
+DO $$ BEGIN PERFORM set_config(name, 'off', false) FROM pg_settings WHERE name IN ('debug_parallel_query', 'force_parallel_mode'); END $$;
+DROP TABLE test_kp_parallel;
+
+-- output from a holdable cursor, after the transaction which declared it
+CREATE TABLE test_hold (j jsonbc);
+INSERT INTO test_hold VALUES ('{"hold_key": [1, "x"]}');
+\c
+BEGIN;
+DECLARE hold_cur CURSOR WITH HOLD FOR SELECT j FROM test_hold;
+COMMIT;
+FETCH ALL FROM hold_cur;
+CLOSE hold_cur;
+DROP TABLE test_hold;
+
+-- key statistics of a parallel aggregate, with string values stored both ways
+CREATE TABLE test_key_stats (v jsonbc);
+INSERT INTO test_key_stats
+	SELECT format('{"ks_many": %s, "ks_few": "v%s", "ks_enc": "x"}', i, i % 3)::jsonbc
+	FROM generate_series(1, 200) i;
+SELECT jsonbc_dict_encode_values('default', 'ks_enc') > 0;
+INSERT INTO test_key_stats VALUES ('{"ks_enc": "x"}'), ('{"ks_enc": "y"}');
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+DO $$ BEGIN PERFORM set_config(name, 'on', false) FROM pg_settings WHERE name IN ('debug_parallel_query', 'force_parallel_mode'); END $$;
+SELECT get_name_by_id(s.id) AS key, s.count, s.strings, s.numbers,
+	CASE WHEN s.distinct_values <= 16 THEN s.distinct_values::text
+		 WHEN s.distinct_values BETWEEN 180 AND 220 THEN 'about 200' END AS distinct_values
+FROM unnest((SELECT jsonbc_key_stats(v) FROM test_key_stats)) s
+WHERE get_name_by_id(s.id) LIKE 'ks\_%'
+ORDER BY 1;
+DO $$ BEGIN PERFORM set_config(name, 'off', false) FROM pg_settings WHERE name IN ('debug_parallel_query', 'force_parallel_mode'); END $$;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE test_key_stats;